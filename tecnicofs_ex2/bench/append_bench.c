@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Small-record appends, as done by a log writer: records of record_size
+    bytes are appended to a log file, which is closed and replaced by the
+    next one (out of 4, reused) when it is full. The workload runs once for
+    each write buffer size (TFS_WRITE_BUFFER, 0 for no buffering); every
+    file is read back and checked at the end of each run.
+    Files only span one block, so larger buffers need a server (and this
+    benchmark) built with a larger block, e.g.
+        make clean all bench EXTRA_CFLAGS=-DBLOCK_SIZE=65536
+    Usage: append_bench client_pipe_path server_pipe_path
+                        [records] [record_size]
+*/
+
+#define LOG_FILES (4)
+
+static size_t const buffer_sizes[] = {0, 256, 1024, 4096, 16384};
+#define N_BUFFER_SIZES (sizeof(buffer_sizes) / sizeof(buffer_sizes[0]))
+
+/* Returns the number of log files with the expected contents */
+static int check(size_t per_file, size_t record_size) {
+    static char data[BLOCK_SIZE];
+    char name[MAX_FILE_NAME];
+    int good = 0;
+
+    for (int i = 0; i < LOG_FILES; i++) {
+        snprintf(name, sizeof(name), "/log%d", i);
+        int f = tfs_open(name, 0);
+        ssize_t rd = f != -1 ? tfs_read(f, data, sizeof(data)) : -1;
+        tfs_close(f);
+        if (rd != (ssize_t)(per_file * record_size)) {
+            continue;
+        }
+        size_t r = 0;
+        while (r < per_file && data[r * record_size] == (char)('A' + r % 26)) {
+            r++;
+        }
+        good += r == per_file;
+    }
+    return good;
+}
+
+static void run(char const *client_path, char const *server_path,
+                size_t buffer_size, long records, size_t record_size) {
+    char value[32];
+    snprintf(value, sizeof(value), "%zu", buffer_size);
+    setenv("TFS_WRITE_BUFFER", value, 1);
+    if (tfs_mount(client_path, server_path) == -1) {
+        exit(1);
+    }
+
+    char name[MAX_FILE_NAME];
+    char record[record_size];
+    size_t per_file = BLOCK_SIZE / record_size;
+    long errors = 0;
+    int f = -1, log = 0;
+    size_t in_file = per_file;
+
+    double start = bench_now();
+    for (long i = 0; i < records; i++) {
+        if (in_file == per_file) {
+            if (f != -1 && tfs_close(f) == -1) {
+                errors++;
+            }
+            snprintf(name, sizeof(name), "/log%d", log++ % LOG_FILES);
+            if ((f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC)) == -1) {
+                exit(1);
+            }
+            in_file = 0;
+        }
+        memset(record, 'A' + (int)(in_file % 26), record_size);
+        if (tfs_write(f, record, record_size) != (ssize_t)record_size) {
+            errors++;
+        }
+        in_file++;
+    }
+    if (tfs_close(f) == -1) {
+        errors++;
+    }
+    double elapsed = bench_now() - start;
+
+    /* only the files that were filled up can be checked */
+    int good = records >= (long)(per_file * LOG_FILES)
+                   ? check(per_file, record_size)
+                   : LOG_FILES;
+    tfs_unmount();
+
+    bench_result("\"buffer_size\": %zu, \"records\": %ld, \"seconds\": %.3f, "
+                 "\"records_per_s\": %.0f, \"mb_per_s\": %.2f, "
+                 "\"errors\": %ld, \"files_ok\": %d",
+                 buffer_size, records, elapsed, (double)records / elapsed,
+                 (double)records * (double)record_size / elapsed / 1e6,
+                 errors, good);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [records] [record_size]'\n");
+        return 1;
+    }
+    long records = argc > 3 ? atol(argv[3]) : 100000;
+    size_t record_size = argc > 4 ? (size_t)atol(argv[4]) : 50;
+    if (records <= 0 || record_size == 0 || record_size > BLOCK_SIZE) {
+        printf("records must be positive and record_size in [1, %d]\n",
+               BLOCK_SIZE);
+        return 1;
+    }
+
+    bench_begin(NULL, "append",
+                "\"config\": {\"block_size\": %d, \"record_size\": %zu}",
+                BLOCK_SIZE, record_size);
+    for (size_t b = 0; b < N_BUFFER_SIZES; b++) {
+        run(argv[1], argv[2], buffer_sizes[b], records, record_size);
+    }
+    bench_end();
+    return 0;
+}
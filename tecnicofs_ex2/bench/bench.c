@@ -0,0 +1,50 @@
+#include "bench.h"
+#include <stdarg.h>
+#include <time.h>
+
+static FILE *out;
+static int n_results;
+
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int bench_begin(char const *path, char const *name, char const *format,
+                ...) {
+    out = stdout;
+    if (path != NULL && (out = fopen(path, "w")) == NULL) {
+        perror("Fopen error");
+        return -1;
+    }
+    n_results = 0;
+
+    fprintf(out, "{\n  \"benchmark\": \"%s\",\n  ", name);
+    if (format != NULL) {
+        va_list args;
+        va_start(args, format);
+        vfprintf(out, format, args);
+        va_end(args);
+        fprintf(out, ",\n  ");
+    }
+    fprintf(out, "\"results\": [");
+    return 0;
+}
+
+void bench_result(char const *format, ...) {
+    fprintf(out, "%s\n    {", n_results++ > 0 ? "," : "");
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+    fprintf(out, "}");
+}
+
+void bench_end() {
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+/*
+ * What the benchmarks share: a clock, and the JSON document they write
+ * their results to,
+ *     {"benchmark": "<name>", <header fields>, "results": [{...}, ...]}
+ * written to the file given on their command line, or else to stdout.
+ */
+
+/* Seconds since some fixed point (CLOCK_MONOTONIC) */
+double bench_now();
+
+/*
+ * Opens the output (stdout if path is NULL) and writes the head of the
+ * document: the name and the header fields, given as a printf format of
+ * "key": value pairs (none if it is NULL).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int bench_begin(char const *path, char const *name, char const *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Writes one result, an object with the fields given as a printf format */
+void bench_result(char const *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/* Ends the document and closes the output */
+void bench_end();
+
+#endif // BENCH_H
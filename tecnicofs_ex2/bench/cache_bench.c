@@ -0,0 +1,181 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "common/stats.h"
+#include "fs/config.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*  Client cache under an 80/20 hot-set workload: each operation opens one of
+    the files, reads all of it and closes it; 80% of the operations go to
+    the hottest 20% of the files. The workload runs once without the cache
+    and once with it (TFS_CACHE=1). With a writer interval, a second
+    session rewrites a random file that often, revoking the leases on it.
+    Usage: cache_bench client_pipe_path server_pipe_path
+                       [ops] [files] [writer_interval_ms]
+*/
+
+#define FILE_SIZE (512)
+
+static long n_ops;
+static int n_files;
+
+/* Returns the name of a file */
+static void file_name(char *name, size_t size, int i) {
+    snprintf(name, size, "/hot%d", i);
+}
+
+/* Rewrites a file with its contents all set to c */
+static int rewrite(int i, char c) {
+    char name[MAX_FILE_NAME];
+    char data[FILE_SIZE];
+    file_name(name, sizeof(name), i);
+    memset(data, c, sizeof(data));
+
+    int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t w = tfs_write(f, data, sizeof(data));
+    tfs_close(f);
+    return w == FILE_SIZE ? 0 : -1;
+}
+
+/* Picks a file: 80% of the picks fall on the first 20% of the files */
+static int pick(unsigned int *seed) {
+    int hot = n_files / 5 > 0 ? n_files / 5 : 1;
+    if (rand_r(seed) % 100 < 80) {
+        return rand_r(seed) % hot;
+    }
+    return rand_r(seed) % n_files;
+}
+
+/* Second session: rewrites a random file every interval_ms until killed */
+static void writer(char const *client_path, char const *server_path,
+                   long interval_ms) {
+    if (tfs_mount(client_path, server_path) == -1) {
+        exit(1);
+    }
+    unsigned int seed = 7;
+    struct timespec interval = {interval_ms / 1000,
+                                (interval_ms % 1000) * 1000000};
+    for (char c = 'a';; c = c == 'z' ? 'a' : (char)(c + 1)) {
+        if (rewrite(rand_r(&seed) % n_files, c) == -1) {
+            exit(1);
+        }
+        nanosleep(&interval, NULL);
+    }
+}
+
+static void run(char const *client_path, char const *server_path,
+                bool cached) {
+    static uint64_t latency[TFS_HIST_BUCKETS];
+    memset(latency, 0, sizeof(latency));
+
+    if (cached) {
+        setenv("TFS_CACHE", "1", 1);
+    } else {
+        unsetenv("TFS_CACHE");
+    }
+    if (tfs_mount(client_path, server_path) == -1) {
+        exit(1);
+    }
+
+    char name[MAX_FILE_NAME];
+    char data[FILE_SIZE];
+    unsigned int seed = 1;
+    long torn = 0, short_reads = 0;
+    double start = bench_now();
+    for (long i = 0; i < n_ops; i++) {
+        file_name(name, sizeof(name), pick(&seed));
+        double t = bench_now();
+        int f = tfs_open(name, 0);
+        ssize_t rd = f != -1 ? tfs_read(f, data, sizeof(data)) : -1;
+        if (f != -1) {
+            tfs_close(f);
+        }
+        latency[tfs_hist_bucket((uint64_t)((bench_now() - t) * 1e9))]++;
+
+        if (rd != FILE_SIZE) {
+            short_reads++;
+        } else if (memcmp(data, data + 1, FILE_SIZE - 1) != 0) {
+            /* every version of a file is a single repeated byte */
+            torn++;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    tfs_cache_stats_t cs;
+    tfs_cache_stats(&cs);
+    tfs_unmount();
+
+    uint64_t opens = cs.open_hits + cs.open_misses;
+    uint64_t reads = cs.read_hits + cs.read_misses;
+    bench_result("\"cache\": %s, \"ops\": %ld, \"seconds\": %.3f, "
+                 "\"ops_per_s\": %.0f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+                 "\"open_hit_rate\": %.3f, \"read_hit_rate\": %.3f, "
+                 "\"revocations\": %lu, \"short_reads\": %ld, \"torn\": %ld",
+                 cached ? "true" : "false", n_ops, elapsed,
+                 (double)n_ops / elapsed,
+                 (double)tfs_hist_percentile(latency, 0.5) / 1e3,
+                 (double)tfs_hist_percentile(latency, 0.99) / 1e3,
+                 opens > 0 ? (double)cs.open_hits / (double)opens : 0,
+                 reads > 0 ? (double)cs.read_hits / (double)reads : 0,
+                 (unsigned long)cs.revocations, short_reads, torn);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [ops] [files] [writer_interval_ms]'\n");
+        return 1;
+    }
+    n_ops = argc > 3 ? atol(argv[3]) : 100000;
+    n_files = argc > 4 ? atoi(argv[4]) : 20;
+    long interval_ms = argc > 5 ? atol(argv[5]) : 0;
+    if (n_ops <= 0 || n_files <= 0 || interval_ms < 0) {
+        printf("ops and files must be positive\n");
+        return 1;
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+    for (int i = 0; i < n_files; i++) {
+        if (rewrite(i, 'a') == -1) {
+            fprintf(stderr, "could not create the files\n");
+            return 1;
+        }
+    }
+    tfs_unmount();
+
+    pid_t pid = -1;
+    if (interval_ms > 0) {
+        char writer_path[41];
+        snprintf(writer_path, sizeof(writer_path), "%.38s_w", argv[1]);
+        pid = fork();
+        if (pid == 0) {
+            writer(writer_path, argv[2], interval_ms);
+        }
+    }
+
+    bench_begin(NULL, "client_cache",
+                "\"config\": {\"files\": %d, \"file_size\": %d, "
+                "\"hot_files\": %d, \"writer_interval_ms\": %ld}",
+                n_files, FILE_SIZE, n_files / 5 > 0 ? n_files / 5 : 1,
+                interval_ms);
+    run(argv[1], argv[2], false);
+    run(argv[1], argv[2], true);
+    bench_end();
+
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
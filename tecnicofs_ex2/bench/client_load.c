@@ -0,0 +1,316 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "common/stats.h"
+#include "fs/config.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*  Client-server load generator: forks M client processes, each with its
+    own session (and reply pipe) to a running server, that start together
+    and run one of the workloads below for a fixed time or number of
+    operations. Their latency histograms are merged into one report.
+      open:   open and close a file
+      write:  open, write io_size bytes (64 by default), close
+      read:   open, read a whole block, close
+      mixed:  one of the above at random (40% open, 30% write, 30% read)
+    Given several servers (e.g. a primary and its read replicas), the
+    clients are spread over them in turn; the files are created through
+    the first one.
+    Usage: client_load [-c clients] [-w open|write|read|mixed]
+                       [-d seconds | -n ops_per_client] [-s io_size]
+                       [-f files] [-j output.json] server_pipe_path...
+*/
+
+typedef enum { W_OPEN, W_WRITE, W_READ, W_MIXED } workload_t;
+
+/* what every client sends back to the parent */
+typedef struct {
+    long ops;
+    long errors;
+    uint64_t bytes;
+    double seconds;
+    uint64_t latency[TFS_HIST_BUCKETS];
+} client_result_t;
+
+static workload_t workload = W_MIXED;
+static double duration = 5.0;
+static long op_count;
+static size_t io_size = 64;
+static int n_files = 4;
+
+static int write_all(int fd, void const *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w <= 0) {
+            return -1;
+        }
+        buf = (char const *)buf + w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = read(fd, buf, len);
+        if (r <= 0) {
+            return -1;
+        }
+        buf = (char *)buf + r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+/* Runs one operation of the workload; returns the bytes moved, -1 on
+ * error */
+static ssize_t one_op(workload_t w, unsigned *seed, char *buffer) {
+    char name[MAX_FILE_NAME];
+    snprintf(name, sizeof(name), "/load%d", rand_r(seed) % n_files);
+
+    if (w == W_MIXED) {
+        int dice = rand_r(seed) % 10;
+        w = dice < 4 ? W_OPEN : dice < 7 ? W_WRITE : W_READ;
+    }
+
+    int f = tfs_open(name, w == W_WRITE ? TFS_O_TRUNC : 0);
+    if (f == -1) {
+        return -1;
+    }
+    ssize_t r = 0;
+    if (w == W_WRITE) {
+        r = tfs_write(f, buffer, io_size);
+    } else if (w == W_READ) {
+        r = tfs_read(f, buffer, BLOCK_SIZE);
+    }
+    if (tfs_close(f) == -1) {
+        return -1;
+    }
+    return r;
+}
+
+static int client(int i, char const *server, int ready_fd, int start_fd,
+                  int result_fd) {
+    static client_result_t res;
+    char pipe_path[40];
+    snprintf(pipe_path, sizeof(pipe_path), "/tmp/tfs_load_%d_%d",
+             (int)getppid(), i);
+
+    char ok = tfs_mount(pipe_path, server) == 0;
+    write_all(ready_fd, &ok, 1);
+    if (!ok) {
+        return 1;
+    }
+
+    /* every client waits here until all of them are mounted */
+    char go;
+    if (read_all(start_fd, &go, 1) == -1) {
+        tfs_unmount();
+        return 1;
+    }
+
+    char buffer[BLOCK_SIZE];
+    memset(buffer, 'c', sizeof(buffer));
+    unsigned seed = (unsigned)i * 7919 + 1;
+    double start = bench_now();
+    double deadline = start + duration;
+
+    for (long n = 0; op_count > 0 ? n < op_count : bench_now() < deadline;
+         n++) {
+        double t0 = bench_now();
+        ssize_t r = one_op(workload, &seed, buffer);
+        double t1 = bench_now();
+        if (r == -1) {
+            res.errors++;
+            continue;
+        }
+        res.ops++;
+        res.bytes += (uint64_t)r;
+        res.latency[tfs_hist_bucket((uint64_t)((t1 - t0) * 1e9))]++;
+    }
+    res.seconds = bench_now() - start;
+
+    tfs_unmount();
+    return write_all(result_fd, &res, sizeof(res)) == -1;
+}
+
+/* Creates the files every workload uses */
+static int prepare(char const *server) {
+    char pipe_path[40];
+    snprintf(pipe_path, sizeof(pipe_path), "/tmp/tfs_load_%d", (int)getpid());
+    if (tfs_mount(pipe_path, server) == -1) {
+        return -1;
+    }
+
+    char data[BLOCK_SIZE];
+    memset(data, 'p', sizeof(data));
+    for (int i = 0; i < n_files; i++) {
+        char name[MAX_FILE_NAME];
+        snprintf(name, sizeof(name), "/load%d", i);
+        int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+        if (f == -1) {
+            fprintf(stderr, "cannot create %s\n", name);
+            tfs_unmount();
+            return -1;
+        }
+        tfs_write(f, data, sizeof(data));
+        tfs_close(f);
+    }
+    return tfs_unmount();
+}
+
+int main(int argc, char **argv) {
+    int n_clients = 4;
+    char const *json_path = NULL;
+    static char const *names[] = {"open", "write", "read", "mixed"};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:w:d:n:s:f:j:")) != -1) {
+        switch (opt) {
+        case 'c':
+            n_clients = atoi(optarg);
+            break;
+        case 'w':
+            for (int w = W_OPEN; w <= W_MIXED; w++) {
+                if (strcmp(optarg, names[w]) == 0) {
+                    workload = (workload_t)w;
+                }
+            }
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'n':
+            op_count = atol(optarg);
+            break;
+        case 's':
+            io_size = (size_t)atol(optarg);
+            break;
+        case 'f':
+            n_files = atoi(optarg);
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: %s [-c clients] [-w open|write|read|mixed] "
+               "[-d seconds | -n ops_per_client] [-s io_size] [-f files] "
+               "[-j output.json] server_pipe_path...\n",
+               argv[0]);
+        return 1;
+    }
+    if (n_clients <= 0 || n_files <= 0 || io_size == 0 ||
+        io_size > BLOCK_SIZE) {
+        printf("clients and files must be positive and io_size in [1, %d]\n",
+               BLOCK_SIZE);
+        return 1;
+    }
+    char **servers = argv + optind;
+    int n_servers = argc - optind;
+
+    if (prepare(servers[0]) == -1) {
+        return 1;
+    }
+
+    int ready[2], start[2], results[2];
+    if (pipe(ready) == -1 || pipe(start) == -1 || pipe(results) == -1) {
+        perror("Pipe error");
+        return 1;
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("Fork error");
+            return 1;
+        }
+        if (pid == 0) {
+            close(start[1]);
+            exit(client(i, servers[i % n_servers], ready[1], start[0],
+                        results[1]));
+        }
+    }
+    close(start[0]);
+    close(ready[1]);
+    close(results[1]);
+
+    int mounted = 0;
+    for (int i = 0; i < n_clients; i++) {
+        char ok;
+        if (read_all(ready[0], &ok, 1) == 0 && ok) {
+            mounted++;
+        }
+    }
+    if (mounted < n_clients) {
+        fprintf(stderr, "only %d of %d clients could mount\n", mounted,
+                n_clients);
+    }
+
+    /* all clients are mounted: let them go */
+    char go[64];
+    memset(go, 1, sizeof(go));
+    for (int i = 0; i < mounted; i++) {
+        write_all(start[1], go, 1);
+    }
+    close(start[1]);
+
+    static client_result_t res, total;
+    double max_seconds = 0;
+    for (int i = 0; i < mounted; i++) {
+        if (read_all(results[0], &res, sizeof(res)) == -1) {
+            fprintf(stderr, "a client did not report\n");
+            continue;
+        }
+        total.ops += res.ops;
+        total.errors += res.errors;
+        total.bytes += res.bytes;
+        for (int b = 0; b < TFS_HIST_BUCKETS; b++) {
+            total.latency[b] += res.latency[b];
+        }
+        if (res.seconds > max_seconds) {
+            max_seconds = res.seconds;
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+
+    double p50 = (double)tfs_hist_percentile(total.latency, 0.5) / 1e3;
+    double p99 = (double)tfs_hist_percentile(total.latency, 0.99) / 1e3;
+    double p999 = (double)tfs_hist_percentile(total.latency, 0.999) / 1e3;
+    double ops_s = max_seconds > 0 ? (double)total.ops / max_seconds : 0;
+    double mb_s = max_seconds > 0 ? (double)total.bytes / max_seconds / 1e6
+                                  : 0;
+
+    printf("%s workload, %d clients, %d servers: %ld ops (%ld errors) in "
+           "%.3f s\n",
+           names[workload], mounted, n_servers, total.ops, total.errors,
+           max_seconds);
+    printf("%12.1f ops/s %10.2f MB/s   p50 %.1f us  p99 %.1f us  "
+           "p999 %.1f us\n",
+           ops_s, mb_s, p50, p99, p999);
+
+    if (json_path != NULL) {
+        if (bench_begin(json_path, "client_load",
+                        "\"config\": {\"workload\": \"%s\", \"clients\": %d, "
+                        "\"servers\": %d}",
+                        names[workload], mounted, n_servers) == -1) {
+            return 1;
+        }
+        bench_result("\"ops\": %ld, \"errors\": %ld, \"seconds\": %.3f, "
+                     "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+                     "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f",
+                     total.ops, total.errors, max_seconds, ops_s, mb_s, p50,
+                     p99, p999);
+        bench_end();
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "fs/operations.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Cost of a clone against that of a copy: for several file sizes (inline,
+    in fragments and in a block of their own), each round makes a copy of
+    every file by reading it and writing it to a new file, and a clone of it
+    with tfs_clone, and then writes the first bytes of each clone (which
+    copies its block, unless the file is inline). Reports the average time
+    of a copy, of a clone and of the first write to a clone, and the blocks
+    the first copies and clones take. The storage delay emulation is off.
+    Usage: clone_bench [output.json]
+*/
+
+#define FILES (6)
+#define ROUNDS (200)
+
+static size_t const sizes[] = {48, 200, BLOCK_SIZE};
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+
+/* Returns the number of free data blocks (without changing it) */
+static int free_blocks() {
+    static int taken[DATA_BLOCKS];
+    int n = 0;
+    while ((taken[n] = data_block_alloc()) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        data_block_free(taken[i]);
+    }
+    return n;
+}
+
+/* Copies a file to another, through a buffer; returns false if it fails */
+static bool copy(char const *source, char const *dest) {
+    static char buffer[BLOCK_SIZE];
+    int from = tfs_open(source, 0);
+    int to = tfs_open(dest, TFS_O_CREAT | TFS_O_TRUNC);
+    ssize_t rd = tfs_read(from, buffer, sizeof(buffer));
+    bool ok = from != -1 && to != -1 && rd >= 0 &&
+              tfs_write(to, buffer, (size_t)rd) == rd;
+    tfs_close(from);
+    tfs_close(to);
+    return ok;
+}
+
+static void run(size_t size) {
+    static char buffer[BLOCK_SIZE];
+    char name[MAX_FILE_NAME], copy_name[MAX_FILE_NAME],
+        clone_name[MAX_FILE_NAME];
+
+    if (tfs_init() == -1) {
+        return;
+    }
+    state_set_storage_delay(false);
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        int fh = tfs_open(name, TFS_O_CREAT);
+        memset(buffer, 'a' + i, size);
+        if (fh == -1 || tfs_write(fh, buffer, size) != (ssize_t)size) {
+            fprintf(stderr, "cannot create %s\n", name);
+            tfs_destroy();
+            return;
+        }
+        tfs_close(fh);
+    }
+
+    double copy_s = 0, clone_s = 0, write_s = 0;
+    int copy_blocks = 0, clone_blocks = 0;
+    int errors = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        int before = free_blocks();
+        double start = bench_now();
+        for (int i = 0; i < FILES; i++) {
+            snprintf(name, sizeof(name), "/f%d", i);
+            snprintf(copy_name, sizeof(copy_name), "/copy%d", i);
+            errors += !copy(name, copy_name);
+        }
+        double copied = bench_now();
+        int after_copies = free_blocks();
+        double clone_start = bench_now();
+        for (int i = 0; i < FILES; i++) {
+            snprintf(name, sizeof(name), "/f%d", i);
+            snprintf(clone_name, sizeof(clone_name), "/clone%d", i);
+            errors += tfs_clone(name, clone_name) == -1;
+        }
+        double cloned = bench_now();
+        int after_clones = free_blocks();
+        double write_start = bench_now();
+        for (int i = 0; i < FILES; i++) {
+            snprintf(clone_name, sizeof(clone_name), "/clone%d", i);
+            int fh = tfs_open(clone_name, 0);
+            errors += tfs_write(fh, "x", 1) != 1;
+            tfs_close(fh);
+        }
+        double written = bench_now();
+
+        copy_s += copied - start;
+        clone_s += cloned - clone_start;
+        write_s += written - write_start;
+        /* later rounds replace the copies and clones of the first */
+        if (r == 0) {
+            copy_blocks = before - after_copies;
+            clone_blocks = after_copies - after_clones;
+        }
+    }
+    tfs_destroy();
+
+    double ops = (double)ROUNDS * FILES;
+    bench_result("\"size\": %zu, \"copy_us\": %.3f, \"clone_us\": %.3f, "
+                 "\"first_write_us\": %.3f, \"copy_blocks\": %d, "
+                 "\"clone_blocks\": %d, \"errors\": %d",
+                 size, copy_s * 1e6 / ops, clone_s * 1e6 / ops,
+                 write_s * 1e6 / ops, copy_blocks, clone_blocks, errors);
+}
+
+int main(int argc, char **argv) {
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "clones",
+                    "\"config\": {\"block_size\": %d, \"fragment_size\": %d, "
+                    "\"inline_data_size\": %d, \"files\": %d, "
+                    "\"rounds\": %d}",
+                    BLOCK_SIZE, FRAGMENT_SIZE, INLINE_DATA_SIZE, FILES,
+                    ROUNDS) == -1) {
+        return 1;
+    }
+    for (size_t s = 0; s < N_SIZES; s++) {
+        run(sizes[s]);
+    }
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "fs/dir_simd.h"
+#include "fs/state.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Benchmark of directory lookups (find_in_dir) in a full directory, with
+    each of the kernels the CPU supports, against the plain strncmp scan
+    over the entries they replace. Lookups hit every entry in turn, or
+    miss. Short names ("file12") and names sharing a long prefix are used.
+    The storage delay emulation is off.
+    Usage: dir_bench [output.json]
+*/
+
+#define MIN_SECONDS (0.1)
+#define BATCH (1000)
+
+static int dir;
+static char names[MAX_DIR_ENTRIES][MAX_FILE_NAME];
+
+/* the lookup before tags: a strncmp of every used entry */
+static int find_strncmp(int inumber, char const *sub_name) {
+    dir_block_t *d = data_block_get(inode_get(inumber)->i_data_block);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (d->d_entries[i].d_inumber != -1 &&
+            strncmp(d->d_entries[i].d_name, sub_name, MAX_FILE_NAME) == 0) {
+            return d->d_entries[i].d_inumber;
+        }
+    }
+    return -1;
+}
+
+static int (*const lookups[])(int, char const *) = {find_in_dir,
+                                                    find_strncmp};
+
+static void run(char const *kernel, int lookup, char const *names_kind,
+                bool hit) {
+    long ops = 0;
+    int found = 0;
+    double start = bench_now(), elapsed;
+    do {
+        for (int i = 0; i < BATCH; i++) {
+            char const *name =
+                hit ? names[(size_t)ops % MAX_DIR_ENTRIES] : "/missing";
+            found += lookups[lookup](dir, name) != -1;
+            ops++;
+        }
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    if (found != (hit ? ops : 0)) {
+        fprintf(stderr, "%s lookups found %d of %ld\n", kernel, found, ops);
+    }
+    bench_result("\"kernel\": \"%s\", \"names\": \"%s\", \"lookup\": \"%s\", "
+                 "\"ops\": %ld, \"ns_per_op\": %.1f",
+                 kernel, names_kind, hit ? "hit" : "miss", ops,
+                 elapsed * 1e9 / (double)ops);
+}
+
+static void fill(char const *prefix) {
+    state_init();
+    dir = inode_create(T_DIRECTORY);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        snprintf(names[i], MAX_FILE_NAME, "%s%d", prefix, (int)i);
+        /* the entries need not point to real i-nodes */
+        add_dir_entry(dir, (int)(i % INODE_TABLE_SIZE), names[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "dir",
+                    "\"config\": {\"block_size\": %d, "
+                    "\"max_dir_entries\": %zu}",
+                    BLOCK_SIZE, (size_t)MAX_DIR_ENTRIES) == -1) {
+        return 1;
+    }
+    state_set_storage_delay(false);
+
+    static char const *const prefixes[][2] = {
+        {"short", "file"},
+        {"long_prefix", "/a/rather/long/common/prefix/file"},
+    };
+    for (size_t f = 0; f < sizeof(prefixes) / sizeof(prefixes[0]); f++) {
+        fill(prefixes[f][1]);
+        for (int hit = 1; hit >= 0; hit--) {
+            run("strncmp", 1, prefixes[f][0], hit);
+            for (int k = 0; k < DIR_KERNELS; k++) {
+                if (dir_use_kernel((dir_kernel_t)k)) {
+                    run(dir_kernel_name((dir_kernel_t)k), 0, prefixes[f][0],
+                        hit);
+                }
+            }
+        }
+    }
+
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "common/stats.h"
+#include "fs/config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Latency of small operations next to a client streaming writes: one
+    session is shared by bulk_threads threads that each rewrite a file of
+    their own (open with truncation, a write of a whole block, close) as
+    fast as they can, so it always has several requests in flight, while
+    another session opens, reads 16 bytes of and closes a small file, one
+    request at a time, and records how long each request takes.
+    Run it against servers started with different scheduling options (e.g.
+    -q 0 for arrival order, the default, and -p) to compare them.
+    Usage: fair_bench client_pipe_path server_pipe_path [bulk_threads]
+                      [seconds]
+*/
+
+#define MAX_THREADS (16)
+
+static tfs_session_t *bulk;
+static volatile bool running = true;
+static long bulk_bytes[MAX_THREADS];
+
+static void *streamer(void *arg) {
+    int i = (int)(long)arg;
+    char name[MAX_FILE_NAME];
+    char data[BLOCK_SIZE];
+    snprintf(name, sizeof(name), "/bulk%d", i);
+    memset(data, 'a' + i, sizeof(data));
+
+    while (running) {
+        int f = tfs_session_open(bulk, name, TFS_O_CREAT | TFS_O_TRUNC);
+        if (f == -1) {
+            continue;
+        }
+        ssize_t wt = tfs_session_write(bulk, f, data, sizeof(data));
+        if (wt > 0) {
+            bulk_bytes[i] += wt;
+        }
+        tfs_session_close(bulk, f);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [bulk_threads] [seconds]'\n");
+        return 1;
+    }
+    int threads = argc > 3 ? atoi(argv[3]) : 8;
+    double seconds = argc > 4 ? atof(argv[4]) : 3;
+    if (threads <= 0 || threads > MAX_THREADS || seconds <= 0) {
+        printf("bulk_threads must be in [1, %d] and seconds positive\n",
+               MAX_THREADS);
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s_bulk", argv[1]);
+    bulk = tfs_session_mount(path, argv[2]);
+    snprintf(path, sizeof(path), "%s_small", argv[1]);
+    tfs_session_t *small = tfs_session_mount(path, argv[2]);
+    if (bulk == NULL || small == NULL) {
+        fprintf(stderr, "cannot mount\n");
+        return 1;
+    }
+    int f = tfs_session_open(small, "/small", TFS_O_CREAT | TFS_O_TRUNC);
+    if (f == -1 || tfs_session_write(small, f, "0123456789abcdef", 16) != 16 ||
+        tfs_session_close(small, f) == -1) {
+        fprintf(stderr, "cannot create /small\n");
+        return 1;
+    }
+
+    pthread_t tids[MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, streamer, (void *)(long)i);
+    }
+
+    static uint64_t hist[TFS_HIST_BUCKETS];
+    uint64_t max = 0;
+    long ops = 0, errors = 0;
+    double start = bench_now();
+    double end = start + seconds;
+    char data[16];
+    while (bench_now() < end) {
+        double t[4];
+        t[0] = bench_now();
+        f = tfs_session_open(small, "/small", 0);
+        t[1] = bench_now();
+        ssize_t rd = f != -1 ? tfs_session_read(small, f, data, sizeof(data))
+                             : -1;
+        t[2] = bench_now();
+        if (f == -1 || rd != sizeof(data) ||
+            tfs_session_close(small, f) == -1) {
+            errors++;
+            continue;
+        }
+        t[3] = bench_now();
+        for (int i = 0; i < 3; i++) {
+            uint64_t latency = (uint64_t)((t[i + 1] - t[i]) * 1e9);
+            hist[tfs_hist_bucket(latency)]++;
+            if (latency > max) {
+                max = latency;
+            }
+            ops++;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    running = false;
+    long bytes = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        bytes += bulk_bytes[i];
+    }
+    tfs_session_unmount(small);
+    tfs_session_unmount(bulk);
+
+    bench_begin(NULL, "fair", "\"config\": {\"bulk_threads\": %d}", threads);
+    bench_result("\"seconds\": %.3f, \"small_ops\": %ld, "
+                 "\"small_errors\": %ld, \"small_p50_us\": %.1f, "
+                 "\"small_p99_us\": %.1f, \"small_p999_us\": %.1f, "
+                 "\"small_max_us\": %.1f, \"bulk_mb_per_s\": %.2f",
+                 elapsed, ops, errors,
+                 (double)tfs_hist_percentile(hist, 0.5) / 1e3,
+                 (double)tfs_hist_percentile(hist, 0.99) / 1e3,
+                 (double)tfs_hist_percentile(hist, 0.999) / 1e3,
+                 (double)max / 1e3, (double)bytes / elapsed / 1e6);
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "bench.h"
+#include "fs/fragments.h"
+#include "fs/operations.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Small files with and without fragments: for several file sizes, creates
+    files of that size until the FS is full, and reports how many fit, how
+    many blocks each takes, and the average time to create and write one
+    and to read it back. The storage delay emulation is off.
+    With the default configuration the root directory fills up first; to
+    see the data blocks run out, build with e.g.
+    make bench EXTRA_CFLAGS=-DDATA_BLOCKS=8
+    Usage: frag_bench [output.json]
+*/
+
+static size_t const sizes[] = {100, 200, 300, 500, 800};
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+
+static void run(size_t size, bool fragments) {
+    static char buffer[BLOCK_SIZE];
+    char name[MAX_FILE_NAME];
+    memset(buffer, 'f', sizeof(buffer));
+
+    if (tfs_init() == -1) {
+        return;
+    }
+    state_set_storage_delay(false);
+    fragments_set_enabled(fragments);
+
+    int files = 0;
+    double start = bench_now();
+    while (true) {
+        snprintf(name, sizeof(name), "/f%d", files);
+        int f = tfs_open(name, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        ssize_t w = tfs_write(f, buffer, size);
+        tfs_close(f);
+        if (w != (ssize_t)size) {
+            break;
+        }
+        files++;
+    }
+    double write_s = bench_now() - start;
+
+    start = bench_now();
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        int f = tfs_open(name, 0);
+        tfs_read(f, buffer, size);
+        tfs_close(f);
+    }
+    double read_s = bench_now() - start;
+
+    /* the blocks left are the ones the files (and the root) did not take */
+    int free_blocks = 0;
+    while (data_block_alloc() != -1) {
+        free_blocks++;
+    }
+    int used = DATA_BLOCKS - free_blocks - 1;
+    tfs_destroy();
+
+    bench_result("\"size\": %zu, \"fragments\": %s, \"files\": %d, "
+                 "\"blocks_used\": %d, \"blocks_per_file\": %.3f, "
+                 "\"write_us\": %.2f, \"read_us\": %.2f",
+                 size, fragments ? "true" : "false", files, used,
+                 files > 0 ? (double)used / files : 0,
+                 files > 0 ? write_s * 1e6 / files : 0,
+                 files > 0 ? read_s * 1e6 / files : 0);
+}
+
+int main(int argc, char **argv) {
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "fragments",
+                    "\"config\": {\"block_size\": %d, \"data_blocks\": %d, "
+                    "\"fragment_size\": %d, \"inline_data_size\": %d, "
+                    "\"max_dir_entries\": %zu}",
+                    BLOCK_SIZE, DATA_BLOCKS, FRAGMENT_SIZE, INLINE_DATA_SIZE,
+                    (size_t)MAX_DIR_ENTRIES) == -1) {
+        return 1;
+    }
+    for (size_t s = 0; s < N_SIZES; s++) {
+        run(sizes[s], false);
+        run(sizes[s], true);
+    }
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "bench.h"
+#include "common/stats.h"
+#include "fs/operations.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*  Multi-threaded load generator running directly against the library
+    (operations.c). Each operation opens a file, reads or writes io_size
+    bytes from its start and closes it. For every thread count, reports
+    the throughput and the latency percentiles of the operations.
+    Usage: lib_bench [-t threads,...] [-r read_percent] [-f files]
+                     [-s io_size] [-p] [-d seconds] [-j output.json]
+      -p: every thread uses its own files (default: all files are shared)
+*/
+
+#define MAX_THREADS (MAX_OPEN_FILES)
+
+typedef struct {
+    int id;
+    unsigned seed;
+    long ops;
+    uint64_t bytes;
+    uint64_t latency[TFS_HIST_BUCKETS];
+} worker_t;
+
+static int read_percent = 50;
+static int n_files = 8;
+static size_t io_size = 256;
+static bool private_files;
+static double duration = 2.0;
+
+static pthread_barrier_t start_barrier;
+static volatile bool stop;
+
+static void file_name(char *name, size_t size, int thread, int file) {
+    snprintf(name, size, "/t%d_f%d", private_files ? thread : 0, file);
+}
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    char name[MAX_FILE_NAME];
+    char *buffer = malloc(io_size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    memset(buffer, 'w', io_size);
+
+    pthread_barrier_wait(&start_barrier);
+    while (!stop) {
+        file_name(name, sizeof(name), w->id, rand_r(&w->seed) % n_files);
+        bool is_read = rand_r(&w->seed) % 100 < (unsigned)read_percent;
+
+        double start = bench_now();
+        int f = tfs_open(name, 0);
+        if (f == -1) {
+            fprintf(stderr, "open failed\n");
+            break;
+        }
+        ssize_t r = is_read ? tfs_read(f, buffer, io_size)
+                            : tfs_write(f, buffer, io_size);
+        tfs_close(f);
+        double end = bench_now();
+
+        if (r == -1) {
+            fprintf(stderr, "%s failed\n", is_read ? "read" : "write");
+            break;
+        }
+        w->ops++;
+        w->bytes += (uint64_t)r;
+        w->latency[tfs_hist_bucket((uint64_t)((end - start) * 1e9))]++;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/* Runs the workload with n threads; returns -1 if it could not start */
+static int run(int n, bool json) {
+    if (tfs_init() == -1) {
+        return -1;
+    }
+
+    /* creates (and fills) every file up front */
+    char name[MAX_FILE_NAME];
+    char *data = calloc(1, io_size);
+    for (int t = 0; t < (private_files ? n : 1); t++) {
+        for (int i = 0; i < n_files; i++) {
+            file_name(name, sizeof(name), t, i);
+            int f = tfs_open(name, TFS_O_CREAT);
+            if (f == -1 || data == NULL) {
+                fprintf(stderr, "cannot create %s\n", name);
+                return -1;
+            }
+            tfs_write(f, data, io_size);
+            tfs_close(f);
+        }
+    }
+    free(data);
+
+    worker_t *workers = calloc((size_t)n, sizeof(worker_t));
+    pthread_t *tids = calloc((size_t)n, sizeof(pthread_t));
+    if (workers == NULL || tids == NULL) {
+        return -1;
+    }
+
+    stop = false;
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)n + 1);
+    for (int i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].seed = (unsigned)i * 7919 + 1;
+        pthread_create(&tids[i], NULL, worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = bench_now();
+    struct timespec ts;
+    ts.tv_sec = (time_t)duration;
+    ts.tv_nsec = (long)((duration - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    stop = true;
+    for (int i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = bench_now() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    static uint64_t latency[TFS_HIST_BUCKETS];
+    memset(latency, 0, sizeof(latency));
+    long ops = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+        ops += workers[i].ops;
+        bytes += workers[i].bytes;
+        for (int b = 0; b < TFS_HIST_BUCKETS; b++) {
+            latency[b] += workers[i].latency[b];
+        }
+    }
+
+    double p50 = (double)tfs_hist_percentile(latency, 0.5) / 1e3;
+    double p99 = (double)tfs_hist_percentile(latency, 0.99) / 1e3;
+    double p999 = (double)tfs_hist_percentile(latency, 0.999) / 1e3;
+    printf("%7d %12.1f %10.2f %10.1f %10.1f %10.1f\n", n,
+           (double)ops / elapsed, (double)bytes / elapsed / 1e6, p50, p99,
+           p999);
+    if (json) {
+        bench_result("\"threads\": %d, \"ops\": %ld, \"seconds\": %.3f, "
+                     "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+                     "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f",
+                     n, ops, elapsed, (double)ops / elapsed,
+                     (double)bytes / elapsed / 1e6, p50, p99, p999);
+    }
+
+    free(workers);
+    free(tids);
+    return tfs_destroy();
+}
+
+int main(int argc, char **argv) {
+    char const *threads = "1,2,4,8";
+    char const *json_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:f:s:pd:j:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = optarg;
+            break;
+        case 'r':
+            read_percent = atoi(optarg);
+            break;
+        case 'f':
+            n_files = atoi(optarg);
+            break;
+        case 's':
+            io_size = (size_t)atol(optarg);
+            break;
+        case 'p':
+            private_files = true;
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        default:
+            printf("Usage: %s [-t threads,...] [-r read_percent] [-f files] "
+                   "[-s io_size] [-p] [-d seconds] [-j output.json]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+    if (n_files <= 0 || io_size == 0 || io_size > BLOCK_SIZE) {
+        printf("files must be positive and io_size in [1, %d]\n", BLOCK_SIZE);
+        return 1;
+    }
+
+    bool json = json_path != NULL;
+    if (json &&
+        bench_begin(json_path, "lib",
+                    "\"config\": {\"read_percent\": %d, \"files\": %d, "
+                    "\"io_size\": %zu, \"private_files\": %s, "
+                    "\"seconds\": %.1f}",
+                    read_percent, n_files, io_size,
+                    private_files ? "true" : "false", duration) == -1) {
+        return 1;
+    }
+
+    printf("%d%% reads, %d %s files, %zu B per I/O\n", read_percent, n_files,
+           private_files ? "private" : "shared", io_size);
+    printf("%7s %12s %10s %10s %10s %10s\n", "threads", "ops/s", "MB/s",
+           "p50 us", "p99 us", "p999 us");
+
+    char *list = strdup(threads);
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        int n = atoi(tok);
+        if (n <= 0 || n > MAX_THREADS) {
+            printf("thread counts must be in [1, %d]\n", MAX_THREADS);
+            return 1;
+        }
+        /* every file lives in the root directory */
+        if ((private_files ? n : 1) * n_files > (int)MAX_DIR_ENTRIES) {
+            printf("%d threads x %d files do not fit in the root directory "
+                   "(%zu entries)\n",
+                   n, n_files, (size_t)MAX_DIR_ENTRIES);
+            return 1;
+        }
+        if (run(n, json) == -1) {
+            return 1;
+        }
+    }
+    free(list);
+
+    if (json) {
+        bench_end();
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE /* syscall */
+#include "bench.h"
+#include "fs/state.h"
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*  Memory footprint of the data blocks region, with and without huge
+    pages: resident memory and page faults of an empty FS, after writing
+    every block in order, and after freeing them all; time and data TLB
+    misses (if the kernel lets us count them) of a pass reading every
+    block in order and in a random order.
+    The default region is too small for huge pages to matter; build with
+    e.g. make bench EXTRA_CFLAGS=-DDATA_BLOCKS=65536 (64 MiB).
+    Usage: mem_bench [output.json]
+*/
+
+static int order[DATA_BLOCKS];
+/* the fields of the phases of the current result */
+static char phases[256];
+/* keeps the reads from being optimized away */
+static volatile uint64_t sink;
+
+static long rss_kb() {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long minor_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+/* Returns a counter of data TLB read misses, -1 if not available */
+static int open_dtlb_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void add_phase(char const *phase, long rss, long faults) {
+    size_t len = strlen(phases);
+    snprintf(phases + len, sizeof(phases) - len,
+             "%s\"%s\": {\"rss_kb\": %ld, \"minor_faults\": %ld}",
+             len > 0 ? ", " : "", phase, rss, faults);
+}
+
+/* Reads every block (in the given order); returns misses, -1 if unknown */
+static long read_pass(int counter, double *seconds, uint64_t *sum) {
+    if (counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double start = bench_now();
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        uint64_t const *block = data_block_get(order[i]);
+        for (size_t w = 0; w < BLOCK_SIZE / sizeof(uint64_t); w += 8) {
+            *sum += block[w];
+        }
+    }
+    *seconds = bench_now() - start;
+    long long misses = -1;
+    if (counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+    }
+    return (long)misses;
+}
+
+static void run(bool huge, int counter) {
+    state_set_huge_pages(huge);
+    long rss0 = rss_kb(), faults0 = minor_faults();
+    if (state_init() == -1) {
+        return;
+    }
+
+    phases[0] = '\0';
+    add_phase("empty", rss_kb() - rss0, minor_faults() - faults0);
+
+    /* the allocation is not timed: its linear scan would dominate */
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        data_block_alloc();
+    }
+    double start = bench_now();
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        memset(data_block_get(i), 'w', BLOCK_SIZE);
+    }
+    double write_s = bench_now() - start;
+    add_phase("written", rss_kb() - rss0, minor_faults() - faults0);
+
+    uint64_t sum = 0;
+    double seq_s, rand_s;
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        order[i] = i;
+    }
+    long seq_misses = read_pass(counter, &seq_s, &sum);
+    unsigned seed = 1;
+    for (int i = DATA_BLOCKS - 1; i > 0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    long rand_misses = read_pass(counter, &rand_s, &sum);
+
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        data_block_free(i);
+    }
+    add_phase("freed", rss_kb() - rss0, minor_faults() - faults0);
+    bench_result("\"huge_pages\": %s, %s, \"write_s\": %.4f, "
+                 "\"seq_read_s\": %.4f, \"seq_dtlb_misses\": %ld, "
+                 "\"rand_read_s\": %.4f, \"rand_dtlb_misses\": %ld",
+                 huge ? "true" : "false", phases, write_s, seq_s, seq_misses,
+                 rand_s, rand_misses);
+    sink = sum;
+    state_destroy();
+}
+
+int main(int argc, char **argv) {
+    state_set_storage_delay(false);
+    int counter = open_dtlb_counter();
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "mem",
+                    "\"config\": {\"block_size\": %d, \"data_blocks\": %d},"
+                    "\n  \"dtlb_counter\": %s",
+                    BLOCK_SIZE, DATA_BLOCKS,
+                    counter != -1 ? "true" : "false") == -1) {
+        return 1;
+    }
+    run(false, counter);
+    run(true, counter);
+    bench_end();
+
+    if (counter != -1) {
+        close(counter);
+    }
+    return 0;
+}
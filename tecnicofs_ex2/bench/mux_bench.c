@@ -0,0 +1,160 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Threads of one client: each thread opens, reads and closes a file of its
+    own, filled with its own letter, and checks what it reads. The workload
+    runs with the threads sharing one session (their requests and replies
+    multiplexed over it) and with a session per thread, for 1, 2, 4 and 8
+    threads. A reply handed over to the wrong thread shows up as a wrong
+    letter ("misrouted").
+    Usage: mux_bench client_pipe_path server_pipe_path [ops_per_thread]
+*/
+
+#define MAX_THREADS (8)
+
+static int const thread_counts[] = {1, 2, 4, 8};
+#define N_THREAD_COUNTS (sizeof(thread_counts) / sizeof(thread_counts[0]))
+
+typedef struct {
+    int i;
+    tfs_session_t *session;
+    long ops;
+    long errors;
+    long misrouted;
+} worker_t;
+
+static char const *client_path;
+static char const *server_path;
+static long ops_per_thread;
+static bool shared;
+static pthread_barrier_t start;
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    char name[MAX_FILE_NAME];
+    char data[BLOCK_SIZE];
+    snprintf(name, sizeof(name), "/mux%d", w->i);
+
+    pthread_barrier_wait(&start);
+    for (long n = 0; n < ops_per_thread; n++) {
+        int f = tfs_session_open(w->session, name, 0);
+        ssize_t rd = f != -1 ? tfs_session_read(w->session, f, data,
+                                                sizeof(data))
+                             : -1;
+        if (f == -1 || tfs_session_close(w->session, f) == -1 ||
+            rd != sizeof(data)) {
+            w->errors++;
+            continue;
+        }
+        if (data[0] != 'a' + w->i || data[sizeof(data) - 1] != 'a' + w->i) {
+            w->misrouted++;
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+static tfs_session_t *mount(int i) {
+    char path[40];
+    snprintf(path, sizeof(path), "%s_%d", client_path, i);
+    tfs_session_t *s = tfs_session_mount(path, server_path);
+    if (s == NULL) {
+        fprintf(stderr, "cannot mount %s\n", path);
+        exit(1);
+    }
+    return s;
+}
+
+/* Creates the file of every thread */
+static void prepare() {
+    tfs_session_t *s = mount(MAX_THREADS);
+    char name[MAX_FILE_NAME];
+    char data[BLOCK_SIZE];
+    for (int i = 0; i < MAX_THREADS; i++) {
+        snprintf(name, sizeof(name), "/mux%d", i);
+        memset(data, 'a' + i, sizeof(data));
+        int f = tfs_session_open(s, name, TFS_O_CREAT | TFS_O_TRUNC);
+        if (f == -1 || tfs_session_write(s, f, data, sizeof(data)) !=
+                           sizeof(data)) {
+            fprintf(stderr, "cannot create %s\n", name);
+            exit(1);
+        }
+        tfs_session_close(s, f);
+    }
+    tfs_session_unmount(s);
+}
+
+static void run(int threads) {
+    static worker_t workers[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+
+    tfs_session_t *one = shared ? mount(0) : NULL;
+    for (int i = 0; i < threads; i++) {
+        memset(&workers[i], 0, sizeof(worker_t));
+        workers[i].i = i;
+        workers[i].session = shared ? one : mount(i);
+    }
+
+    pthread_barrier_init(&start, NULL, (unsigned)threads + 1);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, worker, &workers[i]);
+    }
+    pthread_barrier_wait(&start);
+    double t0 = bench_now();
+    long ops = 0, errors = 0, misrouted = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        ops += workers[i].ops;
+        errors += workers[i].errors;
+        misrouted += workers[i].misrouted;
+    }
+    double elapsed = bench_now() - t0;
+    pthread_barrier_destroy(&start);
+
+    for (int i = 0; i < threads; i++) {
+        if (!shared) {
+            tfs_session_unmount(workers[i].session);
+        }
+    }
+    if (shared) {
+        tfs_session_unmount(one);
+    }
+
+    bench_result("\"sessions\": \"%s\", \"threads\": %d, \"ops\": %ld, "
+                 "\"seconds\": %.3f, \"ops_per_s\": %.0f, \"errors\": %ld, "
+                 "\"misrouted\": %ld",
+                 shared ? "shared" : "per_thread", threads, ops, elapsed,
+                 (double)ops / elapsed, errors, misrouted);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [ops_per_thread]'\n");
+        return 1;
+    }
+    client_path = argv[1];
+    server_path = argv[2];
+    ops_per_thread = argc > 3 ? atol(argv[3]) : 20000;
+    if (ops_per_thread <= 0) {
+        printf("ops_per_thread must be positive\n");
+        return 1;
+    }
+
+    prepare();
+    bench_begin(NULL, "mux", NULL);
+    for (int mode = 0; mode < 2; mode++) {
+        shared = mode == 0;
+        for (size_t t = 0; t < N_THREAD_COUNTS; t++) {
+            run(thread_counts[t]);
+        }
+    }
+    bench_end();
+    return 0;
+}
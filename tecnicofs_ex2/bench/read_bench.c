@@ -0,0 +1,91 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Large-read throughput: writes one file of read_size bytes and then
+    reads it back from the start, over and over.
+    Reads of at least a page are answered by the server straight from the
+    file's block; start the server with -z to splice them into the reply
+    pipe instead. Files only span one block, so reads of more than 1 KiB
+    need a server built with a larger block, e.g.
+        make clean all bench EXTRA_CFLAGS=-DBLOCK_SIZE=65536
+    Usage: read_bench client_pipe_path server_pipe_path
+                      [iterations] [read_size]
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [iterations] [read_size]'\n");
+        return 1;
+    }
+
+    long iterations = argc > 3 ? atol(argv[3]) : 10000;
+    size_t read_size = argc > 4 ? (size_t)atol(argv[4]) : BLOCK_SIZE;
+    if (iterations <= 0 || read_size == 0 || read_size > BLOCK_SIZE) {
+        printf("iterations must be positive and read_size in [1, %d]\n",
+               BLOCK_SIZE);
+        return 1;
+    }
+
+    char *data = malloc(read_size);
+    if (data == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < read_size; i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+
+    /* writes may be shortened by the transport, so loop until done */
+    int f = tfs_open("/large", TFS_O_CREAT | TFS_O_TRUNC);
+    if (f == -1) {
+        return 1;
+    }
+    for (size_t done = 0; done < read_size;) {
+        ssize_t w = tfs_write(f, data + done, read_size - done);
+        if (w <= 0) {
+            fprintf(stderr, "write failed\n");
+            return 1;
+        }
+        done += (size_t)w;
+    }
+    tfs_close(f);
+
+    char *back = malloc(read_size);
+    if (back == NULL) {
+        return 1;
+    }
+
+    double start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        f = tfs_open("/large", 0);
+        if (f == -1 || tfs_read(f, back, read_size) != (ssize_t)read_size ||
+            tfs_close(f) == -1) {
+            fprintf(stderr, "read failed at iteration %ld\n", i);
+            return 1;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    if (memcmp(data, back, read_size) != 0) {
+        fprintf(stderr, "data read back does not match\n");
+        return 1;
+    }
+
+    tfs_unmount();
+
+    printf("%8ld reads of %8zu B  %8.3f s  %10.1f reads/s  %8.2f MB/s\n",
+           iterations, read_size, elapsed, (double)iterations / elapsed,
+           (double)read_size * (double)iterations / elapsed / 1e6);
+
+    free(data);
+    free(back);
+    return 0;
+}
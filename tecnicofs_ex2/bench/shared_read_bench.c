@@ -0,0 +1,145 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "fs/shared_state.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Reads of one file through the server (open, read and close requests)
+    and straight from its shared state (shared_state_lookup and
+    shared_state_read), with the server otherwise idle and while another
+    thread keeps rewriting the file with the client API. The rewrites fill
+    the whole file with one letter, so a read that sees two letters was torn
+    ("torn" must be 0).
+    The server must be started with -S shm_name.
+    Usage: shared_read_bench client_pipe_path server_pipe_path shm_name
+                             [iterations] [read_size]
+*/
+
+static char const *client_path;
+static char const *server_path;
+static size_t read_size;
+static volatile bool writing;
+
+/* Fills the file with a letter; returns 0 if successful, -1 otherwise */
+static int fill(tfs_session_t *s, char letter) {
+    char data[BLOCK_SIZE];
+    memset(data, letter, read_size);
+    int f = tfs_session_open(s, "/shared", TFS_O_CREAT);
+    if (f == -1 || tfs_session_write(s, f, data, read_size) !=
+                       (ssize_t)read_size) {
+        return -1;
+    }
+    return tfs_session_close(s, f);
+}
+
+static void *writer(void *arg) {
+    tfs_session_t *s = arg;
+    for (long n = 0; writing; n++) {
+        fill(s, n % 2 == 0 ? 'a' : 'b');
+    }
+    return NULL;
+}
+
+/* Whether a read saw a single rewrite */
+static bool whole(char const *data) {
+    for (size_t i = 1; i < read_size; i++) {
+        if (data[i] != data[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run(tfs_session_t *s, shared_state_t *state, bool direct,
+                bool busy, long iterations) {
+    char data[BLOCK_SIZE];
+    pthread_t tid;
+    tfs_session_t *w = NULL;
+    if (busy) {
+        char path[40];
+        snprintf(path, sizeof(path), "%s_w", client_path);
+        w = tfs_session_mount(path, server_path);
+        if (w == NULL) {
+            fprintf(stderr, "cannot mount %s\n", path);
+            exit(1);
+        }
+        writing = true;
+        pthread_create(&tid, NULL, writer, w);
+    }
+
+    long errors = 0, torn = 0;
+    double start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        ssize_t rd = -1;
+        if (direct) {
+            int inumber = shared_state_lookup(state, "/shared");
+            rd = shared_state_read(state, inumber, data, read_size, 0);
+        } else {
+            int f = tfs_session_open(s, "/shared", 0);
+            rd = f != -1 ? tfs_session_read(s, f, data, read_size) : -1;
+            if (f == -1 || tfs_session_close(s, f) == -1) {
+                rd = -1;
+            }
+        }
+        if (rd != (ssize_t)read_size) {
+            errors++;
+        } else if (!whole(data)) {
+            torn++;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    if (busy) {
+        writing = false;
+        pthread_join(tid, NULL);
+        tfs_session_unmount(w);
+    }
+
+    bench_result("\"reads\": \"%s\", \"writer\": %s, \"iterations\": %ld, "
+                 "\"seconds\": %.3f, \"reads_per_s\": %.0f, \"errors\": %ld, "
+                 "\"torn\": %ld",
+                 direct ? "shared_memory" : "server", busy ? "true" : "false",
+                 iterations, elapsed, (double)iterations / elapsed, errors,
+                 torn);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path shm_name [iterations] [read_size]'\n");
+        return 1;
+    }
+    client_path = argv[1];
+    server_path = argv[2];
+    long iterations = argc > 4 ? atol(argv[4]) : 20000;
+    read_size = argc > 5 ? (size_t)atol(argv[5]) : BLOCK_SIZE;
+    if (iterations <= 0 || read_size == 0 || read_size > BLOCK_SIZE) {
+        printf("iterations must be positive and read_size in [1, %d]\n",
+               BLOCK_SIZE);
+        return 1;
+    }
+
+    tfs_session_t *s = tfs_session_mount(client_path, server_path);
+    if (s == NULL || fill(s, 'a') == -1) {
+        fprintf(stderr, "cannot create /shared\n");
+        return 1;
+    }
+    shared_state_t *state = shared_state_attach(argv[3]);
+    if (state == NULL) {
+        return 1;
+    }
+
+    bench_begin(NULL, "shared_read", "\"read_size\": %zu", read_size);
+    run(s, state, false, false, iterations);
+    run(s, state, true, false, iterations);
+    run(s, state, false, true, iterations);
+    run(s, state, true, true, iterations);
+    bench_end();
+
+    shared_state_detach(state);
+    tfs_session_unmount(s);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "bench.h"
+#include "fs/operations.h"
+#include "fs/snapshot.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Cost of writing with live snapshots: for several file sizes (inline, in
+    fragments and in a block of their own) and 0, 1 and 10 snapshots, each
+    round takes the snapshots, rewrites every file twice and deletes the
+    snapshots. The first write of a file after the snapshots are taken
+    copies its block (copy-on-write, once however many snapshots share it);
+    the second one writes in place. Reports the average time to take a
+    snapshot, of a first and of a second write, and to free the snapshots'
+    blocks after they are deleted. The storage delay emulation is off.
+    Usage: snapshot_bench [output.json]
+*/
+
+#define FILES (16)
+#define ROUNDS (200)
+
+static size_t const sizes[] = {48, 200, BLOCK_SIZE};
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+static int const counts[] = {0, 1, 10};
+#define N_COUNTS (sizeof(counts) / sizeof(counts[0]))
+
+
+/* Rewrites every file from the start; returns false if a write fails */
+static bool rewrite(int const *fh, char const *buffer, size_t size) {
+    for (int i = 0; i < FILES; i++) {
+        if (tfs_pwrite(fh[i], buffer, size, 0) != (ssize_t)size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run(size_t size, int snapshots) {
+    static char buffer[BLOCK_SIZE];
+    char name[MAX_FILE_NAME];
+    int fh[FILES];
+
+    if (tfs_init() == -1) {
+        return;
+    }
+    state_set_storage_delay(false);
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        fh[i] = tfs_open(name, TFS_O_CREAT);
+        memset(buffer, 'a' + i, size);
+        if (fh[i] == -1 || tfs_write(fh[i], buffer, size) != (ssize_t)size) {
+            fprintf(stderr, "cannot create %s\n", name);
+            tfs_destroy();
+            return;
+        }
+    }
+
+    double create_s = 0, first_s = 0, second_s = 0, reclaim_s = 0;
+    int ids[MAX_SNAPSHOTS];
+    int errors = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        memset(buffer, 'A' + r % 26, size);
+        double start = bench_now();
+        for (int s = 0; s < snapshots; s++) {
+            ids[s] = tfs_snapshot_create();
+            errors += ids[s] == -1;
+        }
+        double created = bench_now();
+        errors += !rewrite(fh, buffer, size);
+        double first = bench_now();
+        errors += !rewrite(fh, buffer, size);
+        double second = bench_now();
+        for (int s = 0; s < snapshots; s++) {
+            tfs_snapshot_delete(ids[s]);
+        }
+        snapshots_wait();
+        double reclaimed = bench_now();
+
+        create_s += created - start;
+        first_s += first - created;
+        second_s += second - first;
+        reclaim_s += reclaimed - second;
+    }
+
+    /* every block is back once the snapshots are gone: the files' and the
+     * root's */
+    int free_blocks = 0;
+    while (data_block_alloc() != -1) {
+        free_blocks++;
+    }
+    tfs_destroy();
+
+    double writes = (double)ROUNDS * FILES;
+    bench_result("\"size\": %zu, \"snapshots\": %d, \"create_us\": %.3f, "
+                 "\"first_write_us\": %.3f, \"write_us\": %.3f, "
+                 "\"reclaim_us\": %.3f, \"blocks_used\": %d, \"errors\": %d",
+                 size, snapshots,
+                 snapshots > 0 ? create_s * 1e6 / ROUNDS / snapshots : 0,
+                 first_s * 1e6 / writes, second_s * 1e6 / writes,
+                 snapshots > 0 ? reclaim_s * 1e6 / ROUNDS / snapshots : 0,
+                 DATA_BLOCKS - free_blocks, errors);
+}
+
+int main(int argc, char **argv) {
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "snapshots",
+                    "\"config\": {\"block_size\": %d, \"fragment_size\": %d, "
+                    "\"inline_data_size\": %d, \"files\": %d, "
+                    "\"rounds\": %d}",
+                    BLOCK_SIZE, FRAGMENT_SIZE, INLINE_DATA_SIZE, FILES,
+                    ROUNDS) == -1) {
+        return 1;
+    }
+    for (size_t s = 0; s < N_SIZES; s++) {
+        for (size_t c = 0; c < N_COUNTS; c++) {
+            run(sizes[s], counts[c]);
+        }
+    }
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "bench.h"
+#include "fs/state.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Microbenchmarks of the state.c primitives, at several fill levels of
+    the structure they work on, with the storage delay emulation
+    (insert_delay) on and off.
+    Usage: state_bench [output.json]
+*/
+
+/* each measurement runs for at least this long */
+#define MIN_SECONDS (0.1)
+#define MAX_ITERATIONS (1000000)
+
+static double const fills[] = {0.0, 0.5, 0.9};
+#define N_FILLS (sizeof(fills) / sizeof(fills[0]))
+
+/* cost of reading the clock, subtracted from every timed call */
+static double clock_overhead;
+
+static void calibrate_clock() {
+    double total = 0;
+    for (int i = 0; i < 100000; i++) {
+        double t0 = bench_now();
+        total += bench_now() - t0;
+    }
+    clock_overhead = total / 100000;
+}
+
+static void emit(char const *op, double fill, int filled, bool delay,
+                 long iterations, double seconds) {
+    seconds -= clock_overhead * (double)iterations;
+    if (seconds < 0) {
+        seconds = 0;
+    }
+    bench_result("\"op\": \"%s\", \"fill\": %.2f, \"filled\": %d, "
+                 "\"delay\": %s, \"iterations\": %ld, \"ns_per_op\": %.1f",
+                 op, fill, filled, delay ? "true" : "false", iterations,
+                 seconds * 1e9 / (double)iterations);
+}
+
+static void bench_inodes(double fill, bool delay) {
+    state_init();
+    int filled = (int)(fill * INODE_TABLE_SIZE);
+    for (int i = 0; i < filled; i++) {
+        inode_create(T_FILE);
+    }
+
+    double create = 0, delete = 0, start = bench_now();
+    long it;
+    for (it = 0; it < MAX_ITERATIONS && bench_now() - start < MIN_SECONDS;
+         it++) {
+        double t0 = bench_now();
+        int inumber = inode_create(T_FILE);
+        double t1 = bench_now();
+        inode_delete(inumber);
+        double t2 = bench_now();
+        create += t1 - t0;
+        delete += t2 - t1;
+    }
+    emit("inode_create", fill, filled, delay, it, create);
+    emit("inode_delete", fill, filled, delay, it, delete);
+}
+
+static void bench_blocks(double fill, bool delay) {
+    state_init();
+    int filled = (int)(fill * DATA_BLOCKS);
+    for (int i = 0; i < filled; i++) {
+        data_block_alloc();
+    }
+
+    double alloc = 0, free = 0, start = bench_now();
+    long it;
+    for (it = 0; it < MAX_ITERATIONS && bench_now() - start < MIN_SECONDS;
+         it++) {
+        double t0 = bench_now();
+        int block = data_block_alloc();
+        double t1 = bench_now();
+        data_block_free(block);
+        double t2 = bench_now();
+        alloc += t1 - t0;
+        free += t2 - t1;
+    }
+    emit("data_block_alloc", fill, filled, delay, it, alloc);
+    emit("data_block_free", fill, filled, delay, it, free);
+}
+
+static void bench_dir(double fill, bool delay) {
+    state_init();
+    int dir = inode_create(T_DIRECTORY);
+    /* one entry is left for the one being added and removed */
+    int filled = (int)(fill * (double)(MAX_DIR_ENTRIES - 1));
+    char name[MAX_FILE_NAME];
+    for (int i = 0; i < filled; i++) {
+        snprintf(name, sizeof(name), "file%d", i);
+        add_dir_entry(dir, 1 + i % (INODE_TABLE_SIZE - 2), name);
+    }
+    int target = INODE_TABLE_SIZE - 1;
+
+    double add = 0, hit = 0, miss = 0, clear = 0, start = bench_now();
+    long it;
+    for (it = 0; it < MAX_ITERATIONS && bench_now() - start < MIN_SECONDS;
+         it++) {
+        double t0 = bench_now();
+        add_dir_entry(dir, target, "target");
+        double t1 = bench_now();
+        find_in_dir(dir, "target");
+        double t2 = bench_now();
+        find_in_dir(dir, "missing");
+        double t3 = bench_now();
+        clear_dir_entry(dir, target);
+        double t4 = bench_now();
+        add += t1 - t0;
+        hit += t2 - t1;
+        miss += t3 - t2;
+        clear += t4 - t3;
+    }
+    emit("add_dir_entry", fill, filled, delay, it, add);
+    emit("find_in_dir_hit", fill, filled, delay, it, hit);
+    emit("find_in_dir_miss", fill, filled, delay, it, miss);
+    emit("clear_dir_entry", fill, filled, delay, it, clear);
+}
+
+static void bench_open_files(double fill, bool delay) {
+    state_init();
+    int filled = (int)(fill * MAX_OPEN_FILES);
+    for (int i = 0; i < filled; i++) {
+        add_to_open_file_table(1, 0);
+    }
+
+    double add = 0, remove = 0, start = bench_now();
+    long it;
+    for (it = 0; it < MAX_ITERATIONS && bench_now() - start < MIN_SECONDS;
+         it++) {
+        double t0 = bench_now();
+        int fhandle = add_to_open_file_table(1, 0);
+        double t1 = bench_now();
+        remove_from_open_file_table(fhandle);
+        double t2 = bench_now();
+        add += t1 - t0;
+        remove += t2 - t1;
+    }
+    emit("add_to_open_file_table", fill, filled, delay, it, add);
+    emit("remove_from_open_file_table", fill, filled, delay, it, remove);
+}
+
+int main(int argc, char **argv) {
+    calibrate_clock();
+    if (bench_begin(argc > 1 ? argv[1] : NULL, "state",
+                    "\"config\": {\"block_size\": %d, \"data_blocks\": %d, "
+                    "\"inode_table_size\": %d, \"max_open_files\": %d, "
+                    "\"max_dir_entries\": %zu},\n  \"clock_overhead_ns\": %.1f",
+                    BLOCK_SIZE, DATA_BLOCKS, INODE_TABLE_SIZE, MAX_OPEN_FILES,
+                    (size_t)MAX_DIR_ENTRIES, clock_overhead * 1e9) == -1) {
+        return 1;
+    }
+
+    for (int d = 0; d < 2; d++) {
+        bool delay = d == 0;
+        state_set_storage_delay(delay);
+        for (size_t f = 0; f < N_FILLS; f++) {
+            bench_inodes(fills[f], delay);
+            bench_blocks(fills[f], delay);
+            bench_dir(fills[f], delay);
+            bench_open_files(fills[f], delay);
+        }
+    }
+
+    bench_end();
+    return 0;
+}
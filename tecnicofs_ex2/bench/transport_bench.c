@@ -0,0 +1,80 @@
+#include "bench.h"
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Compares the plain client-server transport (named pipes or Unix
+    socket, depending on the server) with the shared-memory arena
+    negotiated by tfs_mount (TFS_SHM=1).
+    Each iteration rewrites a file and reads it back, so both the
+    write and the read paths are exercised.
+    Usage: transport_bench client_pipe_path server_pipe_path
+                           [iterations] [io_size]
+*/
+
+static int run(char const *label, char const *client_pipe,
+               char const *server_pipe, long iterations, size_t io_size) {
+    char data[BLOCK_SIZE], back[BLOCK_SIZE];
+    memset(data, 'x', sizeof(data));
+
+    if (tfs_mount(client_pipe, server_pipe) == -1) {
+        return -1;
+    }
+
+    double start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        int f = tfs_open("/bench", TFS_O_CREAT | TFS_O_TRUNC);
+        if (f == -1 || tfs_write(f, data, io_size) != (ssize_t)io_size ||
+            tfs_close(f) == -1) {
+            fprintf(stderr, "%s: write failed at iteration %ld\n", label, i);
+            tfs_unmount();
+            return -1;
+        }
+        f = tfs_open("/bench", 0);
+        if (f == -1 || tfs_read(f, back, io_size) != (ssize_t)io_size ||
+            tfs_close(f) == -1) {
+            fprintf(stderr, "%s: read failed at iteration %ld\n", label, i);
+            tfs_unmount();
+            return -1;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    tfs_unmount();
+
+    double bytes = 2.0 * (double)io_size * (double)iterations;
+    printf("%-5s %8ld iterations %6zu B  %8.3f s  %10.1f ops/s  %8.2f MB/s\n",
+           label, iterations, io_size, elapsed,
+           6.0 * (double)iterations / elapsed, bytes / elapsed / 1e6);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [iterations] [io_size]'\n");
+        return 1;
+    }
+
+    long iterations = argc > 3 ? atol(argv[3]) : 10000;
+    size_t io_size = argc > 4 ? (size_t)atol(argv[4]) : BLOCK_SIZE;
+    if (iterations <= 0 || io_size == 0 || io_size > BLOCK_SIZE) {
+        printf("iterations must be positive and io_size in [1, %d]\n",
+               BLOCK_SIZE);
+        return 1;
+    }
+
+    unsetenv("TFS_SHM");
+    if (run("plain", argv[1], argv[2], iterations, io_size) == -1) {
+        return 1;
+    }
+
+    setenv("TFS_SHM", "1", 1);
+    if (run("shm", argv[1], argv[2], iterations, io_size) == -1) {
+        return 1;
+    }
+
+    return 0;
+}
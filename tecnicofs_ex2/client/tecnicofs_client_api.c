@@ -1,194 +1,1700 @@
 #include "tecnicofs_client_api.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
-int fserv;
-int id;
-int fcli;
+/*
+ * Client cache (see tfs_cache_stats): file contents and name lookups, kept
+ * while the server leases them to the session
+ */
+#define CACHE_ENTRIES (32)
+/* handles of a caching session are the client's own */
+#define CACHE_FILES (64)
 
-int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
-    unlink(client_pipe_path);
-    if (mkfifo (client_pipe_path, 0644) == -1) {
+typedef struct {
+    char name[41]; /* empty if the entry is free */
+    int inumber;
+    bool valid;    /* a lease is held: the contents below are current */
+    uint64_t used; /* for LRU replacement */
+    size_t size;
+    char data[TFS_LEASE_DATA_MAX];
+} cache_entry_t;
+
+/* revocations remembered for the leases being asked for (see cache_mark) */
+#define REVOKED_RING (64)
+
+/*
+ * What the cache looked like when a request was sent with the cache lock
+ * released: what it brings back is only cached if nothing changed the file
+ * meanwhile
+ */
+typedef struct {
+    bool alone;       /* no write of the session was in flight */
+    uint64_t epoch;   /* writes of the session sent so far */
+    uint64_t revoked; /* revocations applied so far */
+} cache_mark_t;
+
+typedef struct {
+    bool used;
+    int fh; /* server handle, -1 until the server is needed */
+    /* no lease could be had at open: reads and writes go to the server
+     * handle, at its own offset */
+    bool uncached;
+    size_t offset;
+    char name[41];
+} cache_file_t;
+
+/*
+ * Write-behind (see tfs_flush): each handle has a buffer where writes are
+ * gathered until it fills up or has to be flushed
+ */
+#define WRITE_BUFFERS (64)
+
+typedef struct {
+    char *data; /* allocated on first use */
+    size_t len;
+} write_buffer_t;
+
+/* most buffers a request or a reply is made of (after the header) */
+#define MAX_IOV (4)
+
+/*
+ * A thread waiting for the reply to its request
+ */
+typedef struct waiter {
+    tfs_tag_t tag;
+    struct iovec iov[MAX_IOV]; /* where the reply goes */
+    int iovcnt;
+    size_t len; /* length of the reply, once it is in */
+    bool done;
+    pthread_cond_t wake; /* the reply is in, or it is this thread's turn to
+                            read the channel */
+    struct waiter *next;
+} waiter_t;
+
+struct tfs_session {
+    int fserv;
+    int fcli;
+    int id;
+    /* whether the server is reached through a Unix socket (fserv == fcli) */
+    bool is_socket;
+    /* reply pipe to remove on unmount */
+    char client_path[41];
+
+    /* the reply channel, shared by every thread: whichever thread is waiting
+     * reads the replies and hands them over to their waiters */
+    pthread_mutex_t lock; /* the fields below */
+    tfs_tag_t next_tag;
+    waiter_t *waiters;
+    bool reading; /* a thread is reading the reply channel */
+    bool broken;  /* the channel failed: no more replies will come */
+
+    /* shared-memory arena (NULL when the session only uses the pipes); it
+     * carries the payload of one request at a time */
+    pthread_mutex_t shm_lock;
+    char *shm_arena;
+
+    /* the write buffers */
+    pthread_mutex_t state_lock;
+    /* the cache; it is never held across a request to the server (see
+     * cache_mark) */
+    pthread_mutex_t cache_lock;
+    bool caching;
+    /* callback pipe, where the server revokes leases */
+    int fcb;
+    char callback_path[TFS_CALLBACK_PATH_SIZE];
+    cache_entry_t cache[CACHE_ENTRIES];
+    cache_file_t cache_files[CACHE_FILES];
+    uint64_t cache_clock;
+    /* writes of the session in flight, and how many have been sent */
+    int writes_in_flight;
+    uint64_t cache_epoch;
+    /* the last revocations applied, by number */
+    int revoked[REVOKED_RING];
+    uint64_t n_revoked;
+    tfs_cache_stats_t cache_stats;
+    /* size of every buffer, 0 if writes are not buffered */
+    size_t write_buffer_size;
+    write_buffer_t write_buffers[WRITE_BUFFERS];
+
+    /* a sharded session has no channel of its own: it routes every call to
+     * the session of one of its shards (see route_name and route_handle) */
+    int n_shards;
+    tfs_session_t *shards[TFS_MAX_SHARDS];
+};
+
+/* session of tfs_mount, used by the calls without a session */
+static tfs_session_t *default_session;
+
+static int flush_buffer(tfs_session_t *s, int fhandle);
+
+/* Returns the shard that owns a path (FNV-1a hash of the path); a file of a
+ * snapshot is in the shard of the live file it was */
+static int route_name(tfs_session_t const *s, char const *name) {
+    size_t prefix = strlen(TFS_SNAPSHOT_PREFIX);
+    if (strncmp(name, TFS_SNAPSHOT_PREFIX, prefix) == 0 &&
+        strchr(name + prefix, '/') != NULL) {
+        name = strchr(name + prefix, '/');
+    }
+    uint32_t hash = 2166136261u;
+    for (char const *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return (int)(hash % (uint32_t)s->n_shards);
+}
+
+/*
+ * Returns the session a handle belongs to, and turns the handle into that
+ * session's own. The handles of a sharded session carry their shard: they
+ * are the shard's handle times the number of shards, plus the shard.
+ * Returns NULL if there is no such session.
+ */
+static tfs_session_t *route_handle(tfs_session_t *s, int *fhandle) {
+    if (s == NULL || s->n_shards == 0) {
+        return s;
+    }
+    if (*fhandle < 0) {
+        return NULL;
+    }
+    int shard = *fhandle % s->n_shards;
+    *fhandle /= s->n_shards;
+    return s->shards[shard];
+}
+
+/*
+ * Reads into a set of buffers until they are all full.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int readv_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t rd = readv(fd, iov, iovcnt);
+        if (rd == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rd <= 0) {
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)rd >= iov->iov_len) {
+            rd -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + rd;
+            iov->iov_len -= (size_t)rd;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads one reply off the reply channel and hands it over to its waiter
+ * (a reply nobody waits for is dropped).
+ * Returns 0 if successful, -1 if the channel failed.
+ */
+static int read_reply(tfs_session_t *s) {
+    tfs_reply_header_t header;
+    struct iovec head = {&header, sizeof(header)};
+
+    /* a message of a socket has to be read at once, so its header is only
+     * peeked at, while a pipe hands over the reply in pieces */
+    if (s->is_socket) {
+        if (recv(s->fcli, &header, sizeof(header), MSG_PEEK) !=
+            sizeof(header)) {
+            return -1;
+        }
+    } else if (readv_all(s->fcli, &head, 1) == -1) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    waiter_t *w = s->waiters;
+    while (w != NULL && w->tag != header.tag) {
+        w = w->next;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    /* the waiter cannot go away until it is done */
+    struct iovec iov[1 + MAX_IOV];
+    int n = 0;
+    if (s->is_socket) {
+        iov[n].iov_base = &header;
+        iov[n++].iov_len = sizeof(header);
+    }
+    size_t left = header.len;
+    for (int i = 0; w != NULL && i < w->iovcnt && left > 0; i++) {
+        iov[n] = w->iov[i];
+        if (iov[n].iov_len > left) {
+            iov[n].iov_len = left;
+        }
+        left -= iov[n++].iov_len;
+    }
+
+    if (s->is_socket) {
+        /* whatever does not fit is dropped with the rest of the message */
+        char discard;
+        iov[n].iov_base = &discard;
+        iov[n++].iov_len = 1;
+        if (readv(s->fcli, iov, n) < (ssize_t)sizeof(header)) {
+            return -1;
+        }
+    } else {
+        if (readv_all(s->fcli, iov, n) == -1) {
+            return -1;
+        }
+        char discard[256];
+        while (left > 0) {
+            struct iovec rest = {discard, left < sizeof(discard)
+                                              ? left
+                                              : sizeof(discard)};
+            left -= rest.iov_len;
+            if (readv_all(s->fcli, &rest, 1) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    if (w != NULL) {
+        pthread_mutex_lock(&s->lock);
+        w->len = header.len;
+        w->done = true;
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return 0;
+}
+
+/* Registers a thread to wait for the reply to a request it is about to send,
+ * under a new tag */
+static void waiter_add(tfs_session_t *s, waiter_t *w, struct iovec const *ret,
+                       int n_ret) {
+    memcpy(w->iov, ret, sizeof(struct iovec) * (size_t)n_ret);
+    w->iovcnt = n_ret;
+    w->len = 0;
+    w->done = false;
+    pthread_cond_init(&w->wake, NULL);
+
+    pthread_mutex_lock(&s->lock);
+    /* 0 is only used by the mount, which comes first */
+    w->tag = s->next_tag++;
+    w->next = s->waiters;
+    s->waiters = w;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Waits for the reply of a waiter, reading the replies of the channel while
+ * no other thread does, and unregisters it.
+ * Returns the length of the reply, -1 if none came.
+ */
+static ssize_t waiter_wait(tfs_session_t *s, waiter_t *w, bool sent) {
+    pthread_mutex_lock(&s->lock);
+    while (sent && !w->done && !s->broken) {
+        if (s->reading) {
+            pthread_cond_wait(&w->wake, &s->lock);
+            continue;
+        }
+        s->reading = true;
+        pthread_mutex_unlock(&s->lock);
+        int r = read_reply(s);
+        pthread_mutex_lock(&s->lock);
+        s->reading = false;
+        if (r == -1) {
+            perror("Read error");
+            s->broken = true;
+        }
+    }
+
+    waiter_t **p = &s->waiters;
+    while (*p != w) {
+        p = &(*p)->next;
+    }
+    *p = w->next;
+
+    /* another thread still waiting takes over the channel (or finds it
+     * broken); only one of them is woken up */
+    for (waiter_t *next = s->waiters; next != NULL; next = next->next) {
+        if (!next->done || s->broken) {
+            pthread_cond_signal(&next->wake);
+            if (!s->broken) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    pthread_cond_destroy(&w->wake);
+    return w->done ? (ssize_t)w->len : -1;
+}
+
+/*
+ * Sends a request and waits for its reply. The request is the op code, the
+ * session id and a new tag, followed by the n_args buffers of args; the
+ * reply is scattered over the n_ret buffers of ret.
+ * Returns the length of the reply, -1 if there was none.
+ */
+static ssize_t request(tfs_session_t *s, char opcode, struct iovec const *args,
+                       int n_args, struct iovec const *ret, int n_ret) {
+    waiter_t w;
+    waiter_add(s, &w, ret, n_ret);
+
+    char header[1 + sizeof(int) + sizeof(tfs_tag_t)];
+    memcpy(header, &opcode, sizeof(char));
+    memcpy(header + 1, &s->id, sizeof(int));
+    memcpy(header + 5, &w.tag, sizeof(tfs_tag_t));
+
+    struct iovec iov[1 + MAX_IOV];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    memcpy(iov + 1, args, sizeof(struct iovec) * (size_t)n_args);
+
+    /* a request fits in PIPE_BUF, so threads never interleave theirs */
+    bool sent = writev(s->fserv, iov, 1 + n_args) != -1;
+    if (!sent) {
+        perror("Write error");
+    }
+    return waiter_wait(s, &w, sent);
+}
+
+/* Sends a request whose reply is an int; returns it, -1 on error */
+static int request_int(tfs_session_t *s, char opcode, struct iovec const *args,
+                       int n_args) {
+    int ret = -1;
+    struct iovec iov = {&ret, sizeof(int)};
+    if (request(s, opcode, args, n_args, &iov, 1) != sizeof(int)) {
+        return -1;
+    }
+    return ret;
+}
+
+/* Sends a request whose reply is an ssize_t; returns it, -1 on error */
+static ssize_t request_ssize(tfs_session_t *s, char opcode,
+                             struct iovec const *args, int n_args) {
+    ssize_t ret = -1;
+    struct iovec iov = {&ret, sizeof(ssize_t)};
+    if (request(s, opcode, args, n_args, &iov, 1) != sizeof(ssize_t)) {
+        return -1;
+    }
+    return ret;
+}
+
+/*
+ * Creates the shared-memory arena and asks the server to map it.
+ * On any failure the session simply keeps using the pipes.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int shm_attach(tfs_session_t *s) {
+    char name[TFS_SHM_NAME_SIZE];
+    memset(name, '\0', sizeof(name));
+    snprintf(name, sizeof(name), "%s%d_%d", TFS_SHM_PREFIX, (int)getpid(),
+             s->id);
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        perror("Shm_open error");
+        return -1;
+    }
+    if (ftruncate(fd, TFS_SHM_ARENA_SIZE) == -1) {
+        perror("Ftruncate error");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    void *arena = mmap(NULL, TFS_SHM_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    close(fd);
+    if (arena == MAP_FAILED) {
+        perror("Mmap error");
+        shm_unlink(name);
+        return -1;
+    }
+
+    struct iovec args = {name, TFS_SHM_NAME_SIZE};
+    int ret = request_int(s, TFS_OP_CODE_SHM_ATTACH, &args, 1);
+
+    /* once the server has mapped it (or refused to), the name is no longer
+     * needed, so nothing is left behind if either side crashes */
+    shm_unlink(name);
+    if (ret == -1) {
+        munmap(arena, TFS_SHM_ARENA_SIZE);
+        return -1;
+    }
+
+    s->shm_arena = arena;
+    return 0;
+}
+
+/*
+ * Creates the callback pipe and registers it with the server, without which
+ * the server grants no leases.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int cache_register(tfs_session_t *s) {
+    memset(s->callback_path, '\0', sizeof(s->callback_path));
+    snprintf(s->callback_path, sizeof(s->callback_path), "%s%d_%d",
+             TFS_CALLBACK_PREFIX, (int)getpid(), s->id);
+
+    unlink(s->callback_path);
+    if (mkfifo(s->callback_path, 0600) == -1) {
         perror("Mkfifo error");
         return -1;
     }
-    if ((fserv = open(server_pipe_path, O_WRONLY)) == -1) {
+    /* the read end has to be open before the server opens the other one */
+    int fd = open(s->callback_path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
         perror("Open error");
+        unlink(s->callback_path);
         return -1;
     }
-    
-    char opcode = TFS_OP_CODE_MOUNT;
-    char buffer[41];
-    memcpy(buffer, &opcode, sizeof(char));
-    memset(buffer + 1, '\0', sizeof(char) * 40);
-    memcpy(buffer + 1, client_pipe_path, sizeof(char) * strlen(client_pipe_path));
 
-    if (write (fserv, buffer, sizeof(buffer)) == -1) {
-        perror("Write error");
+    struct iovec args = {s->callback_path, TFS_CALLBACK_PATH_SIZE};
+    int ret = request_int(s, TFS_OP_CODE_CALLBACK, &args, 1);
+    /* both ends are open (or never will be): the name is not needed */
+    unlink(s->callback_path);
+    if (ret == -1) {
+        close(fd);
         return -1;
     }
-    fcli = open(client_pipe_path, O_RDONLY);
-    if (fcli == -1) {
-        perror("Open error");
+    s->fcb = fd;
+    return 0;
+}
+
+/*
+ * Turns on the cache. On any failure the session simply does not cache.
+ */
+static void cache_attach(tfs_session_t *s) {
+    if (cache_register(s) == -1) {
+        return;
+    }
+    s->caching = true;
+}
+
+/*
+ * Applies the revocations the server has sent so far. Since the server sends
+ * them before acknowledging the write that caused them, anything written
+ * before this call started is seen.
+ */
+static void cache_poll(tfs_session_t *s) {
+    int inumbers[64];
+    while (s->fcb != -1) {
+        ssize_t rd = read(s->fcb, inumbers, sizeof(inumbers));
+        if (rd == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rd == -1 && errno == EAGAIN) {
+            return;
+        }
+        if (rd <= 0) {
+            /* the server could not deliver a revocation: trust nothing, and
+             * start over with a new channel */
+            for (int i = 0; i < CACHE_ENTRIES; i++) {
+                s->cache[i].valid = false;
+            }
+            s->n_revoked += REVOKED_RING + 1;
+            close(s->fcb);
+            s->fcb = -1;
+            /* only once: without a channel no leases are granted, and the
+             * session goes on without caching new files */
+            cache_register(s);
+            return;
+        }
+        for (size_t n = 0; n < (size_t)rd / sizeof(int); n++) {
+            s->revoked[s->n_revoked++ % REVOKED_RING] = inumbers[n];
+            for (int i = 0; i < CACHE_ENTRIES; i++) {
+                if (s->cache[i].valid && s->cache[i].inumber == inumbers[n]) {
+                    s->cache[i].valid = false;
+                    s->cache_stats.revocations++;
+                }
+            }
+        }
+    }
+}
+
+/* Returns the (current) cached contents of a file, NULL if there are none */
+static cache_entry_t *cache_find(tfs_session_t *s, char const *name) {
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        if (s->cache[i].valid && strcmp(s->cache[i].name, name) == 0) {
+            s->cache[i].used = ++s->cache_clock;
+            return &s->cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Returns the entry to keep a file in: its own, or the least recently used */
+static cache_entry_t *cache_slot(tfs_session_t *s, char const *name) {
+    cache_entry_t *victim = &s->cache[0];
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        if (strcmp(s->cache[i].name, name) == 0) {
+            return &s->cache[i];
+        }
+        if (s->cache[i].used < victim->used) {
+            victim = &s->cache[i];
+        }
+    }
+    /* the server may still revoke its lease, which is then ignored */
+    strcpy(victim->name, name);
+    victim->valid = false;
+    return victim;
+}
+
+/*
+ * Connects to a server listening on a SOCK_SEQPACKET Unix socket; the one
+ * connection carries both the requests and the replies.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int socket_connect(tfs_session_t *s, char const *server_path) {
+    struct sockaddr_un addr;
+    if (strlen(server_path) >= sizeof(addr.sun_path)) {
         return -1;
     }
-    
-    ssize_t rd = read(fcli, &id, sizeof(int));
-    if (rd == -1) {
-        perror("Read error");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, server_path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd == -1) {
+        perror("Socket error");
         return -1;
     }
-    if (id == 0) {
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("Connect error");
+        close(fd);
         return -1;
     }
+    s->fserv = s->fcli = fd;
     return 0;
 }
 
-int tfs_unmount() {
-    char buffer[5];
-    char opcode = TFS_OP_CODE_UNMOUNT;
+static tfs_session_t *session_create() {
+    tfs_session_t *s = calloc(1, sizeof(tfs_session_t));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->fserv = s->fcli = s->fcb = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->shm_lock, NULL);
+    pthread_mutex_init(&s->state_lock, NULL);
+    pthread_mutex_init(&s->cache_lock, NULL);
+    return s;
+}
+
+static void session_destroy(tfs_session_t *s) {
+    if (s->fcli != -1 && s->fcli != s->fserv) {
+        close(s->fcli);
+    }
+    if (s->fserv != -1) {
+        close(s->fserv);
+    }
+    if (s->client_path[0] != '\0') {
+        unlink(s->client_path);
+    }
+    if (s->shm_arena != NULL) {
+        munmap(s->shm_arena, TFS_SHM_ARENA_SIZE);
+    }
+    if (s->fcb != -1) {
+        close(s->fcb);
+    }
+    for (int fh = 0; fh < WRITE_BUFFERS; fh++) {
+        free(s->write_buffers[fh].data);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_mutex_destroy(&s->shm_lock);
+    pthread_mutex_destroy(&s->state_lock);
+    pthread_mutex_destroy(&s->cache_lock);
+    free(s);
+}
+
+/*
+ * Mounts a session on every shard listed in a shard map (see
+ * tools/tfs_shards); shard i gets the reply pipe client_pipe_path.i.
+ * Returns the sharded session, or NULL if a shard could not be mounted.
+ */
+static tfs_session_t *shards_mount(char const *client_pipe_path,
+                                   char const *map_path) {
+    FILE *map = fopen(map_path, "r");
+    if (map == NULL) {
+        perror("Fopen error");
+        return NULL;
+    }
+    tfs_session_t *s = session_create();
+    if (s == NULL) {
+        fclose(map);
+        return NULL;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), map) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        char client_path[41];
+        int n = snprintf(client_path, sizeof(client_path), "%s.%d",
+                         client_pipe_path, s->n_shards);
+        tfs_session_t *shard = NULL;
+        if (s->n_shards < TFS_MAX_SHARDS && n < (int)sizeof(client_path)) {
+            shard = tfs_session_mount(client_path, line);
+        }
+        if (shard == NULL) {
+            fprintf(stderr, "cannot mount shard %d (%s)\n", s->n_shards,
+                    line);
+            fclose(map);
+            tfs_session_unmount(s);
+            return NULL;
+        }
+        s->shards[s->n_shards++] = shard;
+    }
+    fclose(map);
+
+    if (s->n_shards == 0) {
+        tfs_session_unmount(s);
+        return NULL;
+    }
+    return s;
+}
+
+tfs_session_t *tfs_session_mount(char const *client_pipe_path,
+                                 char const *server_pipe_path) {
+    struct stat st;
+    if (stat(server_pipe_path, &st) == -1) {
+        perror("Stat error");
+        return NULL;
+    }
+    if (S_ISREG(st.st_mode)) {
+        return shards_mount(client_pipe_path, server_pipe_path);
+    }
+    tfs_session_t *s = session_create();
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->is_socket = S_ISSOCK(st.st_mode);
+    if (s->is_socket) {
+        /* no reply pipe is needed, so there is none to leak */
+        if (socket_connect(s, server_pipe_path) == -1) {
+            session_destroy(s);
+            return NULL;
+        }
+    } else {
+        unlink(client_pipe_path);
+        if (mkfifo (client_pipe_path, 0644) == -1) {
+            perror("Mkfifo error");
+            session_destroy(s);
+            return NULL;
+        }
+        strncpy(s->client_path, client_pipe_path, sizeof(s->client_path) - 1);
+        if ((s->fserv = open(server_pipe_path, O_WRONLY)) == -1) {
+            perror("Open error");
+            session_destroy(s);
+            return NULL;
+        }
+    }
+
+    char opcode = TFS_OP_CODE_MOUNT;
+    char buffer[41];
     memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &id, sizeof(int));
+    memset(buffer + 1, '\0', sizeof(char) * 40);
+    if (!s->is_socket) {
+        memcpy(buffer + 1, client_pipe_path,
+               sizeof(char) * strlen(client_pipe_path));
+    }
 
-    if (write (fserv, buffer, sizeof(buffer)) == -1) {
+    /* the mount is the session's first request, so its tag is 0 */
+    waiter_t w;
+    struct iovec ret = {&s->id, sizeof(int)};
+    s->id = -1;
+    waiter_add(s, &w, &ret, 1);
+    bool sent = write(s->fserv, buffer, sizeof(buffer)) != -1;
+    if (!sent) {
         perror("Write error");
+    } else if (!s->is_socket &&
+               (s->fcli = open(client_pipe_path, O_RDONLY)) == -1) {
+        perror("Open error");
+        sent = false;
+    }
+    if (waiter_wait(s, &w, sent) != sizeof(int) || s->id == -1) {
+        session_destroy(s);
+        return NULL;
+    }
+
+    /* the shared-memory transport is opt-in; the pipes are the fallback */
+    char const *shm = getenv("TFS_SHM");
+    if (shm != NULL && strcmp(shm, "1") == 0) {
+        shm_attach(s);
+    }
+    /* so is write-behind */
+    char const *buffered = getenv("TFS_WRITE_BUFFER");
+    s->write_buffer_size =
+        buffered != NULL ? strtoul(buffered, NULL, 10) : 0;
+    /* so is the cache */
+    char const *cached = getenv("TFS_CACHE");
+    if (cached != NULL && strcmp(cached, "1") == 0) {
+        cache_attach(s);
+    }
+    return s;
+}
+
+int tfs_session_unmount(tfs_session_t *s) {
+    if (s == NULL) {
         return -1;
     }
-    if (close(fcli) == -1) {
-        perror("Closing error");
+    if (s->n_shards > 0 || s->fserv == -1) {
+        int ret = 0;
+        for (int i = 0; i < s->n_shards; i++) {
+            if (tfs_session_unmount(s->shards[i]) == -1) {
+                ret = -1;
+            }
+        }
+        session_destroy(s);
+        return ret;
+    }
+
+    /* the data of handles left open is not lost */
+    int ret = 0;
+    for (int fh = 0; fh < WRITE_BUFFERS; fh++) {
+        if (flush_buffer(s, fh) == -1) {
+            ret = -1;
+        }
+    }
+
+    /* there is no reply to wait for */
+    char buffer[1 + sizeof(int) + sizeof(tfs_tag_t)];
+    char opcode = TFS_OP_CODE_UNMOUNT;
+    tfs_tag_t tag = 0;
+    memcpy(buffer, &opcode, sizeof(char));
+    memcpy(buffer + 1, &s->id, sizeof(int));
+    memcpy(buffer + 5, &tag, sizeof(tfs_tag_t));
+    if (write (s->fserv, buffer, sizeof(buffer)) == -1) {
+        perror("Write error");
+        ret = -1;
+    }
+
+    session_destroy(s);
+    return ret;
+}
+
+static int remote_open(tfs_session_t *s, char const *name, int flags) {
+    char padded[40];
+    memset(padded, '\0', sizeof(padded));
+    memcpy(padded, name, strnlen(name, sizeof(padded)));
+
+    struct iovec args[2] = {{padded, sizeof(padded)}, {&flags, sizeof(int)}};
+    return request_int(s, TFS_OP_CODE_OPEN, args, 2);
+}
+
+static int remote_close(tfs_session_t *s, int fhandle) {
+    struct iovec args = {&fhandle, sizeof(int)};
+    return request_int(s, TFS_OP_CODE_CLOSE, &args, 1);
+}
+
+/*
+ * Asks for a lease on the file of a server handle (the cache lock is not
+ * held): the file's contents go to data.
+ * Returns the file's size, -1 if no lease was granted.
+ */
+static ssize_t lease_fetch(tfs_session_t *s, int fh, int *inumber,
+                           char *data) {
+    ssize_t size = -1;
+    struct iovec args = {&fh, sizeof(int)};
+    struct iovec ret[3] = {{&size, sizeof(ssize_t)},
+                           {inumber, sizeof(int)},
+                           {data, TFS_LEASE_DATA_MAX}};
+    ssize_t len = request(s, TFS_OP_CODE_LEASE, &args, 1, ret, 3);
+    if (size < 0 ||
+        len != (ssize_t)(sizeof(ssize_t) + sizeof(int)) + size) {
         return -1;
     }
-    if(close(fserv) == -1) {
-        perror("Closing error");
+    return size;
+}
+
+/* Takes a mark before a request is sent with the cache lock released; a
+ * request that writes counts as in flight until cache_write_end */
+static cache_mark_t cache_mark(tfs_session_t *s, bool writes) {
+    cache_mark_t mark;
+    mark.alone = s->writes_in_flight == 0;
+    mark.epoch = writes ? ++s->cache_epoch : s->cache_epoch;
+    mark.revoked = s->n_revoked;
+    if (writes) {
+        s->writes_in_flight++;
+    }
+    return mark;
+}
+
+static void cache_write_end(tfs_session_t *s) { s->writes_in_flight--; }
+
+/* Whether no write of the session overlapped a request since its mark */
+static bool cache_alone(tfs_session_t const *s, cache_mark_t mark) {
+    return mark.alone && s->cache_epoch == mark.epoch;
+}
+
+/* Whether a file's lease may have been revoked since a mark */
+static bool cache_revoked(tfs_session_t const *s, cache_mark_t mark,
+                          int inumber) {
+    if (s->n_revoked - mark.revoked > REVOKED_RING) {
+        return true;
+    }
+    for (uint64_t n = mark.revoked; n < s->n_revoked; n++) {
+        if (s->revoked[n % REVOKED_RING] == inumber) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Caches the contents that came with a lease asked for after a mark (with
+ * the cache lock held), unless they may have changed since: a revocation
+ * of the file, or a write of the session, came in meanwhile.
+ */
+static void cache_install(tfs_session_t *s, char const *name,
+                          cache_mark_t mark, int inumber, char const *data,
+                          size_t size) {
+    /* the revocations of older leases on the file were sent before this one
+     * was granted, so they are all in the pipe by now */
+    cache_poll(s);
+    if (!cache_alone(s, mark) || cache_revoked(s, mark, inumber)) {
+        return;
+    }
+    cache_entry_t *entry = cache_slot(s, name);
+    memcpy(entry->data, data, size);
+    entry->inumber = inumber;
+    entry->size = size;
+    entry->used = ++s->cache_clock;
+    entry->valid = true;
+}
+
+static ssize_t remote_read(tfs_session_t *s, int fhandle, void *buffer,
+                           size_t len);
+static ssize_t remote_write(tfs_session_t *s, int fhandle, void const *buffer,
+                            size_t len);
+
+static cache_file_t *cached_file(tfs_session_t *s, int fhandle) {
+    if (fhandle < 0 || fhandle >= CACHE_FILES ||
+        !s->cache_files[fhandle].used) {
+        return NULL;
+    }
+    return &s->cache_files[fhandle];
+}
+
+/* Returns the server handle of a client handle (the cache lock is not
+ * held), opening one if needed; -1 if it has none */
+static int cache_server_handle(tfs_session_t *s, int fhandle) {
+    char name[41];
+    pthread_mutex_lock(&s->cache_lock);
+    cache_file_t *file = cached_file(s, fhandle);
+    int fh = file != NULL ? file->fh : -1;
+    if (file != NULL) {
+        strcpy(name, file->name);
+    }
+    pthread_mutex_unlock(&s->cache_lock);
+    if (file == NULL || fh != -1) {
+        return fh;
+    }
+
+    fh = remote_open(s, name, 0);
+    if (fh == -1) {
         return -1;
     }
+    /* another thread may have opened one meanwhile, or closed the handle */
+    int extra = fh;
+    pthread_mutex_lock(&s->cache_lock);
+    file = cached_file(s, fhandle);
+    if (file == NULL || strcmp(file->name, name) != 0) {
+        fh = -1;
+    } else if (file->fh != -1) {
+        fh = file->fh;
+    } else {
+        file->fh = fh;
+        extra = -1;
+    }
+    pthread_mutex_unlock(&s->cache_lock);
+    if (extra != -1) {
+        remote_close(s, extra);
+    }
+    return fh;
+}
 
-    return 0;
+/* Reads from a file's contents at the client handle's offset */
+static ssize_t read_at(cache_file_t *file, char const *data, size_t size,
+                       void *buffer, size_t len) {
+    size_t to_read = file->offset < size ? size - file->offset : 0;
+    if (to_read > len) {
+        to_read = len;
+    }
+    memcpy(buffer, data + file->offset, to_read);
+    file->offset += to_read;
+    return (ssize_t)to_read;
 }
 
-int tfs_open(char const *name, int flags) {
-    char buffer[49];
-    char opcode = TFS_OP_CODE_OPEN;
+/*
+ * Opens a file; if its contents are cached, the server is not involved.
+ * The cache lock is only held between the requests to the server, the
+ * handle being taken in the meantime.
+ */
+static int cached_open(tfs_session_t *s, char const *name, int flags) {
+    if (strlen(name) > 40) {
+        return -1;
+    }
+    pthread_mutex_lock(&s->cache_lock);
+    int h = 0;
+    while (h < CACHE_FILES && s->cache_files[h].used) {
+        h++;
+    }
+    if (h == CACHE_FILES) {
+        pthread_mutex_unlock(&s->cache_lock);
+        return -1;
+    }
+    cache_file_t *file = &s->cache_files[h];
+    file->used = true;
+    file->fh = -1;
+    file->uncached = false;
+    file->offset = 0;
+    strcpy(file->name, name);
 
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer +  1, &id, sizeof(int));
-    memset(buffer +  5, '\0', sizeof(char) * 40);
+    cache_poll(s);
+    cache_entry_t *entry = NULL;
+    if (!(flags & TFS_O_TRUNC)) {
+        entry = cache_find(s, name);
+    }
+    if (entry != NULL) {
+        s->cache_stats.open_hits++;
+        file->offset = (flags & TFS_O_APPEND) ? entry->size : 0;
+        pthread_mutex_unlock(&s->cache_lock);
+        return h;
+    }
+    s->cache_stats.open_misses++;
+    /* a truncation is a write of this session, which revokes no lease of
+     * its own */
+    bool truncates = flags & TFS_O_TRUNC;
+    if (truncates) {
+        cache_mark(s, true);
+    }
+    pthread_mutex_unlock(&s->cache_lock);
 
-    memcpy(buffer +  5, name, sizeof(char) * strlen(name));
-    memcpy(buffer + 45, &flags, sizeof(int));
+    int fh = remote_open(s, name, flags);
 
-    if (write (fserv, buffer, sizeof(buffer)) == -1) {
-        perror("Write error");
+    pthread_mutex_lock(&s->cache_lock);
+    if (truncates) {
+        cache_write_end(s);
+        cache_slot(s, name)->valid = false;
+    }
+    if (fh == -1) {
+        file->used = false;
+        pthread_mutex_unlock(&s->cache_lock);
         return -1;
     }
+    file->fh = fh;
+    /* a file that cannot be leased (too large for the cache, or the session
+     * lost its callback pipe) is still opened, uncached */
+    if (s->fcb == -1) {
+        file->uncached = true;
+        pthread_mutex_unlock(&s->cache_lock);
+        return h;
+    }
+    cache_mark_t mark = cache_mark(s, false);
+    pthread_mutex_unlock(&s->cache_lock);
 
-    int ret;
-    ssize_t rd = read(fcli, &ret, sizeof(int));
-    if (rd == -1) {
-        perror("Read error");
+    char data[TFS_LEASE_DATA_MAX];
+    int inumber = -1;
+    ssize_t size = lease_fetch(s, fh, &inumber, data);
+
+    pthread_mutex_lock(&s->cache_lock);
+    if (size == -1) {
+        file->uncached = true;
+    } else {
+        cache_install(s, name, mark, inumber, data, (size_t)size);
+        file->offset = (flags & TFS_O_APPEND) ? (size_t)size : 0;
+    }
+    pthread_mutex_unlock(&s->cache_lock);
+    return h;
+}
+
+static int cached_close(tfs_session_t *s, int fhandle) {
+    pthread_mutex_lock(&s->cache_lock);
+    cache_file_t *file = cached_file(s, fhandle);
+    int fh = file != NULL ? file->fh : -1;
+    if (file != NULL) {
+        file->used = false;
+    }
+    pthread_mutex_unlock(&s->cache_lock);
+    if (file == NULL) {
+        return -1;
+    }
+    return fh != -1 ? remote_close(s, fh) : 0;
+}
+
+/* Writes through to the server, at the client handle's offset, and updates
+ * the cached contents if the lease survived the write (and no other write
+ * of the session overlapped it) */
+static ssize_t cached_write(tfs_session_t *s, int fhandle, void const *buffer,
+                            size_t len) {
+    int fh = cache_server_handle(s, fhandle);
+    if (fh == -1) {
+        return -1;
+    }
+    pthread_mutex_lock(&s->cache_lock);
+    cache_file_t *file = cached_file(s, fhandle);
+    if (file == NULL) {
+        pthread_mutex_unlock(&s->cache_lock);
         return -1;
     }
+    char name[41];
+    strcpy(name, file->name);
+    size_t offset = file->offset;
+    bool uncached = file->uncached;
+    cache_mark_t mark = cache_mark(s, true);
+    pthread_mutex_unlock(&s->cache_lock);
+
+    ssize_t ret;
+    if (uncached) {
+        ret = remote_write(s, fh, buffer, len);
+    } else {
+        if (len > TFS_MAX_PAYLOAD) {
+            len = TFS_MAX_PAYLOAD;
+        }
+        struct iovec args[4] = {{&fh, sizeof(int)},
+                                {&len, sizeof(size_t)},
+                                {&offset, sizeof(size_t)},
+                                {(void *)buffer, len}};
+        ret = request_ssize(s, TFS_OP_CODE_PWRITE, args, 4);
+    }
 
+    pthread_mutex_lock(&s->cache_lock);
+    cache_write_end(s);
+    if (ret > 0) {
+        cache_poll(s);
+        /* the lease of this session survives its writes, so the contents
+         * it cached are updated, or dropped if they cannot be */
+        cache_entry_t *entry = cache_find(s, name);
+        if (entry != NULL && (uncached || !cache_alone(s, mark))) {
+            entry->valid = false;
+        } else if (entry != NULL) {
+            if (offset > entry->size) {
+                memset(entry->data + entry->size, 0, offset - entry->size);
+            }
+            memcpy(entry->data + offset, buffer, (size_t)ret);
+            if (offset + (size_t)ret > entry->size) {
+                entry->size = offset + (size_t)ret;
+            }
+        }
+        file = cached_file(s, fhandle);
+        if (!uncached && file != NULL) {
+            file->offset = offset + (size_t)ret;
+        }
+    }
+    pthread_mutex_unlock(&s->cache_lock);
     return ret;
 }
 
-int tfs_close(int fhandle) {
-    char buffer[9];
-    char opcode = TFS_OP_CODE_CLOSE;
+/* Reads from the cached contents, leasing them again if they were revoked */
+static ssize_t cached_read(tfs_session_t *s, int fhandle, void *buffer,
+                           size_t len) {
+    pthread_mutex_lock(&s->cache_lock);
+    cache_file_t *file = cached_file(s, fhandle);
+    if (file == NULL) {
+        pthread_mutex_unlock(&s->cache_lock);
+        return -1;
+    }
+    if (file->uncached) {
+        int fh = file->fh;
+        pthread_mutex_unlock(&s->cache_lock);
+        return remote_read(s, fh, buffer, len);
+    }
 
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &id, sizeof(int));
-    memcpy(buffer + 5, &fhandle, sizeof(int));
+    cache_poll(s);
+    cache_entry_t *entry = cache_find(s, file->name);
+    if (entry != NULL) {
+        s->cache_stats.read_hits++;
+        ssize_t ret = read_at(file, entry->data, entry->size, buffer, len);
+        pthread_mutex_unlock(&s->cache_lock);
+        return ret;
+    }
+    s->cache_stats.read_misses++;
+    char name[41];
+    strcpy(name, file->name);
+    pthread_mutex_unlock(&s->cache_lock);
 
-    if (write (fserv, buffer, sizeof(buffer)) == -1) {
-        perror("Write error");
+    int fh = cache_server_handle(s, fhandle);
+    if (fh == -1) {
         return -1;
     }
-    
-    int ret;
-    ssize_t rd = read(fcli, &ret, sizeof(int));
-    if (rd == -1) {
-        perror("Read error");
+    pthread_mutex_lock(&s->cache_lock);
+    cache_mark_t mark = cache_mark(s, false);
+    pthread_mutex_unlock(&s->cache_lock);
+
+    /* the read is answered from the contents that came with the lease, even
+     * if they cannot be cached */
+    char data[TFS_LEASE_DATA_MAX];
+    int inumber = -1;
+    ssize_t size = lease_fetch(s, fh, &inumber, data);
+    if (size == -1) {
         return -1;
     }
+
+    pthread_mutex_lock(&s->cache_lock);
+    cache_install(s, name, mark, inumber, data, (size_t)size);
+    file = cached_file(s, fhandle);
+    ssize_t ret = file != NULL
+                      ? read_at(file, data, (size_t)size, buffer, len)
+                      : -1;
+    pthread_mutex_unlock(&s->cache_lock);
     return ret;
+}
 
+int tfs_session_open(tfs_session_t *s, char const *name, int flags) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        int shard = route_name(s, name);
+        int fh = tfs_session_open(s->shards[shard], name, flags);
+        return fh == -1 ? -1 : fh * s->n_shards + shard;
+    }
+    if (s->caching) {
+        return cached_open(s, name, flags);
+    }
+    return remote_open(s, name, flags);
 }
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
-    char res_buffer[len + 17]; 
-    char opcode = TFS_OP_CODE_WRITE;
-    memcpy(res_buffer, &opcode, sizeof(char));
-    memcpy(res_buffer +  1, &id, sizeof(int));
-    memcpy(res_buffer +  5, &fhandle, sizeof(int));
-    memcpy(res_buffer +  9, &len, sizeof(size_t));
-    memcpy(res_buffer + 17, buffer, sizeof(char) * len);
-
-    if (write (fserv, res_buffer, sizeof(res_buffer)) == -1) {
-        perror("Write error");
+int tfs_session_close(tfs_session_t *s, int fhandle) {
+    s = route_handle(s, &fhandle);
+    if (s == NULL) {
         return -1;
     }
 
-    ssize_t ret;
-    ssize_t rd = read(fcli, &ret, sizeof(ssize_t));
-    if (rd == -1) {
-        perror("Read error");
+    /* the handle is closed even if its last writes failed */
+    int flushed = flush_buffer(s, fhandle);
+    int ret;
+    if (s->caching) {
+        ret = cached_close(s, fhandle);
+    } else {
+        ret = remote_close(s, fhandle);
+    }
+    return flushed == -1 ? -1 : ret;
+}
+
+/* Writes through the shared-memory arena: the payload is copied once into the
+ * arena and the server reads it in place */
+static ssize_t write_shm(tfs_session_t *s, int fhandle, void const *buffer,
+                         size_t len) {
+    struct iovec args[2] = {{&fhandle, sizeof(int)}, {&len, sizeof(size_t)}};
+
+    pthread_mutex_lock(&s->shm_lock);
+    memcpy(s->shm_arena, buffer, len);
+    ssize_t ret = request_ssize(s, TFS_OP_CODE_SHM_WRITE, args, 2);
+    pthread_mutex_unlock(&s->shm_lock);
+    return ret;
+}
+
+/* Writes to a server handle, through the arena if the session has one */
+static ssize_t remote_write(tfs_session_t *s, int fhandle, void const *buffer,
+                            size_t len) {
+    if (s->shm_arena != NULL && len <= TFS_SHM_ARENA_SIZE) {
+        return write_shm(s, fhandle, buffer, len);
+    }
+    if (len > TFS_MAX_PAYLOAD) {
+        len = TFS_MAX_PAYLOAD;
+    }
+
+    struct iovec args[3] = {{&fhandle, sizeof(int)},
+                            {&len, sizeof(size_t)},
+                            {(void *)buffer, len}};
+    return request_ssize(s, TFS_OP_CODE_WRITE, args, 3);
+}
+
+/* Sends a write to the server right away (with the state lock held, if the
+ * session caches) */
+static ssize_t write_through(tfs_session_t *s, int fhandle, void const *buffer,
+                             size_t len) {
+    if (s->caching) {
+        return cached_write(s, fhandle, buffer, len);
+    }
+    return remote_write(s, fhandle, buffer, len);
+}
+
+/*
+ * Sends the buffered writes of a handle to the server. If they cannot all be
+ * written (an error, or the file is full), the rest is discarded.
+ * Returns 0 if successful (or nothing was buffered), -1 otherwise.
+ */
+static int flush_buffer(tfs_session_t *s, int fhandle) {
+    if (s->write_buffer_size == 0 || fhandle < 0 ||
+        fhandle >= WRITE_BUFFERS) {
+        return 0;
+    }
+    pthread_mutex_lock(&s->state_lock);
+    write_buffer_t *wb = &s->write_buffers[fhandle];
+
+    size_t done = 0;
+    while (done < wb->len) {
+        ssize_t wt =
+            write_through(s, fhandle, wb->data + done, wb->len - done);
+        if (wt <= 0) {
+            break;
+        }
+        done += (size_t)wt;
+    }
+    int ret = done == wb->len ? 0 : -1;
+    wb->len = 0;
+    pthread_mutex_unlock(&s->state_lock);
+    return ret;
+}
+
+/* Buffers a write (with the state lock held) */
+static ssize_t buffered_write(tfs_session_t *s, int fhandle,
+                              void const *buffer, size_t len) {
+    write_buffer_t *wb = &s->write_buffers[fhandle];
+
+    if (wb->len + len > s->write_buffer_size) {
+        /* a failure of earlier writes is reported here, and this one is not
+         * done either */
+        size_t done = 0;
+        while (done < wb->len) {
+            ssize_t wt =
+                write_through(s, fhandle, wb->data + done, wb->len - done);
+            if (wt <= 0) {
+                break;
+            }
+            done += (size_t)wt;
+        }
+        bool flushed = done == wb->len;
+        wb->len = 0;
+        if (!flushed) {
+            return -1;
+        }
+        if (len >= s->write_buffer_size) {
+            return write_through(s, fhandle, buffer, len);
+        }
+    }
+    if (wb->data == NULL &&
+        (wb->data = malloc(s->write_buffer_size)) == NULL) {
+        return write_through(s, fhandle, buffer, len);
+    }
+
+    memcpy(wb->data + wb->len, buffer, len);
+    wb->len += len;
+    return (ssize_t)len;
+}
+
+ssize_t tfs_session_write(tfs_session_t *s, int fhandle, void const *buffer,
+                          size_t len) {
+    s = route_handle(s, &fhandle);
+    if (s == NULL) {
         return -1;
     }
+    bool buffered = s->write_buffer_size > 0 && fhandle >= 0 &&
+                    fhandle < WRITE_BUFFERS;
+    if (!buffered) {
+        return write_through(s, fhandle, buffer, len);
+    }
+
+    pthread_mutex_lock(&s->state_lock);
+    ssize_t ret = buffered ? buffered_write(s, fhandle, buffer, len)
+                           : write_through(s, fhandle, buffer, len);
+    pthread_mutex_unlock(&s->state_lock);
     return ret;
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    char res_buffer[17];
-    char opcode = TFS_OP_CODE_READ;
+int tfs_session_flush(tfs_session_t *s, int fhandle) {
+    s = route_handle(s, &fhandle);
+    if (s == NULL) {
+        return -1;
+    }
+    return flush_buffer(s, fhandle);
+}
 
-    memcpy(res_buffer, &opcode, sizeof(char));
-    memcpy(res_buffer + 1, &id, sizeof(int));
-    memcpy(res_buffer + 5, &fhandle, sizeof(int));
-    memcpy(res_buffer + 9, &len, sizeof(size_t));
+/* Reads through the shared-memory arena: the server reads the file straight
+ * into the arena and only the byte count travels through the pipe */
+static ssize_t read_shm(tfs_session_t *s, int fhandle, void *buffer,
+                        size_t len) {
+    struct iovec args[2] = {{&fhandle, sizeof(int)}, {&len, sizeof(size_t)}};
 
-    if (write (fserv, res_buffer, sizeof(res_buffer)) == -1) {
-        perror("Write error");
+    pthread_mutex_lock(&s->shm_lock);
+    ssize_t num = request_ssize(s, TFS_OP_CODE_SHM_READ, args, 2);
+    if (num > 0) {
+        memcpy(buffer, s->shm_arena, (size_t)num);
+    }
+    pthread_mutex_unlock(&s->shm_lock);
+    return num;
+}
+
+/* Reads from a server handle, through the arena if the session has one */
+static ssize_t remote_read(tfs_session_t *s, int fhandle, void *buffer,
+                           size_t len) {
+    if (s->shm_arena != NULL && len <= TFS_SHM_ARENA_SIZE) {
+        return read_shm(s, fhandle, buffer, len);
+    }
+
+    ssize_t num = -1;
+    struct iovec args[2] = {{&fhandle, sizeof(int)}, {&len, sizeof(size_t)}};
+    struct iovec ret[2] = {{&num, sizeof(ssize_t)}, {buffer, len}};
+    ssize_t got = request(s, TFS_OP_CODE_READ, args, 2, ret, 2);
+    if (num < 0 || got != (ssize_t)sizeof(ssize_t) + num) {
         return -1;
     }
-    ssize_t num;
-    ssize_t rd = read(fcli, &num, sizeof(ssize_t));
-    if (rd == -1) {
-        perror("Read error");
+    return num;
+}
+
+ssize_t tfs_session_read(tfs_session_t *s, int fhandle, void *buffer,
+                         size_t len) {
+    s = route_handle(s, &fhandle);
+    if (s == NULL) {
         return -1;
     }
-    if (num == -1) {
+    /* a read sees the writes done before it on the same handle */
+    if (flush_buffer(s, fhandle) == -1) {
         return -1;
     }
-        
-    ssize_t rd2 = read(fcli, buffer, sizeof(char) * (size_t) num);
-    if (rd2 == -1) {
-        perror("Read error");
+    if (s->caching) {
+        return cached_read(s, fhandle, buffer, len);
+    }
+    return remote_read(s, fhandle, buffer, len);
+}
+
+int tfs_session_shutdown_after_all_closed(tfs_session_t *s) {
+    if (s == NULL) {
         return -1;
     }
-    return num;
+    if (s->n_shards > 0) {
+        int ret = 0;
+        for (int i = 0; i < s->n_shards; i++) {
+            if (tfs_session_shutdown_after_all_closed(s->shards[i]) == -1) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+    return request_int(s, TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED, NULL, 0);
 }
 
-int tfs_shutdown_after_all_closed() {
-    char buffer[5];
-    char opcode = TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED;
+/* Adds the counters of one shard to those of the others */
+static void stats_add(tfs_stats_t *total, tfs_stats_t const *shard) {
+    for (int op = 0; op < TFS_OP_CODE_COUNT; op++) {
+        tfs_op_stats_t *t = &total->ops[op];
+        tfs_op_stats_t const *o = &shard->ops[op];
+        t->count += o->count;
+        t->bytes_in += o->bytes_in;
+        t->bytes_out += o->bytes_out;
+        for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+            t->latency[i] += o->latency[i];
+        }
+    }
+    total->lock_acquisitions += shard->lock_acquisitions;
+    total->lock_contended += shard->lock_contended;
+    total->lock_wait_ns += shard->lock_wait_ns;
+    total->storage_accesses += shard->storage_accesses;
+    total->sessions += shard->sessions;
+    total->lease_grants += shard->lease_grants;
+    total->lease_revocations += shard->lease_revocations;
+}
 
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &id, sizeof(int));
-    if (write (fserv, buffer, sizeof(buffer)) == -1) {
-        perror("Write error");
+int tfs_session_stats(tfs_session_t *s, tfs_stats_t *stats) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        /* the counters of all shards, summed */
+        tfs_stats_t *shard = malloc(sizeof(tfs_stats_t));
+        if (shard == NULL) {
+            return -1;
+        }
+        int ret = 0;
+        memset(stats, 0, sizeof(tfs_stats_t));
+        for (int i = 0; i < s->n_shards && ret == 0; i++) {
+            ret = tfs_session_stats(s->shards[i], shard);
+            stats_add(stats, shard);
+        }
+        free(shard);
+        return ret;
+    }
+    struct iovec ret = {stats, sizeof(tfs_stats_t)};
+    if (request(s, TFS_OP_CODE_STATS, NULL, 0, &ret, 1) !=
+        sizeof(tfs_stats_t)) {
         return -1;
     }
+    return 0;
+}
 
-    int ret;
-    if (read(fcli, &ret, sizeof(int)) == -1) {
-        perror("Read error");
+int tfs_session_trace(tfs_session_t *s, int command, char const *path) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        /* shard i dumps its spans to path.i */
+        int ret = 0;
+        for (int i = 0; i < s->n_shards; i++) {
+            char shard_path[TFS_TRACE_PATH_SIZE];
+            if (path != NULL) {
+                snprintf(shard_path, sizeof(shard_path), "%s.%d", path, i);
+            }
+            if (tfs_session_trace(s->shards[i], command,
+                                  path != NULL ? shard_path : NULL) == -1) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+    char padded[TFS_TRACE_PATH_SIZE];
+    memset(padded, '\0', TFS_TRACE_PATH_SIZE);
+    if (path != NULL) {
+        strncpy(padded, path, TFS_TRACE_PATH_SIZE - 1);
+    }
+
+    struct iovec args[2] = {{&command, sizeof(int)},
+                            {padded, TFS_TRACE_PATH_SIZE}};
+    return request_int(s, TFS_OP_CODE_TRACE, args, 2);
+}
+
+int tfs_session_checkpoint(tfs_session_t *s, char const *path) {
+    if (s == NULL || path == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        /* shard i checkpoints to path.i */
+        int ret = 0;
+        for (int i = 0; i < s->n_shards; i++) {
+            char shard_path[TFS_CHECKPOINT_PATH_SIZE];
+            snprintf(shard_path, sizeof(shard_path), "%s.%d", path, i);
+            if (tfs_session_checkpoint(s->shards[i], shard_path) == -1) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+    char padded[TFS_CHECKPOINT_PATH_SIZE];
+    memset(padded, '\0', TFS_CHECKPOINT_PATH_SIZE);
+    strncpy(padded, path, TFS_CHECKPOINT_PATH_SIZE - 1);
+
+    /* the server writes it in the background, and is asked how it is going
+     * until it is done */
+    int command = TFS_CHECKPOINT_START;
+    struct iovec args[2] = {{&command, sizeof(int)},
+                            {padded, TFS_CHECKPOINT_PATH_SIZE}};
+    if (request_int(s, TFS_OP_CODE_CHECKPOINT, args, 2) == -1) {
+        return -1;
+    }
+    struct timespec pause = {0, 10 * 1000 * 1000};
+    int status;
+    command = TFS_CHECKPOINT_STATUS;
+    while ((status = request_int(s, TFS_OP_CODE_CHECKPOINT, args, 2)) == 1) {
+        nanosleep(&pause, NULL);
+    }
+    return status;
+}
+
+int tfs_session_snapshot_create(tfs_session_t *s) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        /* every shard takes one, which must have the same id everywhere */
+        int ids[TFS_MAX_SHARDS];
+        bool same = true;
+        for (int i = 0; i < s->n_shards; i++) {
+            ids[i] = tfs_session_snapshot_create(s->shards[i]);
+            same = same && ids[i] != -1 && ids[i] == ids[0];
+        }
+        for (int i = 0; !same && i < s->n_shards; i++) {
+            tfs_session_snapshot_delete(s->shards[i], ids[i]);
+        }
+        return same ? ids[0] : -1;
+    }
+    int command = TFS_SNAPSHOT_CREATE, id = -1;
+    struct iovec args[2] = {{&command, sizeof(int)}, {&id, sizeof(int)}};
+    return request_int(s, TFS_OP_CODE_SNAPSHOT, args, 2);
+}
+
+int tfs_session_snapshot_delete(tfs_session_t *s, int id) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        int ret = 0;
+        for (int i = 0; i < s->n_shards; i++) {
+            if (tfs_session_snapshot_delete(s->shards[i], id) == -1) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+    int command = TFS_SNAPSHOT_DELETE;
+    struct iovec args[2] = {{&command, sizeof(int)}, {&id, sizeof(int)}};
+    return request_int(s, TFS_OP_CODE_SNAPSHOT, args, 2);
+}
+
+int tfs_session_clone(tfs_session_t *s, char const *source,
+                      char const *dest) {
+    if (s == NULL) {
         return -1;
     }
+    if (s->n_shards > 0) {
+        /* the blocks are only shared within a shard */
+        int shard = route_name(s, source);
+        if (route_name(s, dest) != shard) {
+            return -1;
+        }
+        return tfs_session_clone(s->shards[shard], source, dest);
+    }
+
+    /* what this session wrote before is cloned too */
+    for (int fh = 0; fh < WRITE_BUFFERS; fh++) {
+        if (flush_buffer(s, fh) == -1) {
+            return -1;
+        }
+    }
+    char padded[2][40];
+    memset(padded, '\0', sizeof(padded));
+    memcpy(padded[0], source, strnlen(source, sizeof(padded[0])));
+    memcpy(padded[1], dest, strnlen(dest, sizeof(padded[1])));
+
+    struct iovec args[2] = {{padded[0], sizeof(padded[0])},
+                            {padded[1], sizeof(padded[1])}};
+    if (!s->caching) {
+        return request_int(s, TFS_OP_CODE_CLONE, args, 2);
+    }
+    /* the server revoked the destination's lease before replying */
+    int ret = request_int(s, TFS_OP_CODE_CLONE, args, 2);
+    pthread_mutex_lock(&s->cache_lock);
+    cache_poll(s);
+    pthread_mutex_unlock(&s->cache_lock);
     return ret;
 }
+
+ssize_t tfs_session_lock_report(tfs_session_t *s, char *buffer,
+                                size_t size) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (s->n_shards > 0) {
+        /* the reports of all shards, one after the other */
+        size_t len = 0;
+        if (size > 0) {
+            buffer[0] = '\0';
+        }
+        for (int i = 0; i < s->n_shards; i++) {
+            char report[TFS_LOCK_REPORT_SIZE];
+            if (tfs_session_lock_report(s->shards[i], report,
+                                        sizeof(report)) == -1) {
+                return -1;
+            }
+            size_t used = len < size ? len : size;
+            int n = snprintf(buffer + used, size - used, "shard %d:\n%s", i,
+                             report);
+            len += (size_t)n;
+        }
+        return (ssize_t)len;
+    }
+    ssize_t len = -1;
+    char report[TFS_LOCK_REPORT_SIZE];
+    struct iovec ret[2] = {{&len, sizeof(ssize_t)},
+                           {report, sizeof(report)}};
+    ssize_t got = request(s, TFS_OP_CODE_LOCK_PROFILE, NULL, 0, ret, 2);
+    if (len < 0 || got != (ssize_t)sizeof(ssize_t) + len) {
+        return -1;
+    }
+
+    if (size > 0) {
+        size_t n = (size_t)len < size ? (size_t)len : size - 1;
+        memcpy(buffer, report, n);
+        buffer[n] = '\0';
+    }
+    return len;
+}
+
+void tfs_session_cache_stats(tfs_session_t *s, tfs_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(tfs_cache_stats_t));
+    for (int i = 0; s != NULL && i < s->n_shards; i++) {
+        tfs_cache_stats_t shard;
+        tfs_session_cache_stats(s->shards[i], &shard);
+        stats->open_hits += shard.open_hits;
+        stats->open_misses += shard.open_misses;
+        stats->read_hits += shard.read_hits;
+        stats->read_misses += shard.read_misses;
+        stats->revocations += shard.revocations;
+    }
+    if (s != NULL && s->n_shards == 0) {
+        pthread_mutex_lock(&s->cache_lock);
+        *stats = s->cache_stats;
+        pthread_mutex_unlock(&s->cache_lock);
+    }
+}
+
+int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
+    default_session = tfs_session_mount(client_pipe_path, server_pipe_path);
+    return default_session != NULL ? 0 : -1;
+}
+
+int tfs_unmount() {
+    int ret = tfs_session_unmount(default_session);
+    default_session = NULL;
+    return ret;
+}
+
+int tfs_open(char const *name, int flags) {
+    return tfs_session_open(default_session, name, flags);
+}
+
+int tfs_close(int fhandle) {
+    return tfs_session_close(default_session, fhandle);
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
+    return tfs_session_write(default_session, fhandle, buffer, len);
+}
+
+int tfs_flush(int fhandle) {
+    return tfs_session_flush(default_session, fhandle);
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    return tfs_session_read(default_session, fhandle, buffer, len);
+}
+
+int tfs_shutdown_after_all_closed() {
+    return tfs_session_shutdown_after_all_closed(default_session);
+}
+
+int tfs_stats(tfs_stats_t *stats) {
+    return tfs_session_stats(default_session, stats);
+}
+
+int tfs_trace(int command, char const *path) {
+    return tfs_session_trace(default_session, command, path);
+}
+
+int tfs_checkpoint(char const *path) {
+    return tfs_session_checkpoint(default_session, path);
+}
+
+int tfs_snapshot_create() {
+    return tfs_session_snapshot_create(default_session);
+}
+
+int tfs_snapshot_delete(int id) {
+    return tfs_session_snapshot_delete(default_session, id);
+}
+
+int tfs_clone(char const *source, char const *dest) {
+    return tfs_session_clone(default_session, source, dest);
+}
+
+ssize_t tfs_lock_report(char *buffer, size_t size) {
+    return tfs_session_lock_report(default_session, buffer, size);
+}
+
+void tfs_cache_stats(tfs_cache_stats_t *stats) {
+    tfs_session_cache_stats(default_session, stats);
+}
@@ -2,6 +2,8 @@
 #define CLIENT_API_H
 
 #include "common/common.h"
+#include "common/stats.h"
+#include <stdint.h>
 #include <sys/types.h>
 
 /*
@@ -11,11 +13,19 @@
  *   the client to receive responses. This named pipe will be created (via
  * 	 mkfifo) inside tfs_mount.
  * - server_pipe_path: pathname of the named pipe where the server is listening
- *   for client requests
+ *   for client requests. If it is a Unix socket instead, the session uses a
+ *   single connection to it and client_pipe_path is not used. If it is a
+ *   shard map (see tools/tfs_shards), a session is mounted on every shard,
+ *   with client_pipe_path.i as the reply pipe of shard i, and each call
+ *   goes to the shard that owns its path or handle.
  * When successful, the new session's identifier (session_id) was
  * saved internally by the client; also, the client process has
  * successfully opened both named pipes (one for reading, the other one for
  * writing, respectively).
+ * With TFS_CACHE=1 in the environment, the session caches file contents
+ * under leases from the server (see tfs_cache_stats).
+ * With TFS_WRITE_BUFFER=<bytes>, writes are buffered in the client (see
+ * tfs_flush).
  *
  * Returns 0 if successful, -1 otherwise.
  */
@@ -60,6 +70,21 @@ int tfs_close(int fhandle);
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
+/*
+ * Sends the buffered writes of an open file to the server.
+ * When the session buffers writes (TFS_WRITE_BUFFER), each handle gathers
+ * consecutive writes in a buffer of that many bytes, and tfs_write reports
+ * them as done. They are sent when the buffer fills up, before a read from
+ * the same handle, on tfs_close and on tfs_flush; if the server cannot write
+ * them all (an error, or the file size limit), the call that sent them
+ * returns -1 and the rest of the buffer is discarded. Other handles, in this
+ * or other clients, only see the writes once they are sent.
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_flush(int fhandle);
+
 /* Reads from an open file, starting at the current offset
  * * Input:
  * 	- file handle (obtained from a previous call to tfs_open)
@@ -78,4 +103,122 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_shutdown_after_all_closed();
 
+/*
+ * Fetches the server's statistics: per-operation counters and latency
+ * histograms, state lock waits and simulated storage accesses, all counted
+ * since the server started.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stats(tfs_stats_t *stats);
+
+/*
+ * Controls the server's request tracing.
+ * Input:
+ *  - command: TFS_TRACE_ON, TFS_TRACE_OFF or TFS_TRACE_DUMP
+ *  - path: for TFS_TRACE_DUMP, the file (on the server's host) where the
+ *    traced spans are written in Chrome's trace event JSON format
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace(int command, char const *path);
+
+/*
+ * Has the server write a checkpoint of its files to a file on its host, and
+ * waits until it is written; the server goes on serving requests meanwhile.
+ * A server started with -k path restores them.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_checkpoint(char const *path);
+
+/*
+ * Has the server take a snapshot: a read-only view of the files as they are
+ * now, which are opened as TFS_SNAPSHOT_PREFIX "<id>/<name>" (but not by a
+ * session that caches files, since they take no lease), while the files
+ * themselves go on changing.
+ * Returns the snapshot's id, -1 if it could not be taken.
+ */
+int tfs_snapshot_create();
+
+/*
+ * Deletes a snapshot; the server frees its storage in the background.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_delete(int id);
+
+/*
+ * Has the server make dest a copy of source (creating it if needed) in one
+ * request, whatever its size: the two files share their storage until
+ * either one is written. The source may be a file of a snapshot. A sharded
+ * session only clones within a shard.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source, char const *dest);
+
+/*
+ * Fetches the server's lock contention report: per lock site acquisitions,
+ * contended acquisitions, wait and hold times, ranked by total wait time.
+ * Input:
+ *  - buffer: where the (null-terminated) report is written
+ *  - size: size of buffer, TFS_LOCK_REPORT_SIZE fits any report
+ * Returns the length of the report, or -1 if the server was not built with
+ * TFS_LOCK_PROFILE or the request failed.
+ */
+ssize_t tfs_lock_report(char *buffer, size_t size);
+
+/*
+ * Counters of the client cache. A caching session keeps the contents of the
+ * files it opens while the server leases them to it: opens and reads of a
+ * leased file are answered without a request, writes go through to the
+ * server, and a lease is revoked when another session changes the file.
+ */
+typedef struct {
+    uint64_t open_hits;   /* opens answered from the cache */
+    uint64_t open_misses; /* ... that needed the server */
+    uint64_t read_hits;   /* reads answered from the cache */
+    uint64_t read_misses; /* ... after the lease had been revoked */
+    uint64_t revocations; /* leases revoked by the server */
+} tfs_cache_stats_t;
+
+/*
+ * Fetches the counters of the client cache, all zero if the session does
+ * not cache
+ */
+void tfs_cache_stats(tfs_cache_stats_t *stats);
+
+/*
+ * Sessions. Every call above works on the session of tfs_mount, one per
+ * process; tfs_session_mount opens a session of its own, and the calls below
+ * do the same as those above on the session they are given. A session may be
+ * used by any number of threads at once: each request carries a tag that the
+ * server's reply echoes, and whichever thread is waiting reads the replies
+ * and hands each one over to the thread that sent the request, so a slow
+ * request does not hold up the others. Handles belong to the session that
+ * opened them.
+ */
+typedef struct tfs_session tfs_session_t;
+
+/* Returns the new session, or NULL if it could not be established */
+tfs_session_t *tfs_session_mount(char const *client_pipe_path,
+                                 char const *server_pipe_path);
+/* Ends a session and frees it, once no other thread is using it */
+int tfs_session_unmount(tfs_session_t *session);
+int tfs_session_open(tfs_session_t *session, char const *name, int flags);
+int tfs_session_close(tfs_session_t *session, int fhandle);
+ssize_t tfs_session_write(tfs_session_t *session, int fhandle,
+                          void const *buffer, size_t len);
+int tfs_session_flush(tfs_session_t *session, int fhandle);
+ssize_t tfs_session_read(tfs_session_t *session, int fhandle, void *buffer,
+                         size_t len);
+int tfs_session_shutdown_after_all_closed(tfs_session_t *session);
+int tfs_session_stats(tfs_session_t *session, tfs_stats_t *stats);
+int tfs_session_trace(tfs_session_t *session, int command, char const *path);
+int tfs_session_checkpoint(tfs_session_t *session, char const *path);
+int tfs_session_snapshot_create(tfs_session_t *session);
+int tfs_session_snapshot_delete(tfs_session_t *session, int id);
+int tfs_session_clone(tfs_session_t *session, char const *source,
+                      char const *dest);
+ssize_t tfs_session_lock_report(tfs_session_t *session, char *buffer,
+                                size_t size);
+void tfs_session_cache_stats(tfs_session_t *session,
+                             tfs_cache_stats_t *stats);
+
 #endif /* CLIENT_API_H */
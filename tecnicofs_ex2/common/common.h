@@ -8,6 +8,23 @@ enum {
     TFS_O_APPEND = 0b100,
 };
 
+/*
+ * Client-server protocol: every request starts with its op code and, but for
+ * TFS_OP_CODE_MOUNT, the session id (an int) and a tag (tfs_tag_t) chosen by
+ * the client, followed by the op's own fields. Every reply is a
+ * tfs_reply_header_t, which echoes the request's tag (0 for a mount), and
+ * then len bytes of the op's reply. Tags let the threads of a client share
+ * one session: the replies need not come back in order.
+ */
+#include <stdint.h>
+
+typedef uint32_t tfs_tag_t;
+
+typedef struct {
+    tfs_tag_t tag;
+    uint32_t len;
+} tfs_reply_header_t;
+
 /* operation codes (for client-server requests) */
 enum {
     TFS_OP_CODE_MOUNT = 1,
@@ -16,7 +33,77 @@ enum {
     TFS_OP_CODE_CLOSE = 4,
     TFS_OP_CODE_WRITE = 5,
     TFS_OP_CODE_READ = 6,
-    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7
+    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7,
+    TFS_OP_CODE_SHM_ATTACH = 8,
+    TFS_OP_CODE_SHM_WRITE = 9,
+    TFS_OP_CODE_SHM_READ = 10,
+    TFS_OP_CODE_STATS = 11,
+    TFS_OP_CODE_TRACE = 12,
+    TFS_OP_CODE_LOCK_PROFILE = 13,
+    TFS_OP_CODE_CALLBACK = 14,
+    TFS_OP_CODE_LEASE = 15,
+    TFS_OP_CODE_PWRITE = 16,
+    TFS_OP_CODE_CHECKPOINT = 17,
+    TFS_OP_CODE_SNAPSHOT = 18,
+    TFS_OP_CODE_CLONE = 19 /* source and destination path names */
+};
+
+/* TFS_OP_CODE_TRACE commands */
+enum {
+    TFS_TRACE_OFF = 0,
+    TFS_TRACE_ON = 1,
+    TFS_TRACE_DUMP = 2, /* to a file on the server's host */
+};
+#define TFS_TRACE_PATH_SIZE (100)
+
+/* TFS_OP_CODE_CHECKPOINT commands: a checkpoint is written in the
+ * background, and its status is asked for until it is no longer running */
+enum {
+    TFS_CHECKPOINT_START = 0, /* to a file on the server's host */
+    TFS_CHECKPOINT_STATUS = 1,
 };
+#define TFS_CHECKPOINT_PATH_SIZE (100)
+
+/* TFS_OP_CODE_SNAPSHOT commands: a snapshot is a read-only view of the
+ * files as they were when it was created, which are opened (read-only) as
+ * TFS_SNAPSHOT_PREFIX "<id>/<name>" */
+enum {
+    TFS_SNAPSHOT_CREATE = 0, /* replies with the snapshot's id */
+    TFS_SNAPSHOT_DELETE = 1,
+};
+#define TFS_SNAPSHOT_PREFIX "/.snap/"
+
+/* largest lock contention report (TFS_OP_CODE_LOCK_PROFILE) */
+#define TFS_LOCK_REPORT_SIZE (2048)
+
+/* number of op code slots (op codes are smaller than this) */
+#define TFS_OP_CODE_COUNT (32)
+
+/* every request (header and payload) must fit in PIPE_BUF (4096 bytes on
+ * Linux), so that requests of concurrent clients written to the server pipe
+ * are never interleaved; larger reads and writes are shortened by the client,
+ * like they would be by the file size limit */
+#define TFS_MAX_REQUEST (4096)
+#define TFS_MAX_PAYLOAD (TFS_MAX_REQUEST - 32)
+
+/* shared-memory transport: payloads of up to TFS_SHM_ARENA_SIZE bytes are
+ * exchanged through a region created by the client (named TFS_SHM_PREFIX
+ * followed by its pid); the pipes only carry the fixed-size headers */
+#define TFS_SHM_PREFIX "/tfs_shm_"
+#define TFS_SHM_NAME_SIZE (40)
+#define TFS_SHM_ARENA_SIZE (1 << 20)
+
+/* client cache: a session registers a named pipe (TFS_OP_CODE_CALLBACK) on
+ * which the server sends the i-number (an int) of every lease it revokes;
+ * a lease (TFS_OP_CODE_LEASE) comes with the whole file, of up to
+ * TFS_LEASE_DATA_MAX bytes */
+#define TFS_CALLBACK_PREFIX "/tmp/tfs_cb_"
+#define TFS_CALLBACK_PATH_SIZE (40)
+#define TFS_LEASE_DATA_MAX (4096)
+
+/* sharded deployment (see tools/tfs_shards): the path a client mounts is a
+ * shard map, a text file with the pipe of every shard on a line of its own;
+ * each path belongs to the shard given by a hash of it */
+#define TFS_MAX_SHARDS (16)
 
 #endif /* COMMON_H */
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "stats.h"
+
+int tfs_hist_bucket(uint64_t value) {
+    if (value < TFS_HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int bits = 63 - __builtin_clzll(value);
+    if (bits > TFS_HIST_MAX_BITS) {
+        return TFS_HIST_BUCKETS - 1;
+    }
+    /* the bits right after the leading one select the linear sub-bucket */
+    int sub = (int)(value >> (bits - TFS_HIST_SUB_BITS)) &
+              (TFS_HIST_SUB_BUCKETS - 1);
+    return (bits - TFS_HIST_SUB_BITS + 1) * TFS_HIST_SUB_BUCKETS + sub;
+}
+
+uint64_t tfs_hist_value(int bucket) {
+    if (bucket < TFS_HIST_SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+
+    int bits = bucket / TFS_HIST_SUB_BUCKETS + TFS_HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(bucket % TFS_HIST_SUB_BUCKETS);
+    return (TFS_HIST_SUB_BUCKETS + sub) << (bits - TFS_HIST_SUB_BITS);
+}
+
+uint64_t tfs_hist_percentile(uint64_t const *hist, double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+        total += hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    /* rank of the sample we are looking for (1-based) */
+    uint64_t rank = (uint64_t)(p * (double)total);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= rank) {
+            return tfs_hist_value(i);
+        }
+    }
+    return tfs_hist_value(TFS_HIST_BUCKETS - 1);
+}
+
+void tfs_stats_diff(tfs_stats_t *after, tfs_stats_t const *before) {
+    for (int op = 0; op < TFS_OP_CODE_COUNT; op++) {
+        tfs_op_stats_t *a = &after->ops[op];
+        tfs_op_stats_t const *b = &before->ops[op];
+        a->count -= b->count;
+        a->bytes_in -= b->bytes_in;
+        a->bytes_out -= b->bytes_out;
+        for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+            a->latency[i] -= b->latency[i];
+        }
+    }
+    after->lock_acquisitions -= before->lock_acquisitions;
+    after->lock_contended -= before->lock_contended;
+    after->lock_wait_ns -= before->lock_wait_ns;
+    after->storage_accesses -= before->storage_accesses;
+    after->lease_grants -= before->lease_grants;
+    after->lease_revocations -= before->lease_revocations;
+}
+
+char const *tfs_op_code_name(int opcode) {
+    switch (opcode) {
+    case TFS_OP_CODE_MOUNT:
+        return "mount";
+    case TFS_OP_CODE_UNMOUNT:
+        return "unmount";
+    case TFS_OP_CODE_OPEN:
+        return "open";
+    case TFS_OP_CODE_CLOSE:
+        return "close";
+    case TFS_OP_CODE_WRITE:
+        return "write";
+    case TFS_OP_CODE_READ:
+        return "read";
+    case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+        return "shutdown";
+    case TFS_OP_CODE_SHM_ATTACH:
+        return "shm_attach";
+    case TFS_OP_CODE_SHM_WRITE:
+        return "shm_write";
+    case TFS_OP_CODE_SHM_READ:
+        return "shm_read";
+    case TFS_OP_CODE_STATS:
+        return "stats";
+    case TFS_OP_CODE_TRACE:
+        return "trace";
+    case TFS_OP_CODE_LOCK_PROFILE:
+        return "lock_profile";
+    case TFS_OP_CODE_CALLBACK:
+        return "callback";
+    case TFS_OP_CODE_LEASE:
+        return "lease";
+    case TFS_OP_CODE_PWRITE:
+        return "pwrite";
+    case TFS_OP_CODE_CHECKPOINT:
+        return "checkpoint";
+    case TFS_OP_CODE_SNAPSHOT:
+        return "snapshot";
+    case TFS_OP_CODE_CLONE:
+        return "clone";
+    default:
+        return "unknown";
+    }
+}
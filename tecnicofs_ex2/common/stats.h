@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common/common.h"
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram (in nanoseconds): values below
+ * TFS_HIST_SUB_BUCKETS have a bucket each; above that, every power of two is
+ * split into TFS_HIST_SUB_BUCKETS linear buckets (12.5% precision).
+ */
+#define TFS_HIST_SUB_BITS (3)
+#define TFS_HIST_SUB_BUCKETS (1 << TFS_HIST_SUB_BITS)
+#define TFS_HIST_MAX_BITS (36) /* about 68 s; longer values are clamped */
+#define TFS_HIST_BUCKETS                                                      \
+    ((TFS_HIST_MAX_BITS - TFS_HIST_SUB_BITS + 1) * TFS_HIST_SUB_BUCKETS)
+
+/*
+ * Counters of one operation
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t bytes_in;  /* request bytes received */
+    uint64_t bytes_out; /* reply bytes sent */
+    uint64_t latency[TFS_HIST_BUCKETS];
+} tfs_op_stats_t;
+
+/*
+ * Server statistics, as returned by TFS_OP_CODE_STATS
+ */
+typedef struct {
+    tfs_op_stats_t ops[TFS_OP_CODE_COUNT]; /* indexed by op code */
+    uint64_t lock_acquisitions;            /* of the state lock */
+    uint64_t lock_contended;               /* ... that had to wait */
+    uint64_t lock_wait_ns;                 /* total time spent waiting */
+    uint64_t storage_accesses;             /* simulated (insert_delay) */
+    uint64_t sessions;                     /* currently mounted */
+    uint64_t lease_grants;                 /* client cache leases */
+    uint64_t lease_revocations;            /* ... revoked by a write */
+} tfs_stats_t;
+
+/* Returns the histogram bucket of a value */
+int tfs_hist_bucket(uint64_t value);
+
+/* Returns the smallest value that falls in a bucket */
+uint64_t tfs_hist_value(int bucket);
+
+/*
+ * Returns the value below which a fraction p (e.g. 0.99) of the samples
+ * of a histogram fall, 0 if it is empty
+ */
+uint64_t tfs_hist_percentile(uint64_t const *hist, double p);
+
+/* Subtracts the counters of before from after (for rates over time) */
+void tfs_stats_diff(tfs_stats_t *after, tfs_stats_t const *before);
+
+/* Returns a printable name of an op code */
+char const *tfs_op_code_name(int opcode);
+
+#endif /* STATS_H */
@@ -0,0 +1,98 @@
+#include "capture.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAPTURE_BUFFER_SIZE (1 << 16)
+
+int capture_fd = -1;
+
+static uint64_t epoch;
+static char buffer[CAPTURE_BUFFER_SIZE];
+static size_t buffered;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int capture_start(char const *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (fd == -1) {
+        perror("Open error");
+        return -1;
+    }
+    if (write(fd, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) == -1) {
+        perror("Write error");
+        close(fd);
+        return -1;
+    }
+    epoch = now_ns();
+    capture_fd = fd;
+    return 0;
+}
+
+void capture_flush() {
+    size_t done = 0;
+    while (capture_fd != -1 && done < buffered) {
+        ssize_t wt = write(capture_fd, buffer + done, buffered - done);
+        if (wt == -1) {
+            /* the capture is given up rather than the server */
+            perror("Capture write error");
+            close(capture_fd);
+            capture_fd = -1;
+            break;
+        }
+        done += (size_t)wt;
+    }
+    buffered = 0;
+}
+
+void capture_request(capture_record_t *rec, char const *name) {
+    if (capture_fd == -1) {
+        return;
+    }
+    if (buffered + sizeof(*rec) + rec->name_len > sizeof(buffer)) {
+        capture_flush();
+    }
+
+    rec->time_ns = rec->time_ns > epoch ? rec->time_ns - epoch : 0;
+    memcpy(buffer + buffered, rec, sizeof(*rec));
+    buffered += sizeof(*rec);
+    if (rec->name_len > 0) {
+        memcpy(buffer + buffered, name, rec->name_len);
+        buffered += rec->name_len;
+    }
+}
+
+FILE *capture_open(char const *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Open error");
+        return NULL;
+    }
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a TecnicoFS capture\n", path);
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int capture_next(FILE *file, capture_record_t *rec, char *name,
+                 size_t name_size) {
+    if (fread(rec, sizeof(*rec), 1, file) != 1) {
+        return feof(file) ? 0 : -1;
+    }
+    if (rec->name_len >= name_size ||
+        fread(name, 1, rec->name_len, file) != rec->name_len) {
+        return -1;
+    }
+    name[rec->name_len] = '\0';
+    return 1;
+}
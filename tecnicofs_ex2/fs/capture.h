@@ -0,0 +1,63 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Workload capture: a compact binary log of every request the server
+ * handles, to be replayed later (tools/tfs_replay).
+ * The file starts with CAPTURE_MAGIC and is followed by one record per
+ * request; an open request's record is followed by the file name.
+ */
+
+#define CAPTURE_MAGIC "TFSCAP1"
+
+typedef struct {
+    uint64_t time_ns;    /* when the request was received, since the start */
+    uint64_t offset;     /* of the file handle, before the request */
+    uint32_t len;        /* bytes requested by a read or write */
+    uint32_t latency_ns; /* of the request, in the server */
+    int32_t session;
+    int32_t handle; /* of a close, read or write */
+    int32_t result; /* returned to the client (the new handle of an open) */
+    uint8_t opcode;
+    uint8_t flags;     /* of an open */
+    uint16_t name_len; /* bytes of file name that follow the record */
+} capture_record_t;
+
+/*
+ * Starts capturing to a file (created or truncated).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int capture_start(char const *path);
+
+/* Whether a capture was started */
+extern int capture_fd;
+static inline int capture_enabled() { return capture_fd != -1; }
+
+/*
+ * Logs a request. time_ns is given as a CLOCK_MONOTONIC time and stored
+ * relative to the start of the capture; name is only used if name_len > 0.
+ * Records are buffered until capture_flush or the buffer fills up.
+ */
+void capture_request(capture_record_t *rec, char const *name);
+
+/* Writes the buffered records to the file */
+void capture_flush();
+
+/*
+ * Opens a capture for reading.
+ * Returns the file, NULL (with an error message) if it is not a capture.
+ */
+FILE *capture_open(char const *path);
+
+/*
+ * Reads the next record and its file name (of at least name_size bytes,
+ * null-terminated).
+ * Returns 1 if a record was read, 0 at the end, -1 if the file is corrupt.
+ */
+int capture_next(FILE *file, capture_record_t *rec, char *name,
+                 size_t name_size);
+
+#endif // CAPTURE_H
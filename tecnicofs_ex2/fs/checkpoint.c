@@ -0,0 +1,307 @@
+#include "checkpoint.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* blocks written at once */
+#define CHECKPOINT_BATCH (64)
+/* blocks read at once (at most IOV_MAX) */
+#define RESTORE_BATCH (1024)
+
+/* the checkpoint being written, or the last one; checkpoint_lock guards
+ * all of it but done, the only field the writer sets */
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static bool started; /* and not joined yet */
+static bool done;    /* set by the writer when it ends */
+static int result = -1;
+static int out_fd = -1;
+static char out_path[PATH_MAX];
+static char tmp_path[PATH_MAX + 4];
+
+/* the snapshot it is taken from */
+static bool taken[INODE_TABLE_SIZE];
+static inode_t inodes[INODE_TABLE_SIZE];
+static int blocks[DATA_BLOCKS];
+static int n_blocks;
+
+static int write_all(int fd, void const *buf, size_t len) {
+    char const *p = buf;
+    while (len > 0) {
+        ssize_t wt = write(fd, p, len);
+        if (wt == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Write error");
+            return -1;
+        }
+        p += wt;
+        len -= (size_t)wt;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t rd = read(fd, p, len);
+        if (rd == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rd <= 0) {
+            return -1;
+        }
+        p += rd;
+        len -= (size_t)rd;
+    }
+    return 0;
+}
+
+/* Writes the header, the i-nodes in use and the block numbers */
+static int write_tables() {
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.block_size = BLOCK_SIZE;
+    header.data_blocks = DATA_BLOCKS;
+    header.inode_table_size = INODE_TABLE_SIZE;
+    header.fragment_size = FRAGMENT_SIZE;
+    header.inode_size = sizeof(inode_t);
+    header.n_blocks = (uint32_t)n_blocks;
+
+    static checkpoint_inode_t records[INODE_TABLE_SIZE];
+    static int32_t numbers[DATA_BLOCKS];
+    memset(records, 0, sizeof(records));
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (taken[i]) {
+            records[header.n_inodes].inumber = i;
+            records[header.n_inodes++].inode = inodes[i];
+        }
+    }
+    for (int b = 0; b < n_blocks; b++) {
+        numbers[b] = blocks[b];
+    }
+
+    struct iovec iov[3] = {
+        {&header, sizeof(header)},
+        {records, header.n_inodes * sizeof(checkpoint_inode_t)},
+        {numbers, (size_t)n_blocks * sizeof(int32_t)}};
+    size_t len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    if (writev(out_fd, iov, 3) != (ssize_t)len) {
+        perror("Write error");
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes the checkpoint: the tables, and then the blocks in batches */
+static void *write_checkpoint(void *arg) {
+    (void)arg;
+    int r = write_tables();
+
+    char *batch = malloc((size_t)CHECKPOINT_BATCH * BLOCK_SIZE);
+    if (batch == NULL) {
+        r = -1;
+    }
+    for (int i = 0; r == 0 && i < n_blocks; i += CHECKPOINT_BATCH) {
+        int n = n_blocks - i < CHECKPOINT_BATCH ? n_blocks - i
+                                                : CHECKPOINT_BATCH;
+        for (int j = 0; j < n; j++) {
+            state_snapshot_block(blocks[i + j],
+                                 batch + (size_t)j * BLOCK_SIZE);
+        }
+        r = write_all(out_fd, batch, (size_t)n * BLOCK_SIZE);
+    }
+    free(batch);
+
+    if (state_snapshot_end() == -1) {
+        fprintf(stderr, "Checkpoint error: out of memory for the blocks "
+                        "changed meanwhile\n");
+        r = -1;
+    }
+    if (r == 0 && fsync(out_fd) == -1) {
+        perror("Fsync error");
+        r = -1;
+    }
+    close(out_fd);
+    if (r == 0 && rename(tmp_path, out_path) == -1) {
+        perror("Rename error");
+        r = -1;
+    }
+    if (r == -1) {
+        unlink(tmp_path);
+    }
+
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    /* its result is taken by whoever joins it */
+    return (void *)(intptr_t)r;
+}
+
+/* Joins the writer, if it was not joined yet (checkpoint_lock held) */
+static int join_writer() {
+    if (started) {
+        void *r;
+        pthread_join(writer, &r);
+        result = (int)(intptr_t)r;
+        started = false;
+    }
+    return result;
+}
+
+/* Starts the writer (checkpoint_lock held) */
+static int start_writer(char const *path) {
+    if (started && !__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    join_writer();
+    if (strlen(path) >= sizeof(out_path)) {
+        return -1;
+    }
+    strcpy(out_path, path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (out_fd == -1) {
+        perror("Open error");
+        return -1;
+    }
+    n_blocks = state_snapshot_begin(taken, inodes, blocks);
+    if (n_blocks == -1) {
+        close(out_fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    done = false;
+    if (pthread_create(&writer, NULL, write_checkpoint, NULL) != 0) {
+        perror("Thread error");
+        state_snapshot_end();
+        close(out_fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    started = true;
+    return 0;
+}
+
+int checkpoint_start(char const *path) {
+    pthread_mutex_lock(&checkpoint_lock);
+    int ret = start_writer(path);
+    pthread_mutex_unlock(&checkpoint_lock);
+    return ret;
+}
+
+int checkpoint_status() {
+    pthread_mutex_lock(&checkpoint_lock);
+    int ret = started && !__atomic_load_n(&done, __ATOMIC_ACQUIRE)
+                  ? 1
+                  : join_writer();
+    pthread_mutex_unlock(&checkpoint_lock);
+    return ret;
+}
+
+int checkpoint_wait() {
+    pthread_mutex_lock(&checkpoint_lock);
+    int ret = join_writer();
+    pthread_mutex_unlock(&checkpoint_lock);
+    return ret;
+}
+
+/* Reads the contents of the blocks of a checkpoint straight into place */
+static int read_blocks(int fd, int const *numbers, int n) {
+    static struct iovec iov[RESTORE_BATCH];
+    for (int i = 0; i < n; i += RESTORE_BATCH) {
+        int k = n - i < RESTORE_BATCH ? n - i : RESTORE_BATCH;
+        for (int j = 0; j < k; j++) {
+            iov[j].iov_base = data_block_get(numbers[i + j]);
+            iov[j].iov_len = BLOCK_SIZE;
+        }
+        /* a short read goes on from where it stopped */
+        struct iovec *next = iov;
+        while (k > 0) {
+            ssize_t rd = readv(fd, next, k);
+            if (rd == -1 && errno == EINTR) {
+                continue;
+            }
+            if (rd <= 0) {
+                return -1;
+            }
+            while (k > 0 && (size_t)rd >= next->iov_len) {
+                rd -= (ssize_t)next->iov_len;
+                next++;
+                k--;
+            }
+            if (k > 0) {
+                next->iov_base = (char *)next->iov_base + rd;
+                next->iov_len -= (size_t)rd;
+            }
+        }
+    }
+    return 0;
+}
+
+int checkpoint_restore(char const *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Open error");
+        return -1;
+    }
+
+    checkpoint_header_t header;
+    static checkpoint_inode_t records[INODE_TABLE_SIZE];
+    static int32_t numbers[DATA_BLOCKS];
+    static int restored[DATA_BLOCKS];
+    if (read_all(fd, &header, sizeof(header)) == -1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) !=
+            0 ||
+        header.block_size != BLOCK_SIZE ||
+        header.data_blocks != DATA_BLOCKS ||
+        header.inode_table_size != INODE_TABLE_SIZE ||
+        header.fragment_size != FRAGMENT_SIZE ||
+        header.inode_size != sizeof(inode_t) ||
+        header.n_inodes > INODE_TABLE_SIZE ||
+        header.n_blocks > DATA_BLOCKS ||
+        read_all(fd, records, header.n_inodes * sizeof(checkpoint_inode_t)) ==
+            -1 ||
+        read_all(fd, numbers, header.n_blocks * sizeof(int32_t)) == -1) {
+        fprintf(stderr, "%s is not a checkpoint of this TecnicoFS\n", path);
+        close(fd);
+        return -1;
+    }
+
+    int files = 0;
+    memset(taken, 0, sizeof(taken));
+    for (uint32_t i = 0; i < header.n_inodes; i++) {
+        int inumber = records[i].inumber;
+        if (inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+            fprintf(stderr, "%s is corrupt\n", path);
+            close(fd);
+            return -1;
+        }
+        taken[inumber] = true;
+        inodes[inumber] = records[i].inode;
+        files += records[i].inode.i_node_type == T_FILE;
+    }
+    for (uint32_t b = 0; b < header.n_blocks; b++) {
+        restored[b] = numbers[b];
+    }
+
+    if (!taken[ROOT_DIR_INUM] ||
+        state_restore(taken, inodes, restored, (int)header.n_blocks) == -1 ||
+        read_blocks(fd, restored, (int)header.n_blocks) == -1) {
+        fprintf(stderr, "%s is corrupt\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return files;
+}
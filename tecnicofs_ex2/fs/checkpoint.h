@@ -0,0 +1,61 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "state.h"
+#include <stdint.h>
+
+/*
+ * Checkpoints of the persistent state, to restart a server without losing
+ * its files. The file starts with a checkpoint_header_t, followed by a
+ * checkpoint_inode_t for every i-node in use, the numbers (int32_t) of the
+ * blocks in use, in increasing order, and then their contents, in the same
+ * order; free blocks take no room.
+ * A checkpoint is taken from a snapshot (see state_snapshot_begin) and
+ * written by a thread of its own, while the FS goes on changing. It is
+ * written to path.tmp and renamed to path once complete, so path always
+ * holds a whole checkpoint.
+ */
+
+#define CHECKPOINT_MAGIC "TFSCKP1"
+
+typedef struct {
+    char magic[8];
+    /* the geometry of the server that wrote it, which must be the same */
+    uint32_t block_size;
+    uint32_t data_blocks;
+    uint32_t inode_table_size;
+    uint32_t fragment_size;
+    uint32_t inode_size;
+    uint32_t n_inodes;
+    uint32_t n_blocks;
+} checkpoint_header_t;
+
+typedef struct {
+    int32_t inumber;
+    inode_t inode;
+} checkpoint_inode_t;
+
+/*
+ * Starts a checkpoint to a file (with the FS lock held).
+ * Returns 0 if successful, -1 otherwise (e.g. if one is under way).
+ */
+int checkpoint_start(char const *path);
+
+/*
+ * Returns 1 while the last checkpoint started is being written, and then 0
+ * if it succeeded, -1 if it failed (or none was started)
+ */
+int checkpoint_status();
+
+/* Waits for the last checkpoint started to be written, and returns
+ * checkpoint_status() */
+int checkpoint_wait();
+
+/*
+ * Replaces the state with the one in a checkpoint (with the FS lock held).
+ * Returns the number of files restored, -1 if the file cannot be read or
+ * is not a checkpoint of this FS (the state may then be partly replaced).
+ */
+int checkpoint_restore(char const *path);
+
+#endif // CHECKPOINT_H
@@ -4,11 +4,33 @@
 /* FS root inode number */
 #define ROOT_DIR_INUM (0)
 
+/* the sizes below can be overridden at build time, e.g.
+ * make EXTRA_CFLAGS=-DBLOCK_SIZE=65536 */
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE (1024)
+#endif
+#ifndef DATA_BLOCKS
 #define DATA_BLOCKS (1024)
+#endif
+#ifndef INODE_TABLE_SIZE
 #define INODE_TABLE_SIZE (50)
+#endif
+/* files up to this size are stored in their i-node */
+#ifndef INLINE_DATA_SIZE
+#define INLINE_DATA_SIZE (64)
+#endif
+/* small files share blocks in fragments of this size (at most 32 per
+ * block) */
+#ifndef FRAGMENT_SIZE
+#define FRAGMENT_SIZE (BLOCK_SIZE / 8)
+#endif
 #define MAX_OPEN_FILES (20)
+/* a replica has as many more handles, for those of its primary (see
+ * oplog.h), so that its clients cannot keep it from following the log */
+#define REPLAY_OPEN_FILES (MAX_OPEN_FILES)
 #define MAX_FILE_NAME (40)
+#define MAX_SESSIONS (16)
+#define MAX_SNAPSHOTS (16)
 
 #define DELAY (5000)
 
@@ -0,0 +1,65 @@
+#include "counters.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct counters_block {
+    tfs_stats_t stats;
+    struct counters_block *next;
+} counters_block_t;
+
+/* every block ever registered (blocks outlive their threads, so that their
+ * counts are not lost) */
+static counters_block_t *blocks;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local counters_block_t *local;
+
+/* used if a block cannot be allocated; its counts are never collected */
+static _Thread_local tfs_stats_t fallback;
+
+tfs_stats_t *counters_local() {
+    if (local != NULL) {
+        return &local->stats;
+    }
+
+    counters_block_t *block = calloc(1, sizeof(counters_block_t));
+    if (block == NULL) {
+        return &fallback;
+    }
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&blocks_lock);
+
+    local = block;
+    return &local->stats;
+}
+
+static inline void sum(uint64_t *total, uint64_t const *counter) {
+    *total += __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void counters_collect(tfs_stats_t *out) {
+    memset(out, 0, sizeof(tfs_stats_t));
+
+    pthread_mutex_lock(&blocks_lock);
+    for (counters_block_t *b = blocks; b != NULL; b = b->next) {
+        tfs_stats_t const *s = &b->stats;
+        for (int op = 0; op < TFS_OP_CODE_COUNT; op++) {
+            sum(&out->ops[op].count, &s->ops[op].count);
+            sum(&out->ops[op].bytes_in, &s->ops[op].bytes_in);
+            sum(&out->ops[op].bytes_out, &s->ops[op].bytes_out);
+            for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+                sum(&out->ops[op].latency[i], &s->ops[op].latency[i]);
+            }
+        }
+        sum(&out->lock_acquisitions, &s->lock_acquisitions);
+        sum(&out->lock_contended, &s->lock_contended);
+        sum(&out->lock_wait_ns, &s->lock_wait_ns);
+        sum(&out->storage_accesses, &s->storage_accesses);
+        sum(&out->lease_grants, &s->lease_grants);
+        sum(&out->lease_revocations, &s->lease_revocations);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include "common/stats.h"
+#include <stdint.h>
+
+/*
+ * Per-thread statistics counters.
+ * Each thread only ever updates its own block, so updates are plain
+ * (relaxed) stores to a private cache line; the blocks of all threads are
+ * only summed when statistics are collected.
+ */
+
+/* Returns the calling thread's counters (registered on first use) */
+tfs_stats_t *counters_local();
+
+/* Adds v to a counter of the calling thread */
+static inline void counter_add(uint64_t *counter, uint64_t v) {
+    __atomic_store_n(counter, *counter + v, __ATOMIC_RELAXED);
+}
+
+/* Sums the counters of every thread into out */
+void counters_collect(tfs_stats_t *out);
+
+#endif // COUNTERS_H
@@ -0,0 +1,191 @@
+#include "dir_simd.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DIR_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * A kernel compares the tags of a group of 32 entries with a given tag,
+ * returning a bit mask of the matches, and compares two keys.
+ */
+typedef struct {
+    uint32_t (*match)(uint8_t const *tags, uint8_t tag);
+    bool (*keys_equal)(char const *a, char const *b);
+} kernel_ops_t;
+
+static uint32_t match_scalar(uint8_t const *tags, uint8_t tag) {
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++) {
+        mask |= (uint32_t)(tags[i] == tag) << i;
+    }
+    return mask;
+}
+
+static bool keys_equal_scalar(char const *a, char const *b) {
+    return memcmp(a, b, MAX_FILE_NAME) == 0;
+}
+
+/* the part of a key after its first 32 bytes */
+static inline bool tail_equal(char const *a, char const *b) {
+    return memcmp(a + 32, b + 32, MAX_FILE_NAME - 32) == 0;
+}
+
+#ifdef DIR_SIMD_X86
+
+__attribute__((target("sse2"))) static uint32_t match_sse2(uint8_t const *tags,
+                                                           uint8_t tag) {
+    __m128i t = _mm_set1_epi8((char)tag);
+    __m128i lo = _mm_loadu_si128((__m128i const *)tags);
+    __m128i hi = _mm_loadu_si128((__m128i const *)(tags + 16));
+    uint32_t mlo = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, t));
+    uint32_t mhi = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, t));
+    return mlo | mhi << 16;
+}
+
+__attribute__((target("sse2"))) static bool keys_equal_sse2(char const *a,
+                                                            char const *b) {
+    __m128i x0 = _mm_loadu_si128((__m128i const *)a);
+    __m128i y0 = _mm_loadu_si128((__m128i const *)b);
+    __m128i x1 = _mm_loadu_si128((__m128i const *)(a + 16));
+    __m128i y1 = _mm_loadu_si128((__m128i const *)(b + 16));
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(x0, y0), _mm_cmpeq_epi8(x1, y1));
+    return _mm_movemask_epi8(eq) == 0xffff && tail_equal(a, b);
+}
+
+__attribute__((target("avx2"))) static uint32_t match_avx2(uint8_t const *tags,
+                                                           uint8_t tag) {
+    __m256i g = _mm256_loadu_si256((__m256i const *)tags);
+    __m256i eq = _mm256_cmpeq_epi8(g, _mm256_set1_epi8((char)tag));
+    return (uint32_t)_mm256_movemask_epi8(eq);
+}
+
+__attribute__((target("avx2"))) static bool keys_equal_avx2(char const *a,
+                                                            char const *b) {
+    __m256i x = _mm256_loadu_si256((__m256i const *)a);
+    __m256i y = _mm256_loadu_si256((__m256i const *)b);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) ==
+               UINT32_MAX &&
+           tail_equal(a, b);
+}
+
+#endif
+
+_Static_assert(MAX_FILE_NAME >= 32 && MAX_FILE_NAME <= 64,
+               "the SIMD kernels compare names as 32 bytes and a tail");
+
+static kernel_ops_t const kernels[DIR_KERNELS] = {
+    [DIR_KERNEL_SCALAR] = {match_scalar, keys_equal_scalar},
+#ifdef DIR_SIMD_X86
+    [DIR_KERNEL_SSE2] = {match_sse2, keys_equal_sse2},
+    [DIR_KERNEL_AVX2] = {match_avx2, keys_equal_avx2},
+#endif
+};
+
+static dir_kernel_t current = DIR_KERNEL_SCALAR;
+static kernel_ops_t const *ops = &kernels[DIR_KERNEL_SCALAR];
+
+static bool supported(dir_kernel_t kernel) {
+    switch (kernel) {
+    case DIR_KERNEL_SCALAR:
+        return true;
+#ifdef DIR_SIMD_X86
+    case DIR_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case DIR_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#else
+    case DIR_KERNEL_SSE2:
+    case DIR_KERNEL_AVX2:
+#endif
+    case DIR_KERNELS:
+    default:
+        return false;
+    }
+}
+
+void dir_simd_init() {
+#ifdef DIR_SIMD_X86
+    __builtin_cpu_init();
+#endif
+    for (int k = DIR_KERNELS - 1; k >= 0; k--) {
+        if (dir_use_kernel((dir_kernel_t)k)) {
+            return;
+        }
+    }
+}
+
+bool dir_use_kernel(dir_kernel_t kernel) {
+    if (!supported(kernel)) {
+        return false;
+    }
+    current = kernel;
+    ops = &kernels[kernel];
+    return true;
+}
+
+dir_kernel_t dir_kernel() { return current; }
+
+char const *dir_kernel_name(dir_kernel_t kernel) {
+    switch (kernel) {
+    case DIR_KERNEL_SCALAR:
+        return "scalar";
+    case DIR_KERNEL_SSE2:
+        return "sse2";
+    case DIR_KERNEL_AVX2:
+        return "avx2";
+    case DIR_KERNELS:
+    default:
+        return "unknown";
+    }
+}
+
+void dir_key(char key[MAX_FILE_NAME], char const *name) {
+    size_t len = strnlen(name, MAX_FILE_NAME);
+    memcpy(key, name, len);
+    memset(key + len, 0, MAX_FILE_NAME - len);
+}
+
+_Static_assert(MAX_FILE_NAME % sizeof(uint64_t) == 0,
+               "keys are hashed a word at a time");
+
+uint8_t dir_tag(char const key[MAX_FILE_NAME]) {
+    /* keys are zero-padded, so every word can be hashed without looking
+     * for the end of the name; the high bits are the best mixed */
+    uint64_t h = 0;
+    for (size_t i = 0; i < MAX_FILE_NAME; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, key + i, sizeof(w));
+        h = (h ^ w) * 0x9e3779b97f4a7c15u;
+        h ^= h >> 29;
+    }
+    return (uint8_t)(0x80 | h >> 57);
+}
+
+int dir_lookup(dir_block_t const *dir, char const key[MAX_FILE_NAME],
+               uint8_t tag) {
+    for (size_t g = 0; g < DIR_TAGS_SIZE; g += 32) {
+        uint32_t mask = ops->match(dir->d_tags + g, tag);
+        while (mask != 0) {
+            size_t i = g + (size_t)__builtin_ctz(mask);
+            /* the padding tags are always empty, so never match */
+            if (ops->keys_equal(dir->d_entries[i].d_name, key)) {
+                return (int)i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return -1;
+}
+
+int dir_free_entry(dir_block_t const *dir) {
+    for (size_t g = 0; g < DIR_TAGS_SIZE; g += 32) {
+        uint32_t mask = ops->match(dir->d_tags + g, DIR_TAG_EMPTY);
+        if (mask != 0) {
+            size_t i = g + (size_t)__builtin_ctz(mask);
+            return i < MAX_DIR_ENTRIES ? (int)i : -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,53 @@
+#ifndef DIR_SIMD_H
+#define DIR_SIMD_H
+
+#include "state.h"
+
+/*
+ * Directory block searches (see dir_block_t), with SSE2 and AVX2 kernels
+ * picked at run time according to the CPU, and a scalar fallback.
+ */
+
+typedef enum {
+    DIR_KERNEL_SCALAR,
+    DIR_KERNEL_SSE2,
+    DIR_KERNEL_AVX2,
+    DIR_KERNELS,
+} dir_kernel_t;
+
+/* Selects the fastest kernel the CPU supports (called by state_init) */
+void dir_simd_init();
+
+/*
+ * Selects a given kernel (for benchmarks).
+ * Returns false, leaving the current one, if the CPU does not support it.
+ */
+bool dir_use_kernel(dir_kernel_t kernel);
+
+/* Returns the kernel in use */
+dir_kernel_t dir_kernel();
+
+/* Returns a printable name of a kernel */
+char const *dir_kernel_name(dir_kernel_t kernel);
+
+/*
+ * Copies a name into a MAX_FILE_NAME key, zero-padded like the names in
+ * directory entries (a longer name keeps its MAX_FILE_NAME-th character,
+ * so it matches no entry)
+ */
+void dir_key(char key[MAX_FILE_NAME], char const *name);
+
+/* Returns the tag of a key (never DIR_TAG_EMPTY) */
+uint8_t dir_tag(char const key[MAX_FILE_NAME]);
+
+/*
+ * Looks for the entry of a key (with tag dir_tag(key)).
+ * Returns its index, -1 if there is none.
+ */
+int dir_lookup(dir_block_t const *dir, char const key[MAX_FILE_NAME],
+               uint8_t tag);
+
+/* Returns the index of the first free entry, -1 if the directory is full */
+int dir_free_entry(dir_block_t const *dir);
+
+#endif // DIR_SIMD_H
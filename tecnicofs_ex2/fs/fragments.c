@@ -0,0 +1,307 @@
+#include "fragments.h"
+#include <string.h>
+
+_Static_assert(FRAGMENTS_PER_BLOCK <= 32 && BLOCK_SIZE % FRAGMENT_SIZE == 0,
+               "a block's fragments are tracked in a 32-bit map");
+_Static_assert(INLINE_DATA_SIZE < FRAGMENT_FILE_MAX,
+               "fragments are for files too large to be inline");
+_Static_assert(INODE_TABLE_SIZE <= UINT8_MAX,
+               "fragment_refs must hold a reference from every file");
+
+/* occupancy map of each fragment block (bit i: fragment i is in use) */
+static uint32_t fragment_map[DATA_BLOCKS];
+/* files that have each fragment (more than one once a file is cloned, see
+ * inode_data_share); the live FS holds a single reference to the block
+ * while any of its fragments is in use */
+static uint8_t fragment_refs[DATA_BLOCKS][FRAGMENTS_PER_BLOCK];
+/* fragment blocks with free fragments, linked through next_partial */
+static int partial = -1;
+static int next_partial[DATA_BLOCKS];
+static bool in_partial[DATA_BLOCKS];
+
+static bool enabled = true;
+
+#define FULL_MAP ((uint32_t)((1ull << FRAGMENTS_PER_BLOCK) - 1))
+
+static inline uint32_t run_mask(int first, int n) {
+    return (uint32_t)(((1ull << n) - 1) << first);
+}
+
+static inline int fragments_for(size_t size) {
+    return (int)((size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE);
+}
+
+void fragments_init() {
+    memset(fragment_map, 0, sizeof(fragment_map));
+    memset(fragment_refs, 0, sizeof(fragment_refs));
+    memset(in_partial, 0, sizeof(in_partial));
+    partial = -1;
+}
+
+void fragments_set_enabled(bool enable) { enabled = enable; }
+
+static void unlink_partial(int block) {
+    for (int *b = &partial; *b != -1; b = &next_partial[*b]) {
+        if (*b == block) {
+            *b = next_partial[block];
+            in_partial[block] = false;
+            return;
+        }
+    }
+}
+
+void fragments_take(inode_t const *inode) {
+    int b = inode->i_data_block;
+    if (fragment_map[b] == 0) {
+        data_block_share(b);
+    }
+    for (int f = inode->i_fragment; f < inode->i_fragment + inode->i_fragments;
+         f++) {
+        fragment_refs[b][f]++;
+    }
+    fragment_map[b] |= run_mask(inode->i_fragment, inode->i_fragments);
+    if (fragment_map[b] == FULL_MAP) {
+        if (in_partial[b]) {
+            unlink_partial(b);
+        }
+    } else if (!in_partial[b]) {
+        next_partial[b] = partial;
+        partial = b;
+        in_partial[b] = true;
+    }
+}
+
+/* Sets the references of a run of newly allocated fragments */
+static void run_take(int block, int first, int n) {
+    memset(&fragment_refs[block][first], 1, (size_t)n);
+}
+
+/* Whether another file has some fragment of a file's run */
+static bool run_shared(inode_t const *inode) {
+    for (int f = inode->i_fragment; f < inode->i_fragment + inode->i_fragments;
+         f++) {
+        if (fragment_refs[inode->i_data_block][f] > 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the first fragment of a free run of n in a map, -1 if none */
+static int find_run(uint32_t map, int n) {
+    for (int first = 0; first + n <= FRAGMENTS_PER_BLOCK; first++) {
+        if ((map & run_mask(first, n)) == 0) {
+            return first;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Allocates a run of n fragments, in a fragment block that has room for
+ * it or in a new one.
+ * Returns the first fragment (and its block), -1 if there is no room.
+ */
+static int fragment_alloc(int n, int *block) {
+    for (int b = partial; b != -1; b = next_partial[b]) {
+        /* the free fragments of a block frozen in a snapshot may still hold
+         * the files of the snapshot */
+        if (data_block_shared(b)) {
+            continue;
+        }
+        int first = find_run(fragment_map[b], n);
+        if (first != -1) {
+            fragment_map[b] |= run_mask(first, n);
+            run_take(b, first, n);
+            if (fragment_map[b] == FULL_MAP) {
+                unlink_partial(b);
+            }
+            *block = b;
+            return first;
+        }
+    }
+
+    int b = data_block_alloc();
+    if (b == -1) {
+        return -1;
+    }
+    fragment_map[b] = run_mask(0, n);
+    run_take(b, 0, n);
+    if (fragment_map[b] != FULL_MAP) {
+        next_partial[b] = partial;
+        partial = b;
+        in_partial[b] = true;
+    }
+    *block = b;
+    return 0;
+}
+
+/* Drops a file's references to a run of fragments, freeing those no other
+ * file has, and their block once it is empty */
+static int fragment_free(int block, int first, int n) {
+    for (int f = first; f < first + n; f++) {
+        if (fragment_refs[block][f] > 0 && --fragment_refs[block][f] == 0) {
+            fragment_map[block] &= ~run_mask(f, 1);
+        }
+    }
+    if (fragment_map[block] == 0) {
+        if (in_partial[block]) {
+            unlink_partial(block);
+        }
+        return data_block_free(block);
+    }
+    if (!in_partial[block]) {
+        next_partial[block] = partial;
+        partial = block;
+        in_partial[block] = true;
+    }
+    return 0;
+}
+
+char *inode_data(inode_t *inode) {
+    if (inode->i_data_block == -1) {
+        return inode->i_inline_data;
+    }
+    char *block = data_block_get(inode->i_data_block);
+    if (block == NULL || inode->i_fragment == -1) {
+        return block;
+    }
+    return block + (size_t)inode->i_fragment * FRAGMENT_SIZE;
+}
+
+static size_t capacity(inode_t const *inode) {
+    if (inode->i_data_block == -1) {
+        return INLINE_DATA_SIZE;
+    }
+    if (inode->i_fragment != -1) {
+        return (size_t)inode->i_fragments * FRAGMENT_SIZE;
+    }
+    return BLOCK_SIZE;
+}
+
+/*
+ * Moves a file's contents to the storage allocated in moved, and frees the
+ * storage they leave.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int move_data(inode_t *inode, inode_t *moved) {
+    char *to = inode_data(moved);
+    char *from = inode_data(inode);
+    if (to == NULL || from == NULL) {
+        inode_data_free(moved);
+        return -1;
+    }
+    /* new fragments may be in a block that other files had when a
+     * checkpoint began */
+    data_block_cow(moved->i_data_block);
+    memcpy(to, from, inode->i_size);
+    if (inode_data_free(inode) == -1) {
+        return -1;
+    }
+    inode->i_data_block = moved->i_data_block;
+    inode->i_fragment = moved->i_fragment;
+    inode->i_fragments = moved->i_fragments;
+    return 0;
+}
+
+int inode_data_reserve(inode_t *inode, size_t size) {
+    if (size <= capacity(inode)) {
+        return 0;
+    }
+    if (size > BLOCK_SIZE) {
+        return -1;
+    }
+
+    int n = fragments_for(size);
+    /* a run of fragments may grow in place */
+    if (inode->i_fragment != -1 && size <= FRAGMENT_FILE_MAX &&
+        inode->i_fragment + n <= FRAGMENTS_PER_BLOCK &&
+        !data_block_shared(inode->i_data_block) && !run_shared(inode)) {
+        uint32_t more =
+            run_mask(inode->i_fragment + inode->i_fragments,
+                     n - inode->i_fragments);
+        if ((fragment_map[inode->i_data_block] & more) == 0) {
+            fragment_map[inode->i_data_block] |= more;
+            run_take(inode->i_data_block,
+                     inode->i_fragment + inode->i_fragments,
+                     n - inode->i_fragments);
+            if (fragment_map[inode->i_data_block] == FULL_MAP) {
+                unlink_partial(inode->i_data_block);
+            }
+            inode->i_fragments = n;
+            return 0;
+        }
+    }
+
+    /* else the contents move to new fragments or to a block of their own */
+    inode_t moved = *inode;
+    if (enabled && size <= FRAGMENT_FILE_MAX) {
+        moved.i_fragment = fragment_alloc(n, &moved.i_data_block);
+        moved.i_fragments = n;
+        if (moved.i_fragment == -1) {
+            return -1;
+        }
+    } else {
+        moved.i_data_block = data_block_alloc();
+        moved.i_fragment = -1;
+        moved.i_fragments = 0;
+        if (moved.i_data_block == -1) {
+            return -1;
+        }
+    }
+
+    return move_data(inode, &moved);
+}
+
+int inode_data_unshare(inode_t *inode) {
+    if (inode->i_data_block == -1) {
+        return 0;
+    }
+    if (inode->i_fragment == -1) {
+        return data_block_unshare(&inode->i_data_block);
+    }
+    if (!data_block_shared(inode->i_data_block) && !run_shared(inode)) {
+        return 0;
+    }
+
+    /* a run of fragments moves out of the shared block (or away from the
+     * clones it is shared with), which keeps the other files' fragments */
+    inode_t moved = *inode;
+    moved.i_fragment = fragment_alloc(inode->i_fragments, &moved.i_data_block);
+    if (moved.i_fragment == -1) {
+        return -1;
+    }
+    return move_data(inode, &moved);
+}
+
+void inode_data_share(inode_t const *from, inode_t *to) {
+    to->i_size = from->i_size;
+    to->i_data_block = from->i_data_block;
+    to->i_fragment = from->i_fragment;
+    to->i_fragments = from->i_fragments;
+    memcpy(to->i_inline_data, from->i_inline_data, INLINE_DATA_SIZE);
+    if (from->i_data_block == -1) {
+        return;
+    }
+    if (from->i_fragment != -1) {
+        fragments_take(from);
+    } else {
+        data_block_share(from->i_data_block);
+    }
+}
+
+int inode_data_free(inode_t *inode) {
+    int r = 0;
+    if (inode->i_data_block != -1) {
+        if (inode->i_fragment != -1) {
+            r = fragment_free(inode->i_data_block, inode->i_fragment,
+                              inode->i_fragments);
+        } else {
+            r = data_block_free(inode->i_data_block);
+        }
+    }
+    inode->i_data_block = -1;
+    inode->i_fragment = -1;
+    inode->i_fragments = 0;
+    return r;
+}
@@ -0,0 +1,63 @@
+#ifndef FRAGMENTS_H
+#define FRAGMENTS_H
+
+#include "state.h"
+
+/*
+ * Storage of file contents, in one of three places depending on the size
+ * of the file:
+ *  - up to INLINE_DATA_SIZE bytes, in the i-node itself;
+ *  - up to FRAGMENT_FILE_MAX bytes, in a run of FRAGMENT_SIZE fragments of
+ *    a block shared with other small files (a fragment block, whose
+ *    fragments in use are tracked in an occupancy map);
+ *  - else, in a whole block.
+ * A file moves to the next place when it grows past the current one.
+ * Like the rest of the FS state, these are not synchronized.
+ */
+
+#define FRAGMENTS_PER_BLOCK (BLOCK_SIZE / FRAGMENT_SIZE)
+#define FRAGMENT_FILE_MAX (BLOCK_SIZE / 2)
+
+/* Forgets every fragment block (called by state_init) */
+void fragments_init();
+
+/* Takes a reference to the fragments of a file, for a file restored (see
+ * state_restore) or cloned that has them too */
+void fragments_take(inode_t const *inode);
+
+/* Chooses whether small files are packed in fragments (they are by
+ * default); files that already are keep their fragments */
+void fragments_set_enabled(bool enabled);
+
+/* Returns where a file's contents start, NULL if that fails */
+char *inode_data(inode_t *inode);
+
+/*
+ * Makes room for size bytes of contents, moving the existing contents if
+ * the file has to change places.
+ * Returns 0 if successful, -1 otherwise (the file is left unchanged).
+ */
+int inode_data_reserve(inode_t *inode, size_t size);
+
+/*
+ * Makes a file (whose contents were freed) share another's contents, which
+ * either one copies before changing them (see inode_data_unshare). Costs
+ * the same whatever the size of the contents.
+ */
+void inode_data_share(inode_t const *from, inode_t *to);
+
+/*
+ * Called before a file's contents are changed in place: if a snapshot or a
+ * clone shares them, they move to storage of this file alone (a run of
+ * fragments moves on its own, leaving the rest of the block as it is).
+ * Returns 0 if successful, -1 otherwise (the file is left unchanged).
+ */
+int inode_data_unshare(inode_t *inode);
+
+/*
+ * Frees the storage of a file's contents, leaving it empty (inline).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int inode_data_free(inode_t *inode);
+
+#endif // FRAGMENTS_H
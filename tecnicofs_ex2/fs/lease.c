@@ -0,0 +1,80 @@
+#include "lease.h"
+#include "config.h"
+#include "counters.h"
+#include <stdint.h>
+
+_Static_assert(MAX_SESSIONS <= 32, "lease holders are kept in a 32-bit mask");
+
+typedef struct {
+    uint32_t holders; /* sessions holding a lease, one bit each */
+    int writer;       /* the holder with a write lease, -1 if none */
+} lease_t;
+
+static lease_t leases[INODE_TABLE_SIZE];
+static lease_revoke_t revoke_fn;
+
+static void revoke(lease_t *lease, int session, int inumber) {
+    lease->holders &= ~(1u << session);
+    if (lease->writer == session) {
+        lease->writer = -1;
+    }
+    counter_add(&counters_local()->lease_revocations, 1);
+    revoke_fn(session, inumber);
+}
+
+void lease_init(lease_revoke_t fn) {
+    revoke_fn = fn;
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        leases[i].holders = 0;
+        leases[i].writer = -1;
+    }
+}
+
+void lease_grant(int session, int inumber) {
+    if (inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+        return;
+    }
+    lease_t *lease = &leases[inumber];
+
+    if (lease->writer != -1 && lease->writer != session) {
+        revoke(lease, lease->writer, inumber);
+    }
+    lease->holders |= 1u << session;
+    counter_add(&counters_local()->lease_grants, 1);
+}
+
+void lease_write(int session, int inumber) {
+    if (inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+        return;
+    }
+    lease_t *lease = &leases[inumber];
+
+    for (int s = 0; lease->holders & ~(1u << session); s++) {
+        if (s != session && (lease->holders & (1u << s))) {
+            revoke(lease, s, inumber);
+        }
+    }
+    lease->writer = (lease->holders & (1u << session)) ? session : -1;
+}
+
+void lease_revoke_all(int inumber) {
+    if (inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+        return;
+    }
+    lease_t *lease = &leases[inumber];
+
+    for (int s = 0; lease->holders != 0; s++) {
+        if (lease->holders & (1u << s)) {
+            revoke(lease, s, inumber);
+        }
+    }
+}
+
+void lease_drop_session(int session) {
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        leases[i].holders &= ~(1u << session);
+        if (leases[i].writer == session) {
+            leases[i].writer = -1;
+        }
+    }
+}
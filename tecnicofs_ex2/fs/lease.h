@@ -0,0 +1,39 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+/*
+ * Leases on file contents, held by sessions that cache them.
+ * While a session holds a lease on an i-node it may serve opens and reads
+ * of that file from its own cache. Read leases are shared; a session that
+ * writes to an i-node it holds a lease on keeps it as a write lease, which
+ * no other session holds at the same time. Every lease that conflicts with
+ * a change is revoked (through the callback given to lease_init) before the
+ * change is acknowledged, so a client never trusts its cache for longer than
+ * it takes to look at its callback channel.
+ * Only the server's request loop (or, in a replica, the thread applying the
+ * log, which excludes the request loop) calls these functions.
+ */
+
+/* Notifies a session that it lost its lease on an i-node */
+typedef void (*lease_revoke_t)(int session, int inumber);
+
+/* Drops every lease and sets the revocation callback */
+void lease_init(lease_revoke_t fn);
+
+/* Grants a session a read lease on an i-node, revoking a write lease that
+ * another session holds on it */
+void lease_grant(int session, int inumber);
+
+/* Called before a session changes an i-node: revokes the leases of every
+ * other session, and turns the writer's own lease (if any) into a write
+ * lease */
+void lease_write(int session, int inumber);
+
+/* Called before an i-node is changed outside of any session (by a replica
+ * applying the log): revokes every lease on it */
+void lease_revoke_all(int inumber);
+
+/* Drops every lease of a session (when it ends) */
+void lease_drop_session(int session);
+
+#endif // LEASE_H
@@ -0,0 +1,145 @@
+#include "lockprof.h"
+#include "counters.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef TFS_LOCK_PROFILE
+
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t hold_ns;
+} site_profile_t;
+
+static site_profile_t profile[LOCK_SITES];
+
+/* when the calling thread acquired the lock of each site */
+static _Thread_local uint64_t acquired_at[LOCK_SITES];
+
+static char const *site_names[LOCK_SITES] = {
+    [LOCK_SITE_DESTROY_AFTER_ALL_CLOSED] = "tfs_destroy_after_all_closed",
+    [LOCK_SITE_LOOKUP] = "tfs_lookup",
+    [LOCK_SITE_OPEN] = "tfs_open",
+    [LOCK_SITE_CLOSE] = "tfs_close",
+    [LOCK_SITE_WRITE] = "tfs_write",
+    [LOCK_SITE_READ] = "tfs_read",
+    [LOCK_SITE_READ_REF] = "tfs_read_ref",
+    [LOCK_SITE_CHECKPOINT] = "tfs_checkpoint",
+    [LOCK_SITE_SNAPSHOT] = "tfs_snapshot",
+    [LOCK_SITE_CLONE] = "tfs_clone",
+};
+
+static inline void profile_add(uint64_t *counter, uint64_t v) {
+    __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+#endif
+
+int tfs_mutex_lock(pthread_mutex_t *mutex, lock_site_t site) {
+    tfs_stats_t *stats = counters_local();
+    counter_add(&stats->lock_acquisitions, 1);
+
+    int r = pthread_mutex_trylock(mutex);
+    uint64_t wait = 0;
+    if (r != 0) {
+        uint64_t t = trace_begin();
+        uint64_t start = now_ns();
+        r = pthread_mutex_lock(mutex);
+        wait = now_ns() - start;
+        counter_add(&stats->lock_contended, 1);
+        counter_add(&stats->lock_wait_ns, wait);
+        trace_end(TRACE_LOCK, t);
+    }
+
+#ifdef TFS_LOCK_PROFILE
+    if (r == 0) {
+        site_profile_t *p = &profile[site];
+        profile_add(&p->acquisitions, 1);
+        if (wait > 0) {
+            profile_add(&p->contended, 1);
+            profile_add(&p->wait_ns, wait);
+        }
+        acquired_at[site] = now_ns();
+    }
+#else
+    (void)site;
+#endif
+    return r;
+}
+
+#ifdef TFS_LOCK_PROFILE
+
+int tfs_mutex_unlock(pthread_mutex_t *mutex, lock_site_t site) {
+    profile_add(&profile[site].hold_ns, now_ns() - acquired_at[site]);
+    return pthread_mutex_unlock(mutex);
+}
+
+static int by_wait(void const *a, void const *b) {
+    uint64_t wa = profile[*(int const *)a].wait_ns;
+    uint64_t wb = profile[*(int const *)b].wait_ns;
+    return (wa < wb) - (wa > wb);
+}
+
+ssize_t lockprof_report(char *buffer, size_t size) {
+    int order[LOCK_SITES];
+    for (int i = 0; i < LOCK_SITES; i++) {
+        order[i] = i;
+    }
+    qsort(order, LOCK_SITES, sizeof(int), by_wait);
+
+    size_t len = 0;
+    len += (size_t)snprintf(buffer, size,
+                            "%-30s %10s %10s %7s %12s %10s %12s %10s\n",
+                            "site", "acquired", "contended", "%", "wait ms",
+                            "avg us", "hold ms", "avg us");
+    for (int i = 0; i < LOCK_SITES && len < size; i++) {
+        site_profile_t p;
+        p.acquisitions =
+            __atomic_load_n(&profile[order[i]].acquisitions, __ATOMIC_RELAXED);
+        p.contended =
+            __atomic_load_n(&profile[order[i]].contended, __ATOMIC_RELAXED);
+        p.wait_ns =
+            __atomic_load_n(&profile[order[i]].wait_ns, __ATOMIC_RELAXED);
+        p.hold_ns =
+            __atomic_load_n(&profile[order[i]].hold_ns, __ATOMIC_RELAXED);
+        if (p.acquisitions == 0) {
+            continue;
+        }
+        len += (size_t)snprintf(
+            buffer + len, size - len,
+            "%-30s %10lu %10lu %6.2f%% %12.3f %10.2f %12.3f %10.2f\n",
+            site_names[order[i]], (unsigned long)p.acquisitions,
+            (unsigned long)p.contended,
+            100.0 * (double)p.contended / (double)p.acquisitions,
+            (double)p.wait_ns / 1e6,
+            (double)p.wait_ns / 1e3 / (double)p.acquisitions,
+            (double)p.hold_ns / 1e6,
+            (double)p.hold_ns / 1e3 / (double)p.acquisitions);
+    }
+    return (ssize_t)(len < size ? len : size - 1);
+}
+
+void lockprof_reset() { memset(profile, 0, sizeof(profile)); }
+
+#else
+
+ssize_t lockprof_report(char *buffer, size_t size) {
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+    return -1;
+}
+
+void lockprof_reset() {}
+
+#endif
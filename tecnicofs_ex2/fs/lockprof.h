@@ -0,0 +1,54 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Instrumented mutex wrapper.
+ * Every acquisition is counted in the server statistics (contended
+ * acquisitions and wait time only cost a clock read when the lock is
+ * busy). Building with -DTFS_LOCK_PROFILE additionally profiles each lock
+ * site: acquisitions, contended acquisitions, wait and hold times.
+ * Without it, the profiling code is not compiled at all.
+ */
+
+/* Places where locks are taken */
+typedef enum {
+    LOCK_SITE_DESTROY_AFTER_ALL_CLOSED,
+    LOCK_SITE_LOOKUP,
+    LOCK_SITE_OPEN,
+    LOCK_SITE_CLOSE,
+    LOCK_SITE_WRITE,
+    LOCK_SITE_READ,
+    LOCK_SITE_READ_REF,
+    LOCK_SITE_CHECKPOINT,
+    LOCK_SITE_SNAPSHOT,
+    LOCK_SITE_CLONE,
+    LOCK_SITES,
+} lock_site_t;
+
+/* Locks the mutex on behalf of a site; returns 0 or an error number */
+int tfs_mutex_lock(pthread_mutex_t *mutex, lock_site_t site);
+
+#ifdef TFS_LOCK_PROFILE
+int tfs_mutex_unlock(pthread_mutex_t *mutex, lock_site_t site);
+#else
+static inline int tfs_mutex_unlock(pthread_mutex_t *mutex, lock_site_t site) {
+    (void)site;
+    return pthread_mutex_unlock(mutex);
+}
+#endif
+
+/*
+ * Writes the contention report, sites ranked by total wait time, to buffer
+ * (at most size bytes, always null-terminated).
+ * Returns the length of the report, or -1 if profiling was not compiled in.
+ */
+ssize_t lockprof_report(char *buffer, size_t size);
+
+/* Forgets every profiled acquisition */
+void lockprof_reset();
+
+#endif // LOCKPROF_H
@@ -0,0 +1,59 @@
+#include "magazine.h"
+
+static inline uint64_t next_state(uint64_t state, uint32_t count) {
+    return ((state >> 32) + 1) << 32 | count;
+}
+
+bool magazine_pop(magazine_t *m, int *item) {
+    uint64_t s = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+    while (true) {
+        uint32_t count = (uint32_t)s;
+        if (count == 0) {
+            return false;
+        }
+        /* only the owner writes items, so this one is stable */
+        int top = m->items[count - 1];
+        if (__atomic_compare_exchange_n(&m->state, &s,
+                                        next_state(s, count - 1), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *item = top;
+            return true;
+        }
+    }
+}
+
+bool magazine_push(magazine_t *m, int item) {
+    uint64_t s = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+    while (true) {
+        uint32_t count = (uint32_t)s;
+        if (count == MAGAZINE_SIZE) {
+            return false;
+        }
+        /* a thief only reads the items below count */
+        __atomic_store_n(&m->items[count], item, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&m->state, &s,
+                                        next_state(s, count + 1), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+}
+
+int magazine_steal(magazine_t *m, int *items) {
+    uint64_t s = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+    while (true) {
+        uint32_t count = (uint32_t)s;
+        if (count == 0) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            items[i] = __atomic_load_n(&m->items[i], __ATOMIC_RELAXED);
+        }
+        /* the copy is only good if the magazine did not change meanwhile */
+        if (__atomic_compare_exchange_n(&m->state, &s, next_state(s, 0),
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return (int)count;
+        }
+    }
+}
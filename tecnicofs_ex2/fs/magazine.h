@@ -0,0 +1,49 @@
+#ifndef MAGAZINE_H
+#define MAGAZINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Magazine: a small stack of free items (block or i-node numbers) cached
+ * by one thread, its owner.
+ * The owner pushes and pops without locks, with a compare-and-swap on the
+ * magazine's own cache line. Any thread may steal the whole contents, so
+ * that the items of other threads' magazines can be given back when the
+ * shared allocator runs dry.
+ */
+
+#define MAGAZINE_SIZE (32)
+/* items moved at once between a magazine and the shared allocator */
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
+typedef struct {
+    /* generation (bumped by every change, against ABA) << 32 | count */
+    uint64_t state;
+    int items[MAGAZINE_SIZE];
+} __attribute__((aligned(64))) magazine_t;
+
+/* Returns the number of items in a magazine */
+static inline int magazine_count(magazine_t const *m) {
+    return (int)(uint32_t)__atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Takes the item on top (owner only).
+ * Returns false if the magazine is empty.
+ */
+bool magazine_pop(magazine_t *m, int *item);
+
+/*
+ * Puts an item on top (owner only).
+ * Returns false if the magazine is full.
+ */
+bool magazine_push(magazine_t *m, int item);
+
+/*
+ * Empties a magazine (any thread) into items (of at least MAGAZINE_SIZE).
+ * Returns how many items were taken.
+ */
+int magazine_steal(magazine_t *m, int *items);
+
+#endif // MAGAZINE_H
@@ -1,4 +1,8 @@
 #include "operations.h"
+#include "checkpoint.h"
+#include "fragments.h"
+#include "lockprof.h"
+#include "snapshot.h"
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -9,8 +13,17 @@ static pthread_mutex_t single_global_lock;
 pthread_cond_t file_opened;
 bool tfs_destroyed;
 
+/* Creates the root directory of an empty state */
+static int create_root() {
+    state_change_begin();
+    int root = inode_create(T_DIRECTORY);
+    state_change_end();
+    return root == ROOT_DIR_INUM ? 0 : -1;
+}
+
 int tfs_init() {
-    state_init();
+    if (state_init() == -1)
+        return -1;
 
     if (pthread_mutex_init(&single_global_lock, 0) != 0)
         return -1;
@@ -18,8 +31,7 @@ int tfs_init() {
         return -1;
 
     /* create root inode */
-    int root = inode_create(T_DIRECTORY);
-    if (root != ROOT_DIR_INUM) {
+    if (create_root() == -1) {
         return -1;
     }
 
@@ -27,6 +39,16 @@ int tfs_init() {
 }
 
 int tfs_destroy() {
+#ifdef TFS_LOCK_PROFILE
+    char report[2048];
+    if (lockprof_report(report, sizeof(report)) > 0) {
+        fputs(report, stderr);
+    }
+#endif
+    /* a checkpoint being written reads the state, and so does the
+     * reclaiming of deleted snapshots */
+    checkpoint_wait();
+    snapshots_destroy();
     state_destroy();
     if (pthread_mutex_destroy(&single_global_lock) != 0) {
         return -1;
@@ -44,7 +66,8 @@ static bool valid_pathname(char const *name) {
 
 int tfs_destroy_after_all_closed() {
     
-    if (pthread_mutex_lock(&single_global_lock) != 0) {
+    if (tfs_mutex_lock(&single_global_lock,
+                       LOCK_SITE_DESTROY_AFTER_ALL_CLOSED) != 0) {
         return -1;
     }
 
@@ -55,7 +78,8 @@ int tfs_destroy_after_all_closed() {
         pthread_cond_wait(&file_opened, &single_global_lock);
     }
 
-    if (pthread_mutex_unlock(&single_global_lock) != 0) {
+    if (tfs_mutex_unlock(&single_global_lock,
+                         LOCK_SITE_DESTROY_AFTER_ALL_CLOSED) != 0) {
         return -1;
     }
 
@@ -79,18 +103,47 @@ int _tfs_lookup_unsynchronized(char const *name) {
 }
 
 int tfs_lookup(char const *name) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_LOOKUP) != 0)
         return -1;
     int ret = _tfs_lookup_unsynchronized(name);
-    if (pthread_mutex_unlock(&single_global_lock) != 0)
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_LOOKUP) != 0)
         return -1;
     return ret;
 }
 
-static int _tfs_open_unsynchronized(char const *name, int flags) {
+/* Opens a file of a snapshot, which is read-only */
+static int _tfs_open_snapshot(int snapshot, char const *name, int flags,
+                              bool replay) {
+    if (flags & TFS_O_TRUNC) {
+        return -1;
+    }
+    int inum = snapshot_lookup(snapshot, name);
+    inode_t const *inode = snapshot_inode(snapshot, inum);
+    if (inode == NULL || snapshot_open(snapshot) == -1) {
+        return -1;
+    }
+    size_t offset = (flags & TFS_O_APPEND) ? inode->i_size : 0;
+    int fhandle = replay ? add_to_replay_open_file_table(inum, offset)
+                         : add_to_open_file_table(inum, offset);
+    if (fhandle == -1) {
+        snapshot_close(snapshot);
+        return -1;
+    }
+    get_open_file_entry(fhandle)->of_snapshot = snapshot;
+    return fhandle;
+}
+
+static int _tfs_open_unsynchronized(char const *name, int flags,
+                                    bool replay) {
     int inum;
     size_t offset;
 
+    char const *snapshot_name;
+    int snapshot = snapshot_path(name, &snapshot_name);
+    if (snapshot != -1) {
+        return _tfs_open_snapshot(snapshot, snapshot_name, flags, replay);
+    }
+
     inum = _tfs_lookup_unsynchronized(name);
     if (inum >= 0) {
         /* The file already exists */
@@ -101,12 +154,10 @@ static int _tfs_open_unsynchronized(char const *name, int flags) {
 
         /* Trucate (if requested) */
         if (flags & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                if (data_block_free(inode->i_data_block) == -1) {
-                    return -1;
-                }
-                inode->i_size = 0;
+            if (inode_data_free(inode) == -1) {
+                return -1;
             }
+            inode->i_size = 0;
         }
         /* Determine initial offset */
         if (flags & TFS_O_APPEND) {
@@ -133,14 +184,15 @@ static int _tfs_open_unsynchronized(char const *name, int flags) {
 
     /* Finally, add entry to the open file table and
      * return the corresponding handle */
-    return add_to_open_file_table(inum, offset);
+    return replay ? add_to_replay_open_file_table(inum, offset)
+                  : add_to_open_file_table(inum, offset);
 
     /* Note: for simplification, if file was created with TFS_O_CREAT and there
      * is an error adding an entry to the open file table, the file is not
      * opened but it remains created */
 }
 
-int tfs_open(char const *name, int flags) {
+static int open_file(char const *name, int flags, bool replay) {
     if(tfs_destroyed) {
         return -1;
     }
@@ -149,37 +201,116 @@ int tfs_open(char const *name, int flags) {
     // Quaisquer chamadas a tfs_open que ocorram concorrentemente ou posteriormente ao 
     // momento em que a tfs_destroy_after_all_closed desativa o TecnicoFS devem devolver erro (-1)
     
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_OPEN) != 0)
         return -1;
 
-    int ret = _tfs_open_unsynchronized(name, flags);
+    /* only creating or truncating a file changes the state */
+    bool changes = flags & (TFS_O_CREAT | TFS_O_TRUNC);
+    if (changes) {
+        state_change_begin();
+    }
+    int ret = _tfs_open_unsynchronized(name, flags, replay);
+    if (changes) {
+        state_change_end();
+    }
     pthread_cond_signal(&file_opened);
 
-    if (pthread_mutex_unlock(&single_global_lock) != 0)
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_OPEN) != 0)
         return -1;
 
     return ret;
 }
 
+int tfs_open(char const *name, int flags) {
+    return open_file(name, flags, false);
+}
+
+int tfs_open_replay(char const *name, int flags) {
+    return open_file(name, flags, true);
+}
+
 int tfs_close(int fhandle) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_CLOSE) != 0)
         return -1;
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    int snapshot = file != NULL ? file->of_snapshot : -1;
     int r = remove_from_open_file_table(fhandle);
+    if (r == 0 && snapshot != -1) {
+        snapshot_close(snapshot);
+    }
 
     pthread_cond_signal(&file_opened);
-    if (pthread_mutex_unlock(&single_global_lock) != 0)
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_CLOSE) != 0)
         return -1;
 
 
     return r;
 }
 
+static int _tfs_clone_unsynchronized(char const *source_path,
+                                     char const *dest_path) {
+    /* the source may be a file of a snapshot (to bring it back) */
+    char const *snapshot_name;
+    int snapshot = snapshot_path(source_path, &snapshot_name);
+    inode_t *source =
+        snapshot != -1
+            ? snapshot_inode(snapshot,
+                             snapshot_lookup(snapshot, snapshot_name))
+            : inode_get(_tfs_lookup_unsynchronized(source_path));
+    if (source == NULL || source->i_node_type != T_FILE ||
+        !valid_pathname(dest_path) ||
+        snapshot_path(dest_path, &snapshot_name) != -1) {
+        return -1;
+    }
+
+    int inum = _tfs_lookup_unsynchronized(dest_path);
+    if (inum == -1) {
+        inum = inode_create(T_FILE);
+        if (inum == -1) {
+            return -1;
+        }
+        if (add_dir_entry(ROOT_DIR_INUM, inum, dest_path + 1) == -1) {
+            inode_delete(inum);
+            return -1;
+        }
+    }
+    inode_t *dest = inode_get(inum);
+    if (dest == NULL || dest->i_node_type != T_FILE) {
+        return -1;
+    }
+    if (dest == source) {
+        return 0;
+    }
+
+    /* the destination's contents are replaced by the source's, shared */
+    if (inode_data_free(dest) == -1) {
+        return -1;
+    }
+    inode_data_share(source, dest);
+    return 0;
+}
+
+int tfs_clone(char const *source_path, char const *dest_path) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_CLONE) != 0)
+        return -1;
+    state_change_begin();
+    int ret = _tfs_clone_unsynchronized(source_path, dest_path);
+    state_change_end();
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_CLONE) != 0)
+        return -1;
+
+    return ret;
+}
+
+/* Writes at the handle's offset, or at *at if it is not NULL; either one is
+ * advanced past the bytes written */
 static ssize_t _tfs_write_unsynchronized(int fhandle, void const *buffer,
-                                         size_t to_write) {
+                                         size_t to_write, size_t *at) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+    if (file == NULL || file->of_snapshot != -1) {
         return -1;
     }
+    size_t *offset = at != NULL ? at : &file->of_offset;
 
     /* From the open file table entry, we get the inode */
     inode_t *inode = inode_get(file->of_inumber);
@@ -188,29 +319,42 @@ static ssize_t _tfs_write_unsynchronized(int fhandle, void const *buffer,
     }
 
     /* Determine how many bytes to write */
-    if (to_write + file->of_offset > BLOCK_SIZE) {
-        to_write = BLOCK_SIZE - file->of_offset;
+    if (*offset >= BLOCK_SIZE) {
+        return 0;
+    }
+    if (to_write + *offset > BLOCK_SIZE) {
+        to_write = BLOCK_SIZE - *offset;
     }
 
     if (to_write > 0) {
-        if (inode->i_size == 0) {
-            /* If empty file, allocate new block */
-            inode->i_data_block = data_block_alloc();
+        /* If the file outgrows its storage, it moves (see fragments.h) */
+        if (inode_data_reserve(inode, *offset + to_write) == -1) {
+            return -1;
+        }
+        /* ... and if a snapshot or a clone shares it, it is copied first */
+        if (inode_data_unshare(inode) == -1) {
+            return -1;
         }
 
-        void *block = data_block_get(inode->i_data_block);
-        if (block == NULL) {
+        char *data = inode_data(inode);
+        if (data == NULL) {
             return -1;
         }
+        data_block_cow(inode->i_data_block);
+
+        /* A write past the end of the file leaves a hole of zeros */
+        if (*offset > inode->i_size) {
+            memset(data + inode->i_size, 0, *offset - inode->i_size);
+        }
 
         /* Perform the actual write */
-        memcpy(block + file->of_offset, buffer, to_write);
+        memcpy(data + *offset, buffer, to_write);
 
         /* The offset associated with the file handle is
          * incremented accordingly */
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+        *offset += to_write;
+        if (*offset > inode->i_size) {
+            inode->i_size = *offset;
         }
     }
 
@@ -218,54 +362,163 @@ static ssize_t _tfs_write_unsynchronized(int fhandle, void const *buffer,
 }
 
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_WRITE) != 0)
+        return -1;
+    state_change_begin();
+    ssize_t ret = _tfs_write_unsynchronized(fhandle, buffer, to_write, NULL);
+    state_change_end();
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_WRITE) != 0)
+        return -1;
+
+    return ret;
+}
+
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t to_write,
+                   size_t offset) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_WRITE) != 0)
         return -1;
-    ssize_t ret = _tfs_write_unsynchronized(fhandle, buffer, to_write);
-    if (pthread_mutex_unlock(&single_global_lock) != 0)
+    state_change_begin();
+    ssize_t ret =
+        _tfs_write_unsynchronized(fhandle, buffer, to_write, &offset);
+    state_change_end();
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_WRITE) != 0)
         return -1;
 
     return ret;
 }
 
-static ssize_t _tfs_read_unsynchronized(int fhandle, void *buffer, size_t len) {
+/* Reads at the handle's offset, or at *at if it is not NULL; either one is
+ * advanced past the bytes read */
+static ssize_t _tfs_read_ref_unsynchronized(int fhandle, size_t len,
+                                           void const **data, size_t *at) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
         return -1;
     }
+    size_t *offset = at != NULL ? at : &file->of_offset;
 
     /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(file->of_inumber);
+    inode_t *inode = file->of_snapshot != -1
+                         ? snapshot_inode(file->of_snapshot, file->of_inumber)
+                         : inode_get(file->of_inumber);
     if (inode == NULL) {
         return -1;
     }
 
     /* Determine how many bytes to read */
-    size_t to_read = inode->i_size - file->of_offset;
+    size_t to_read = *offset < inode->i_size ? inode->i_size - *offset : 0;
     if (to_read > len) {
         to_read = len;
     }
 
+    *data = NULL;
     if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        if (block == NULL) {
+        char const *contents = inode_data(inode);
+        if (contents == NULL) {
             return -1;
         }
 
-        /* Perform the actual read */
-        memcpy(buffer, block + file->of_offset, to_read);
+        *data = contents + *offset;
         /* The offset associated with the file handle is
          * incremented accordingly */
-        file->of_offset += to_read;
+        *offset += to_read;
     }
 
     return (ssize_t)to_read;
 }
 
+static ssize_t _tfs_read_unsynchronized(int fhandle, void *buffer, size_t len,
+                                        size_t *at) {
+    void const *data;
+    ssize_t to_read = _tfs_read_ref_unsynchronized(fhandle, len, &data, at);
+
+    if (to_read > 0) {
+        /* Perform the actual read */
+        memcpy(buffer, data, (size_t)to_read);
+    }
+
+    return to_read;
+}
+
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_READ) != 0)
+        return -1;
+    ssize_t ret = _tfs_read_unsynchronized(fhandle, buffer, len, NULL);
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_READ) != 0)
+        return -1;
+
+    return ret;
+}
+
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_READ) != 0)
+        return -1;
+    ssize_t ret = _tfs_read_unsynchronized(fhandle, buffer, len, &offset);
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_READ) != 0)
+        return -1;
+
+    return ret;
+}
+
+ssize_t tfs_read_ref(int fhandle, size_t len, void const **data) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_READ_REF) != 0)
+        return -1;
+    ssize_t ret = _tfs_read_ref_unsynchronized(fhandle, len, data, NULL);
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_READ_REF) != 0)
+        return -1;
+
+    return ret;
+}
+
+int tfs_checkpoint(char const *path) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_CHECKPOINT) != 0)
+        return -1;
+    int ret = checkpoint_start(path);
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_CHECKPOINT) != 0)
+        return -1;
+
+    return ret;
+}
+
+int tfs_checkpoint_status() { return checkpoint_status(); }
+
+int tfs_checkpoint_wait() { return checkpoint_wait(); }
+
+int tfs_restore(char const *path) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_CHECKPOINT) != 0)
+        return -1;
+    /* a checkpoint being written reads the state that is replaced */
+    checkpoint_wait();
+    state_change_begin();
+    /* the snapshots are of the state being replaced */
+    snapshots_reset();
+    int ret = checkpoint_restore(path);
+    state_change_end();
+    /* a checkpoint that cannot be restored leaves an empty FS */
+    if (ret == -1 && state_init() == 0) {
+        create_root();
+    }
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_CHECKPOINT) != 0)
+        return -1;
+
+    return ret;
+}
+
+int tfs_snapshot_create() {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_SNAPSHOT) != 0)
+        return -1;
+    int ret = snapshot_create();
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_SNAPSHOT) != 0)
+        return -1;
+
+    return ret;
+}
+
+int tfs_snapshot_delete(int id) {
+    if (tfs_mutex_lock(&single_global_lock, LOCK_SITE_SNAPSHOT) != 0)
         return -1;
-    ssize_t ret = _tfs_read_unsynchronized(fhandle, buffer, len);
-    if (pthread_mutex_unlock(&single_global_lock) != 0)
+    int ret = snapshot_delete(id);
+    if (tfs_mutex_unlock(&single_global_lock, LOCK_SITE_SNAPSHOT) != 0)
         return -1;
 
     return ret;
@@ -44,6 +44,12 @@ int tfs_lookup(char const *name);
  */
 int tfs_open(char const *name, int flags);
 
+/*
+ * Opens a file for a replica's replay of its primary's log, with a handle of
+ * its own (see REPLAY_OPEN_FILES), which clients cannot run out of
+ */
+int tfs_open_replay(char const *name, int flags);
+
 /* Closes a file
  * Input:
  * 	- file handle (obtained from a previous call to tfs_open)
@@ -72,6 +78,32 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Writes to an open file, starting at the given offset; the handle's offset
+ * is neither used nor changed. Writing past the end of the file fills the
+ * gap with zeros.
+ * Returns the number of bytes written, or -1 in case of error
+ */
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t len,
+                   size_t offset);
+
+/* Reads from an open file, starting at the given offset; the handle's offset
+ * is neither used nor changed.
+ * Returns the number of bytes read, or -1 in case of error
+ */
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset);
+
+/* Reads from an open file, starting at the current offset, without copying:
+ * the file contents are left in place and only a pointer to them is returned
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- maximum number of bytes to read
+ * 	- where to store the pointer to the first byte read (NULL if none)
+ * Returns the number of bytes available at *data, or -1 in case of error.
+ * Note: the contents are only guaranteed to be unchanged until the next
+ * operation that modifies the file.
+ */
+ssize_t tfs_read_ref(int fhandle, size_t len, void const **data);
+
 /* Copies the contents of a file that exists in TecnicoFS to the contents
  * of another file in the OS' file system tree (outside TecnicoFS).
  * Input:
@@ -82,4 +114,48 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
 
+/* Makes a file whose contents are those of another (created if it does not
+ * exist, or else with its own contents replaced), without copying them:
+ * both files share the blocks until either one changes them.
+ * Input:
+ *      - path name of the source file, which may be in a snapshot
+ *      - path name of the destination file (not in a snapshot)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source_path, char const *dest_path);
+
+/* Starts a checkpoint of the FS to a file in the OS' file system, which is
+ * written in the background while operations go on (see checkpoint.h)
+ * Returns 0 if it was started, -1 otherwise (e.g. if one is under way).
+ */
+int tfs_checkpoint(char const *path);
+
+/* Returns 1 while the last checkpoint is being written, and then 0 if it
+ * was written, -1 if it failed */
+int tfs_checkpoint_status();
+
+/* Waits for the last checkpoint to be written, and returns its status */
+int tfs_checkpoint_wait();
+
+/* Replaces the contents of the FS with those of a checkpoint, after the one
+ * being written (if any) is done
+ * Returns the number of files restored, -1 if it cannot be restored (the
+ * FS is then empty).
+ */
+int tfs_restore(char const *path);
+
+/* Takes a snapshot of the FS: a read-only view of its files as they are
+ * now, which are opened as TFS_SNAPSHOT_PREFIX "<id>/<name>" (see
+ * snapshot.h). Only the i-node table is copied; the blocks are copied when
+ * the live FS changes them.
+ * Returns the snapshot's id, -1 if there are MAX_SNAPSHOTS already.
+ */
+int tfs_snapshot_create();
+
+/* Deletes a snapshot; the blocks only it has are freed in the background,
+ * once the files open in it are closed
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_delete(int id);
+
 #endif // OPERATIONS_H
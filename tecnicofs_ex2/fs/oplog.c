@@ -0,0 +1,321 @@
+#include "oplog.h"
+#include "common/common.h"
+#include "operations.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* how often the follower looks for new records */
+#define OPLOG_POLL_NS (1000 * 1000)
+
+int oplog_fd = -1;
+static uint64_t last_seq;
+
+/* follower state, guarded by follow_lock */
+static pthread_mutex_t follow_lock = PTHREAD_MUTEX_INITIALIZER;
+static int follow_fd = -1;
+static off_t follow_offset;   /* of the next record */
+static uint64_t applied_seq;  /* last record applied */
+static uint64_t caught_up_ns; /* when the last read to the end started */
+static uint64_t staleness_ns;
+static oplog_change_t change_fn;
+/* primary handle -> replica handle (-1 if not open) */
+static int handles[MAX_OPEN_FILES];
+static char *data;
+static size_t data_size;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int oplog_start(char const *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0640);
+    if (fd == -1) {
+        perror("Open error");
+        return -1;
+    }
+    if (write(fd, OPLOG_MAGIC, sizeof(OPLOG_MAGIC)) == -1) {
+        perror("Write error");
+        close(fd);
+        return -1;
+    }
+    oplog_fd = fd;
+    return 0;
+}
+
+/* Appends a record; it is written at once, since the operation is only
+ * acknowledged after it. If it cannot be written, the process exits: a
+ * primary that went on without logging would leave its replicas serving
+ * ever older data as if they were up to date, while one that stops before
+ * acknowledging the operation leaves them with everything acknowledged. */
+static void append(oplog_record_t *rec, void const *payload) {
+    if (oplog_fd == -1) {
+        return;
+    }
+    rec->seq = ++last_seq;
+
+    struct iovec iov[2];
+    iov[0].iov_base = rec;
+    iov[0].iov_len = sizeof(*rec);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = rec->len;
+    ssize_t wt = writev(oplog_fd, iov, rec->len > 0 ? 2 : 1);
+    if (wt != (ssize_t)(sizeof(*rec) + rec->len)) {
+        if (wt == -1) {
+            perror("Log write error");
+        }
+        fprintf(stderr, "Primary stopped at log record %lu\n",
+                (unsigned long)rec->seq);
+        exit(1);
+    }
+}
+
+void oplog_open(int handle, int flags, char const *name) {
+    oplog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.opcode = TFS_OP_CODE_OPEN;
+    rec.handle = handle;
+    rec.flags = flags;
+    rec.len = (uint32_t)strlen(name);
+    append(&rec, name);
+}
+
+void oplog_write(int handle, uint64_t offset, void const *buffer,
+                 size_t len) {
+    oplog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.opcode = TFS_OP_CODE_WRITE;
+    rec.handle = handle;
+    rec.offset = offset;
+    rec.len = (uint32_t)len;
+    append(&rec, buffer);
+}
+
+void oplog_close(int handle) {
+    oplog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.opcode = TFS_OP_CODE_CLOSE;
+    rec.handle = handle;
+    append(&rec, NULL);
+}
+
+void oplog_clone(char const *source, char const *dest) {
+    char names[2 * (MAX_FILE_NAME + 1)];
+    size_t source_len = strnlen(source, MAX_FILE_NAME);
+    size_t dest_len = strnlen(dest, MAX_FILE_NAME);
+    memcpy(names, source, source_len);
+    names[source_len] = '\0';
+    memcpy(names + source_len + 1, dest, dest_len);
+    names[source_len + 1 + dest_len] = '\0';
+
+    oplog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.opcode = TFS_OP_CODE_CLONE;
+    rec.handle = -1;
+    rec.len = (uint32_t)(source_len + dest_len + 2);
+    append(&rec, names);
+}
+
+/* Returns the i-node of a replica handle, -1 if none */
+static int handle_inumber(int fh) {
+    open_file_entry_t *file = get_open_file_entry(fh);
+    return file != NULL ? file->of_inumber : -1;
+}
+
+/*
+ * Applies a record (with follow_lock held). Every record is of an operation
+ * that succeeded on the primary, so one that fails here (or refers to a
+ * handle that is not open) means the replica no longer has the primary's
+ * state.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int apply(oplog_record_t const *rec) {
+    if (rec->opcode == TFS_OP_CODE_CLONE) {
+        /* both names are ended by a '\0' (as the primary wrote them) */
+        if (rec->len < 2 || data[rec->len - 1] != '\0') {
+            return -1;
+        }
+        char const *dest = data + strlen(data) + 1;
+        if (dest >= data + rec->len) {
+            return -1;
+        }
+        change_fn(tfs_lookup(dest));
+        return tfs_clone(data, dest);
+    }
+    if (rec->handle < 0 || rec->handle >= MAX_OPEN_FILES) {
+        return -1;
+    }
+    int *fh = &handles[rec->handle];
+
+    switch (rec->opcode) {
+    case TFS_OP_CODE_OPEN: {
+        if (*fh != -1) {
+            return -1;
+        }
+        char name[MAX_FILE_NAME + 1];
+        size_t len = rec->len < MAX_FILE_NAME ? rec->len : MAX_FILE_NAME;
+        memcpy(name, data, len);
+        name[len] = '\0';
+        /* the primary has at most MAX_OPEN_FILES handles, and so has the
+         * replay, whatever the replica's clients hold */
+        *fh = tfs_open_replay(name, rec->flags);
+        if (*fh == -1) {
+            return -1;
+        }
+        if (rec->flags & TFS_O_TRUNC) {
+            change_fn(handle_inumber(*fh));
+        }
+        return 0;
+    }
+    case TFS_OP_CODE_WRITE:
+        if (*fh == -1) {
+            return -1;
+        }
+        change_fn(handle_inumber(*fh));
+        return tfs_pwrite(*fh, data, rec->len, rec->offset) ==
+                       (ssize_t)rec->len
+                   ? 0
+                   : -1;
+    case TFS_OP_CODE_CLOSE: {
+        if (*fh == -1) {
+            return -1;
+        }
+        int ret = tfs_close(*fh);
+        *fh = -1;
+        return ret;
+    }
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Applies every complete record after follow_offset (with follow_lock held).
+ * A partial record is left for the next time. If the log cannot be followed
+ * any further, the process exits.
+ */
+static void catch_up() {
+    uint64_t start = now_ns();
+    while (true) {
+        oplog_record_t rec;
+        ssize_t rd = pread(follow_fd, &rec, sizeof(rec), follow_offset);
+        if (rd == -1) {
+            perror("Log read error");
+            break;
+        }
+        if (rd < (ssize_t)sizeof(rec)) {
+            struct stat st;
+            if (fstat(follow_fd, &st) == -1 || st.st_size < follow_offset) {
+                fprintf(stderr, "The log was truncated: the primary "
+                                "restarted\n");
+                break;
+            }
+            caught_up_ns = start;
+            return;
+        }
+        if (rec.seq != applied_seq + 1) {
+            fprintf(stderr, "Log record %lu after %lu: the primary restarted "
+                            "or the log is corrupt\n",
+                    (unsigned long)rec.seq, (unsigned long)applied_seq);
+            break;
+        }
+        if (rec.len > data_size) {
+            char *grown = realloc(data, rec.len);
+            if (grown == NULL) {
+                break;
+            }
+            data = grown;
+            data_size = rec.len;
+        }
+        rd = pread(follow_fd, data, rec.len,
+                   follow_offset + (off_t)sizeof(rec));
+        if (rd < (ssize_t)rec.len) {
+            caught_up_ns = start;
+            return;
+        }
+
+        if (apply(&rec) == -1) {
+            fprintf(stderr, "Log record %lu could not be applied\n",
+                    (unsigned long)rec.seq);
+            break;
+        }
+        applied_seq = rec.seq;
+        follow_offset += (off_t)(sizeof(rec) + rec.len);
+    }
+
+    /* a replica that cannot follow the log would serve ever older data
+     * while claiming the staleness bound, so it stops */
+    fprintf(stderr, "Replica stopped at log record %lu\n",
+            (unsigned long)applied_seq);
+    exit(1);
+}
+
+static void *follower(void *arg) {
+    (void)arg;
+    struct timespec pause = {0, OPLOG_POLL_NS};
+    while (true) {
+        pthread_mutex_lock(&follow_lock);
+        catch_up();
+        pthread_mutex_unlock(&follow_lock);
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+int oplog_follow(char const *path, uint64_t max_staleness_ns,
+                 oplog_change_t fn) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Open error");
+        return -1;
+    }
+    char magic[sizeof(OPLOG_MAGIC)];
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, OPLOG_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a TecnicoFS log\n", path);
+        close(fd);
+        return -1;
+    }
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        handles[i] = -1;
+    }
+    follow_fd = fd;
+    follow_offset = sizeof(magic);
+    staleness_ns = max_staleness_ns;
+    change_fn = fn;
+
+    catch_up();
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, follower, NULL) != 0) {
+        perror("Thread error");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+bool oplog_following() { return change_fn != NULL; }
+
+void oplog_begin_request() {
+    if (change_fn == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&follow_lock);
+    if (now_ns() - caught_up_ns > staleness_ns) {
+        catch_up();
+    }
+}
+
+void oplog_end_request() {
+    if (change_fn != NULL) {
+        pthread_mutex_unlock(&follow_lock);
+    }
+}
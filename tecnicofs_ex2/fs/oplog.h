@@ -0,0 +1,74 @@
+#ifndef OPLOG_H
+#define OPLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Operation log, for read replicas. A primary (tfs_server -l) appends every
+ * operation that changes its state to the log before acknowledging it:
+ * opens (a later write needs the handle), writes, with the offset they were
+ * done at and their data, closes and clones. Replicas (tfs_server -r) tail the log
+ * and apply it to their own state through operations.c.
+ * The file starts with OPLOG_MAGIC and is followed by one record per
+ * operation, numbered from 1; an open's record is followed by the file name,
+ * a write's by its data and a clone's by both names, each ended by a '\0'.
+ */
+
+#define OPLOG_MAGIC "TFSLOG1"
+
+typedef struct {
+    uint64_t seq;
+    uint64_t offset; /* of a write */
+    int32_t handle;  /* on the primary */
+    int32_t flags;   /* of an open */
+    uint32_t len;    /* bytes that follow */
+    uint8_t opcode;  /* TFS_OP_CODE_OPEN, _WRITE, _CLOSE or _CLONE */
+} oplog_record_t;
+
+/*
+ * Starts logging to a file (created or truncated), as a primary.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int oplog_start(char const *path);
+
+/* Whether the server logs its changes */
+extern int oplog_fd;
+static inline bool oplog_enabled() { return oplog_fd != -1; }
+
+/* Log an operation that succeeded (if the server logs its changes); if it
+ * cannot be logged, the process exits before it is acknowledged */
+void oplog_open(int handle, int flags, char const *name);
+void oplog_write(int handle, uint64_t offset, void const *data, size_t len);
+void oplog_close(int handle);
+void oplog_clone(char const *source, char const *dest);
+
+/* Called by a replica before it changes a file on its own: the i-node
+ * number of the file */
+typedef void (*oplog_change_t)(int inumber);
+
+/*
+ * Follows a primary's log, as a replica: applies what it holds so far and
+ * starts a thread that applies the rest as it comes. Requests see every
+ * change that the primary had acknowledged max_staleness_ns before them
+ * (see oplog_begin_request). A replica that can no longer follow the log
+ * (the primary restarted, the log is corrupt, or a record of it could not be
+ * applied) exits.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int oplog_follow(char const *path, uint64_t max_staleness_ns,
+                 oplog_change_t fn);
+
+/* Whether the server is a replica */
+bool oplog_following();
+
+/*
+ * Bracket the handling of a request by a replica: the log is not applied
+ * in between, and if the last time it was read to its end is older than
+ * the staleness bound, it is read (and applied) now. No-ops elsewhere.
+ */
+void oplog_begin_request();
+void oplog_end_request();
+
+#endif // OPLOG_H
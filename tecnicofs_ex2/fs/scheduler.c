@@ -0,0 +1,190 @@
+#include "scheduler.h"
+#include <stddef.h>
+#include <string.h>
+
+typedef struct {
+    tfs_request_t req;
+    uint32_t id;
+    uint64_t seq; /* arrival order, across sessions */
+} entry_t;
+
+typedef struct {
+    entry_t entries[SCHED_MAX_IN_FLIGHT];
+    bool used[SCHED_MAX_IN_FLIGHT];
+    int order[SCHED_MAX_IN_FLIGHT]; /* the entries in use, oldest first */
+    int n;
+    uint64_t deficit;
+} queue_t;
+
+static queue_t queues[MAX_SESSIONS];
+static int queued;
+static uint64_t arrivals;
+
+static uint32_t quantum = SCHED_DEFAULT_QUANTUM;
+static int max_in_flight = SCHED_DEFAULT_IN_FLIGHT;
+static bool metadata_first;
+
+/* the session being served, and the one that sent the last metadata
+ * request that went first */
+static int current;
+static int metadata_last;
+
+void sched_init(uint32_t q, int in_flight, bool metadata) {
+    memset(queues, 0, sizeof(queues));
+    queued = 0;
+    quantum = q;
+    max_in_flight = in_flight;
+    if (max_in_flight < 1) {
+        max_in_flight = 1;
+    } else if (max_in_flight > SCHED_MAX_IN_FLIGHT) {
+        max_in_flight = SCHED_MAX_IN_FLIGHT;
+    }
+    metadata_first = metadata;
+    current = metadata_last = 0;
+}
+
+bool sched_pending() { return queued > 0; }
+
+bool sched_full(int session) { return queues[session].n >= max_in_flight; }
+
+void sched_push(tfs_request_t const *req, int session, uint32_t id) {
+    queue_t *q = &queues[session];
+    int slot = 0;
+    while (q->used[slot]) {
+        slot++;
+    }
+    entry_t *e = &q->entries[slot];
+    /* only the valid bytes of the request are copied */
+    memcpy(&e->req, req, offsetof(tfs_request_t, buf) + req->len);
+    e->id = id;
+    e->seq = arrivals++;
+    q->used[slot] = true;
+    q->order[q->n++] = slot;
+    queued++;
+}
+
+/* Whether a request reads or writes file contents */
+static bool is_data(tfs_request_t const *req) {
+    switch (req->buf[0]) {
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_SHM_WRITE:
+    case TFS_OP_CODE_SHM_READ:
+    case TFS_OP_CODE_PWRITE:
+    case TFS_OP_CODE_LEASE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Returns what a request costs, in bytes */
+static uint64_t cost(tfs_request_t const *req) {
+    if (req->buf[0] == TFS_OP_CODE_LEASE) {
+        /* the reply carries the whole file */
+        return SCHED_OP_COST + BLOCK_SIZE;
+    }
+    if (!is_data(req) || req->len < 9 + sizeof(size_t)) {
+        return SCHED_OP_COST;
+    }
+    /* the length follows the file handle in every read and write */
+    size_t len;
+    memcpy(&len, req->buf + 9, sizeof(size_t));
+    return SCHED_OP_COST + (len < TFS_MAX_REQUEST ? len : TFS_MAX_REQUEST);
+}
+
+/* Takes the i-th oldest request of a session */
+static void take(int session, int i, tfs_request_t *req, uint32_t *id) {
+    queue_t *q = &queues[session];
+    int slot = q->order[i];
+    entry_t *e = &q->entries[slot];
+    memcpy(req, &e->req, offsetof(tfs_request_t, buf) + e->req.len);
+    *id = e->id;
+    q->used[slot] = false;
+    memmove(&q->order[i], &q->order[i + 1],
+            (size_t)(q->n - i - 1) * sizeof(int));
+    q->n--;
+    queued--;
+    if (q->n == 0) {
+        /* an idle session does not save up */
+        q->deficit = 0;
+    }
+}
+
+/* Takes the oldest request of a session whose oldest request is a metadata
+ * one, going round the sessions.
+ * Returns false if there is none. */
+static bool pop_metadata(tfs_request_t *req, uint32_t *id) {
+    for (int k = 1; k <= MAX_SESSIONS; k++) {
+        int s = (metadata_last + k) % MAX_SESSIONS;
+        queue_t *q = &queues[s];
+        if (q->n > 0 && !is_data(&q->entries[q->order[0]].req)) {
+            take(s, 0, req, id);
+            metadata_last = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Takes the request that arrived first */
+static void pop_oldest(tfs_request_t *req, uint32_t *id) {
+    int session = -1;
+    uint64_t oldest = UINT64_MAX;
+    for (int s = 0; s < MAX_SESSIONS; s++) {
+        queue_t *q = &queues[s];
+        if (q->n > 0 && q->entries[q->order[0]].seq < oldest) {
+            oldest = q->entries[q->order[0]].seq;
+            session = s;
+        }
+    }
+    take(session, 0, req, id);
+}
+
+bool sched_pop(tfs_request_t *req, uint32_t *id) {
+    if (queued == 0) {
+        return false;
+    }
+    if (metadata_first && pop_metadata(req, id)) {
+        return true;
+    }
+    if (quantum == 0) {
+        pop_oldest(req, id);
+        return true;
+    }
+
+    /* deficit round-robin: the current session is served while its
+     * deficit covers its oldest request; the next one with requests then
+     * gets a quantum more */
+    while (true) {
+        queue_t *q = &queues[current];
+        if (q->n > 0) {
+            uint64_t c = cost(&q->entries[q->order[0]].req);
+            if (c <= q->deficit) {
+                q->deficit -= c;
+                take(current, 0, req, id);
+                return true;
+            }
+        }
+        do {
+            current = (current + 1) % MAX_SESSIONS;
+        } while (queues[current].n == 0);
+        queues[current].deficit += quantum;
+    }
+}
+
+void sched_drop_conn(int conn) {
+    for (int s = 0; s < MAX_SESSIONS; s++) {
+        queue_t *q = &queues[s];
+        for (int i = 0; i < q->n;) {
+            entry_t *e = &q->entries[q->order[i]];
+            if (e->req.conn == conn) {
+                tfs_request_t req;
+                uint32_t id;
+                take(s, i, &req, &id);
+            } else {
+                i++;
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "config.h"
+#include "transport.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Scheduling of the requests the server has taken in but not handled yet.
+ * Each session has a queue of at most SCHED_MAX_IN_FLIGHT requests, and
+ * the queues are served by deficit round-robin: a session gets a quantum
+ * of bytes each turn, and a request costs SCHED_OP_COST plus the bytes it
+ * reads or writes, so a session streaming large writes gets no more of the
+ * server than one doing many small operations. Optionally, a session whose
+ * next request is a metadata request (anything but a read or a write) goes
+ * before those whose next request reads or writes.
+ * Only the sessions are interleaved: the requests of a session are handled
+ * in the order they arrived, since a client may send an open, the writes to
+ * its handle and its close without waiting for any of them.
+ * Only the server's request loop calls these functions.
+ */
+
+#define SCHED_MAX_IN_FLIGHT (16)
+#define SCHED_OP_COST (128)
+#define SCHED_DEFAULT_QUANTUM (BLOCK_SIZE + SCHED_OP_COST)
+#define SCHED_DEFAULT_IN_FLIGHT (8)
+
+/*
+ * Sets the quantum (0: requests are handled in the order they arrive), the
+ * most requests of a session that are queued at once (at most
+ * SCHED_MAX_IN_FLIGHT), and whether metadata requests go first
+ */
+void sched_init(uint32_t quantum, int max_in_flight, bool metadata_first);
+
+/* Whether any request is queued */
+bool sched_pending();
+
+/* Whether a session has as many requests queued as it may have */
+bool sched_full(int session);
+
+/* Queues a request of a session (that is not full), with the id it is
+ * traced with */
+void sched_push(tfs_request_t const *req, int session, uint32_t id);
+
+/*
+ * Takes the next request to handle.
+ * Returns false if none is queued.
+ */
+bool sched_pop(tfs_request_t *req, uint32_t *id);
+
+/* Forgets the requests that arrived on a connection (that was closed) */
+void sched_drop_conn(int conn);
+
+#endif // SCHEDULER_H
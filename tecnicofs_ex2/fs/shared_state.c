@@ -0,0 +1,181 @@
+#include "shared_state.h"
+#include "dir_simd.h"
+#include "fragments.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* how many times a reader retries before it gives up (a server that died
+ * in the middle of a change leaves the sequence number odd for good) */
+#define MAX_ATTEMPTS (1 << 20)
+
+struct shared_state {
+    shared_state_header_t const *header;
+    char const *data;
+    size_t size;
+};
+
+shared_state_t *shared_state_attach(char const *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        perror("Shm_open error");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (size_t)st.st_size < sizeof(shared_state_header_t)) {
+        fprintf(stderr, "%s is not a TecnicoFS state\n", name);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Mmap error");
+        return NULL;
+    }
+
+    shared_state_header_t const *header = map;
+    char magic[sizeof(header->magic)];
+    memcpy(magic, header->magic, sizeof(magic));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (memcmp(magic, SHARED_STATE_MAGIC, sizeof(SHARED_STATE_MAGIC)) != 0 ||
+        header->block_size != BLOCK_SIZE ||
+        header->data_blocks != DATA_BLOCKS ||
+        header->inode_table_size != INODE_TABLE_SIZE ||
+        header->fragment_size != FRAGMENT_SIZE ||
+        header->inode_size != sizeof(inode_t) ||
+        header->data_offset + (size_t)BLOCK_SIZE * DATA_BLOCKS > size) {
+        fprintf(stderr, "%s is not ready or was made by a server built with "
+                        "other sizes\n",
+                name);
+        munmap(map, size);
+        return NULL;
+    }
+
+    shared_state_t *state = malloc(sizeof(shared_state_t));
+    if (state == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    dir_simd_init();
+    state->header = header;
+    state->data = (char const *)map + header->data_offset;
+    state->size = size;
+    return state;
+}
+
+void shared_state_detach(shared_state_t *state) {
+    munmap((void *)state->header, state->size);
+    free(state);
+}
+
+/* Waits until the server is not changing the state, and returns the
+ * sequence number to check the copies against */
+static uint64_t read_begin(shared_state_t const *state) {
+    uint64_t seq;
+    while ((seq = __atomic_load_n(&state->header->seq, __ATOMIC_ACQUIRE)) &
+           1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+/* Whether what was copied since read_begin may be inconsistent */
+static bool read_retry(shared_state_t const *state, uint64_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&state->header->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/*
+ * Returns where the contents of a copy of an i-node are, NULL if it cannot
+ * be right (the copy may be torn: it is checked before it is used)
+ */
+static char const *contents(shared_state_t const *state,
+                            inode_t const *inode) {
+    if (inode->i_size > BLOCK_SIZE) {
+        return NULL;
+    }
+    if (inode->i_data_block == -1) {
+        return inode->i_size <= INLINE_DATA_SIZE ? inode->i_inline_data
+                                                 : NULL;
+    }
+    if (inode->i_data_block < 0 || inode->i_data_block >= DATA_BLOCKS) {
+        return NULL;
+    }
+    char const *block =
+        state->data + (size_t)inode->i_data_block * BLOCK_SIZE;
+    if (inode->i_fragment == -1) {
+        return block;
+    }
+    if (inode->i_fragment < 0 || inode->i_fragment >= FRAGMENTS_PER_BLOCK ||
+        (size_t)inode->i_fragment * FRAGMENT_SIZE + inode->i_size >
+            BLOCK_SIZE) {
+        return NULL;
+    }
+    return block + (size_t)inode->i_fragment * FRAGMENT_SIZE;
+}
+
+int shared_state_lookup(shared_state_t *state, char const *name) {
+    if (name == NULL || strlen(name) <= 1 || name[0] != '/') {
+        return -1;
+    }
+    char key[MAX_FILE_NAME];
+    dir_key(key, name + 1);
+    uint8_t tag = dir_tag(key);
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        uint64_t seq = read_begin(state);
+        inode_t root = state->header->inodes[ROOT_DIR_INUM];
+        int inumber = -1;
+        if (root.i_node_type == T_DIRECTORY && root.i_data_block >= 0 &&
+            root.i_data_block < DATA_BLOCKS) {
+            dir_block_t const *dir =
+                (dir_block_t const *)(state->data +
+                                      (size_t)root.i_data_block * BLOCK_SIZE);
+            int i = dir_lookup(dir, key, tag);
+            if (i != -1) {
+                inumber = dir->d_entries[i].d_inumber;
+            }
+        }
+        if (!read_retry(state, seq)) {
+            return inumber >= 0 && inumber < INODE_TABLE_SIZE ? inumber : -1;
+        }
+    }
+    return -1;
+}
+
+ssize_t shared_state_read(shared_state_t *state, int inumber, void *buffer,
+                          size_t len, size_t offset) {
+    if (inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        uint64_t seq = read_begin(state);
+        inode_t inode = state->header->inodes[inumber];
+        char const *data = contents(state, &inode);
+        size_t to_read = 0;
+        if (data != NULL && offset < inode.i_size) {
+            to_read = inode.i_size - offset;
+            if (to_read > len) {
+                to_read = len;
+            }
+            memcpy(buffer, data + offset, to_read);
+        }
+        if (!read_retry(state, seq)) {
+            if (data == NULL || inode.i_node_type != T_FILE) {
+                return -1;
+            }
+            return (ssize_t)to_read;
+        }
+    }
+    return -1;
+}
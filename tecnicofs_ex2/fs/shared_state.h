@@ -0,0 +1,64 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+#include "state.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The FS state in a named POSIX shared memory segment (tfs_server -S name),
+ * which trusted processes on the same host can map read-only to look up
+ * and read files without a round trip to the server.
+ * The server remains the only writer. Its changes are bracketed by a
+ * seqlock (see state_change_begin): a reader copies what it needs and
+ * retries if the sequence number was odd or changed meanwhile, so readers
+ * never write to the segment and can never hold the server up.
+ * The segment holds this header, with the i-node table, and then, at
+ * data_offset (page aligned), the data blocks.
+ */
+
+#define SHARED_STATE_MAGIC "TFSSHM1"
+
+typedef struct {
+    char magic[8]; /* set last, once the segment is ready */
+    /* the geometry the server was built with, which readers must share */
+    uint32_t block_size;
+    uint32_t data_blocks;
+    uint32_t inode_table_size;
+    uint32_t fragment_size;
+    uint32_t inode_size;
+    uint32_t data_offset;
+    /* odd while the server changes the state */
+    _Alignas(64) uint64_t seq;
+    _Alignas(64) inode_t inodes[INODE_TABLE_SIZE];
+} shared_state_header_t;
+
+/* A read-only mapping of a server's state */
+typedef struct shared_state shared_state_t;
+
+/*
+ * Maps the state of a server started with -S name, read-only.
+ * Returns the mapping, NULL if it fails (e.g. the server was built with
+ * other sizes).
+ */
+shared_state_t *shared_state_attach(char const *name);
+
+void shared_state_detach(shared_state_t *state);
+
+/*
+ * Looks for a file, like tfs_lookup.
+ * Returns its i-node number, -1 if it does not exist.
+ */
+int shared_state_lookup(shared_state_t *state, char const *name);
+
+/*
+ * Reads up to len bytes of a file, from an offset, like tfs_pread; the
+ * bytes come from one consistent version of the file.
+ * Returns the number of bytes read, -1 in case of error.
+ */
+ssize_t shared_state_read(shared_state_t *state, int inumber, void *buffer,
+                          size_t len, size_t offset);
+
+#endif // SHARED_STATE_H
@@ -0,0 +1,205 @@
+#include "snapshot.h"
+#include "common/common.h"
+#include "dir_simd.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef enum {
+    SNAPSHOT_FREE,
+    SNAPSHOT_LIVE,
+    SNAPSHOT_DELETED, /* its blocks are still to be freed */
+} snapshot_state_t;
+
+typedef struct {
+    snapshot_state_t state;
+    int open; /* files open in it */
+    bool taken[INODE_TABLE_SIZE];
+    inode_t inodes[INODE_TABLE_SIZE];
+} snapshot_t;
+
+static snapshot_t snapshots[MAX_SNAPSHOTS];
+
+/* protects the states and the open counts, which the reclaimer reads */
+static pthread_mutex_t snapshots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+/* frees the blocks of deleted snapshots (started by the first delete) */
+static pthread_t reclaimer;
+static bool reclaimer_started;
+static bool reclaimer_stop;
+static bool reclaiming;
+
+static inline bool valid_id(int id) { return id >= 0 && id < MAX_SNAPSHOTS; }
+
+/* Returns a deleted snapshot with no file open, -1 if none (lock held) */
+static int reclaimable() {
+    for (int id = 0; id < MAX_SNAPSHOTS; id++) {
+        if (snapshots[id].state == SNAPSHOT_DELETED &&
+            snapshots[id].open == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+static void *reclaim(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&snapshots_lock);
+    while (!reclaimer_stop) {
+        int id = reclaimable();
+        if (id == -1) {
+            pthread_cond_wait(&reclaim_cond, &snapshots_lock);
+            continue;
+        }
+        /* the live FS goes on meanwhile: the references are atomic */
+        reclaiming = true;
+        pthread_mutex_unlock(&snapshots_lock);
+        state_unfreeze(snapshots[id].taken, snapshots[id].inodes);
+        pthread_mutex_lock(&snapshots_lock);
+        snapshots[id].state = SNAPSHOT_FREE;
+        reclaiming = false;
+        pthread_cond_broadcast(&reclaim_cond);
+    }
+    pthread_mutex_unlock(&snapshots_lock);
+    return NULL;
+}
+
+int snapshot_create() {
+    pthread_mutex_lock(&snapshots_lock);
+    int id = 0;
+    while (id < MAX_SNAPSHOTS && snapshots[id].state != SNAPSHOT_FREE) {
+        id++;
+    }
+    if (id == MAX_SNAPSHOTS) {
+        pthread_mutex_unlock(&snapshots_lock);
+        return -1;
+    }
+    state_freeze(snapshots[id].taken, snapshots[id].inodes);
+    snapshots[id].state = SNAPSHOT_LIVE;
+    snapshots[id].open = 0;
+    pthread_mutex_unlock(&snapshots_lock);
+    return id;
+}
+
+int snapshot_delete(int id) {
+    pthread_mutex_lock(&snapshots_lock);
+    if (!valid_id(id) || snapshots[id].state != SNAPSHOT_LIVE) {
+        pthread_mutex_unlock(&snapshots_lock);
+        return -1;
+    }
+    if (!reclaimer_started) {
+        if (pthread_create(&reclaimer, NULL, reclaim, NULL) != 0) {
+            perror("Thread error");
+            pthread_mutex_unlock(&snapshots_lock);
+            return -1;
+        }
+        reclaimer_started = true;
+    }
+    snapshots[id].state = SNAPSHOT_DELETED;
+    pthread_cond_broadcast(&reclaim_cond);
+    pthread_mutex_unlock(&snapshots_lock);
+    return 0;
+}
+
+int snapshot_path(char const *path, char const **name) {
+    size_t prefix = strlen(TFS_SNAPSHOT_PREFIX);
+    if (path == NULL || strncmp(path, TFS_SNAPSHOT_PREFIX, prefix) != 0) {
+        return -1;
+    }
+    char const *c = path + prefix;
+    int id = 0;
+    if (*c < '0' || *c > '9') {
+        return -1;
+    }
+    while (*c >= '0' && *c <= '9' && id < MAX_SNAPSHOTS) {
+        id = id * 10 + (*c++ - '0');
+    }
+    if (!valid_id(id) || *c != '/' || c[1] == '\0') {
+        return -1;
+    }
+    *name = c + 1;
+    return id;
+}
+
+int snapshot_lookup(int id, char const *name) {
+    inode_t *root = snapshot_inode(id, ROOT_DIR_INUM);
+    if (root == NULL || root->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+    dir_block_t const *dir = data_block_get(root->i_data_block);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    char key[MAX_FILE_NAME];
+    dir_key(key, name);
+    int i = dir_lookup(dir, key, dir_tag(key));
+    return i == -1 ? -1 : dir->d_entries[i].d_inumber;
+}
+
+inode_t *snapshot_inode(int id, int inumber) {
+    if (!valid_id(id) || inumber < 0 || inumber >= INODE_TABLE_SIZE) {
+        return NULL;
+    }
+    pthread_mutex_lock(&snapshots_lock);
+    snapshot_t *s = &snapshots[id];
+    bool readable = s->state == SNAPSHOT_LIVE ||
+                    (s->state == SNAPSHOT_DELETED && s->open > 0);
+    pthread_mutex_unlock(&snapshots_lock);
+    return readable && s->taken[inumber] ? &s->inodes[inumber] : NULL;
+}
+
+int snapshot_open(int id) {
+    int ret = -1;
+    pthread_mutex_lock(&snapshots_lock);
+    if (valid_id(id) && snapshots[id].state == SNAPSHOT_LIVE) {
+        snapshots[id].open++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&snapshots_lock);
+    return ret;
+}
+
+void snapshot_close(int id) {
+    pthread_mutex_lock(&snapshots_lock);
+    if (valid_id(id) && snapshots[id].open > 0 &&
+        --snapshots[id].open == 0 &&
+        snapshots[id].state == SNAPSHOT_DELETED) {
+        pthread_cond_broadcast(&reclaim_cond);
+    }
+    pthread_mutex_unlock(&snapshots_lock);
+}
+
+void snapshots_wait() {
+    pthread_mutex_lock(&snapshots_lock);
+    while (reclaiming || (reclaimer_started && reclaimable() != -1)) {
+        pthread_cond_wait(&reclaim_cond, &snapshots_lock);
+    }
+    pthread_mutex_unlock(&snapshots_lock);
+}
+
+void snapshots_reset() {
+    pthread_mutex_lock(&snapshots_lock);
+    while (reclaiming) {
+        pthread_cond_wait(&reclaim_cond, &snapshots_lock);
+    }
+    for (int id = 0; id < MAX_SNAPSHOTS; id++) {
+        snapshots[id].state = SNAPSHOT_FREE;
+        snapshots[id].open = 0;
+    }
+    pthread_mutex_unlock(&snapshots_lock);
+}
+
+void snapshots_destroy() {
+    pthread_mutex_lock(&snapshots_lock);
+    bool started = reclaimer_started;
+    reclaimer_stop = true;
+    pthread_cond_broadcast(&reclaim_cond);
+    pthread_mutex_unlock(&snapshots_lock);
+    if (started) {
+        pthread_join(reclaimer, NULL);
+    }
+    reclaimer_started = false;
+    reclaimer_stop = false;
+    snapshots_reset();
+}
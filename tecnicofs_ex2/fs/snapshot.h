@@ -0,0 +1,62 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "state.h"
+
+/*
+ * Snapshots: read-only views of the FS as it was when they were taken.
+ * A snapshot is a copy of the i-node table; the blocks (including the root
+ * directory's) stay shared with the live FS, which copies a block before
+ * changing it in place (see state_freeze and data_block_unshare). The files
+ * of snapshot id are opened as TFS_SNAPSHOT_PREFIX "<id>/<name>".
+ * A deleted snapshot is gone at once, but the blocks only it had are freed
+ * by a thread of its own, once the files opened in it are closed.
+ * Only FS operations (with the FS lock held) call these functions.
+ */
+
+/*
+ * Takes a snapshot of the live FS, in O(INODE_TABLE_SIZE).
+ * Returns its id, -1 if there are MAX_SNAPSHOTS already.
+ */
+int snapshot_create();
+
+/*
+ * Deletes a snapshot (its blocks are freed in the background).
+ * Returns 0 if successful, -1 if there is no such snapshot.
+ */
+int snapshot_delete(int id);
+
+/*
+ * Parses the path of a file in a snapshot.
+ * Returns the snapshot's id, and sets *name to the file's name within it
+ * (without the '/'), -1 if it is not such a path.
+ */
+int snapshot_path(char const *path, char const **name);
+
+/* Returns the i-number of a file of a snapshot, -1 if it has none */
+int snapshot_lookup(int id, char const *name);
+
+/* Returns an i-node of a snapshot that is open (or not deleted yet), NULL
+ * if it has none */
+inode_t *snapshot_inode(int id, int inumber);
+
+/*
+ * Account for the files open in a snapshot, which keep its blocks from
+ * being freed. snapshot_open returns 0, or -1 if it was deleted.
+ */
+int snapshot_open(int id);
+void snapshot_close(int id);
+
+/* Waits until the blocks of the deleted snapshots with no file open are
+ * freed */
+void snapshots_wait();
+
+/* Forgets every snapshot without freeing its blocks (before the state is
+ * replaced by state_init) */
+void snapshots_reset();
+
+/* Stops the thread that frees the blocks of deleted snapshots (before the
+ * state is destroyed) */
+void snapshots_destroy();
+
+#endif // SNAPSHOT_H
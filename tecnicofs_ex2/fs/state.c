@@ -1,349 +1,1183 @@
-#include "state.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-
-/* Persistent FS state  (in reality, it should be maintained in secondary
- * memory; for simplicity, this project maintains it in primary memory) */
-
-/* I-node table */
-static inode_t inode_table[INODE_TABLE_SIZE];
-static char freeinode_ts[INODE_TABLE_SIZE];
-
-/* Data blocks */
-static char fs_data[BLOCK_SIZE * DATA_BLOCKS];
-static char free_blocks[DATA_BLOCKS];
-
-/* Volatile FS state */
-
-static open_file_entry_t open_file_table[MAX_OPEN_FILES];
-static char free_open_file_entries[MAX_OPEN_FILES];
-
-static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
-}
-
-static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
-}
-
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
-}
-
-/**
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
- *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
- *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
- */
-static void touch_all_memory() { __asm volatile("" : : : "memory"); }
-
-/*
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
- */
-static void insert_delay() {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
-    }
-}
-
-/*
- * Initializes FS state
- */
-void state_init() {
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-    }
-
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
-    }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
-    }
-}
-
-void state_destroy() { /* nothing to do */
-}
-
-/*
- * Creates a new i-node in the i-node table.
- * Input:
- *  - n_type: the type of the node (file or directory)
- * Returns:
- *  new i-node's number if successfully created, -1 otherwise
- */
-int inode_create(inode_type n_type) {
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * (int)sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-
-        /* Finds first free entry in i-node table */
-        if (freeinode_ts[inumber] == FREE) {
-            /* Found a free entry, so takes it for the new i-node*/
-            freeinode_ts[inumber] = TAKEN;
-            insert_delay(); // simulate storage access delay (to i-node)
-            inode_table[inumber].i_node_type = n_type;
-
-            if (n_type == T_DIRECTORY) {
-                /* Initializes directory (filling its block with empty
-                 * entries, labeled with inumber==-1) */
-                int b = data_block_alloc();
-                if (b == -1) {
-                    freeinode_ts[inumber] = FREE;
-                    return -1;
-                }
-
-                inode_table[inumber].i_size = BLOCK_SIZE;
-                inode_table[inumber].i_data_block = b;
-
-                dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-                if (dir_entry == NULL) {
-                    freeinode_ts[inumber] = FREE;
-                    return -1;
-                }
-
-                for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    dir_entry[i].d_inumber = -1;
-                }
-            } else {
-                /* In case of a new file, simply sets its size to 0 */
-                inode_table[inumber].i_size = 0;
-                inode_table[inumber].i_data_block = -1;
-            }
-            return inumber;
-        }
-    }
-    return -1;
-}
-
-/*
- * Deletes the i-node.
- * Input:
- *  - inumber: i-node's number
- * Returns: 0 if successful, -1 if failed
- */
-int inode_delete(int inumber) {
-    // simulate storage access delay (to i-node and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
-    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE) {
-        return -1;
-    }
-
-    freeinode_ts[inumber] = FREE;
-
-    if (inode_table[inumber].i_size > 0) {
-        if (data_block_free(inode_table[inumber].i_data_block) == -1) {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-/*
- * Returns a pointer to an existing i-node.
- * Input:
- *  - inumber: identifier of the i-node
- * Returns: pointer if successful, NULL if failed
- */
-inode_t *inode_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node
-    return &inode_table[inumber];
-}
-
-/*
- * Adds an entry to the i-node directory data.
- * Input:
- *  - inumber: identifier of the i-node
- *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry
- * Returns: SUCCESS or FAIL
- */
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
-    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    if (strlen(sub_name) == 0) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_block);
-    if (dir_entry == NULL) {
-        return -1;
-    }
-
-    /* Finds and fills the first empty entry */
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
-            return 0;
-        }
-    }
-
-    return -1;
-}
-
-/* Looks for a given name inside a directory
- * Input:
- * 	- parent directory's i-node number
- * 	- name to search
- * 	Returns i-number linked to the target name, -1 if not found
- */
-int find_in_dir(int inumber, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (!valid_inumber(inumber) ||
-        inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_block);
-    if (dir_entry == NULL) {
-        return -1;
-    }
-
-    /* Iterates over the directory entries looking for one that has the target
-     * name */
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            return dir_entry[i].d_inumber;
-        }
-
-    return -1;
-}
-
-/*
- * Allocated a new data block
- * Returns: block index if successful, -1 otherwise
- */
-int data_block_alloc() {
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        if (i * (int)sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
-
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            return i;
-        }
-    }
-    return -1;
-}
-
-/* Frees a data block
- * Input
- * 	- the block index
- * Returns: 0 if success, -1 otherwise
- */
-int data_block_free(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to free_blocks
-    free_blocks[block_number] = FREE;
-    return 0;
-}
-
-/* Returns a pointer to the contents of a given block
- * Input:
- * 	- Block's index
- * Returns: pointer to the first byte of the block, NULL otherwise
- */
-void *data_block_get(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data[block_number * BLOCK_SIZE];
-}
-
-/* Add new entry to the open file table
- * Inputs:
- * 	- I-node number of the file to open
- * 	- Initial offset
- * Returns: file handle if successful, -1 otherwise
- */
-int add_to_open_file_table(int inumber, size_t offset) {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            return i;
-        }
-    }
-    return -1;
-}
-
-/* Frees an entry from the open file table
- * Inputs:
- * 	- file handle to free/close
- * Returns 0 is success, -1 otherwise
- */
-int remove_from_open_file_table(int fhandle) {
-    if (!valid_file_handle(fhandle) ||
-        free_open_file_entries[fhandle] != TAKEN) {
-        return -1;
-    }
-    free_open_file_entries[fhandle] = FREE;
-    return 0;
-}
-
-/* Returns pointer to a given entry in the open file table
- * Inputs:
- * 	 - file handle
- * Returns: pointer to the entry if sucessful, NULL otherwise
- */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return NULL;
-    }
-    return &open_file_table[fhandle];
-}
-
-int files_opened() {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if(free_open_file_entries[i] == TAKEN) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
+#define _GNU_SOURCE /* MAP_HUGETLB, MADV_HUGEPAGE */
+#include "state.h"
+#include "counters.h"
+#include "dir_simd.h"
+#include "fragments.h"
+#include "magazine.h"
+#include "shared_state.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Persistent FS state  (in reality, it should be maintained in secondary
+ * memory; for simplicity, this project maintains it in primary memory) */
+
+/* I-node table (in the shared segment, if there is one) */
+static inode_t private_inode_table[INODE_TABLE_SIZE];
+static inode_t *inode_table = private_inode_table;
+static char freeinode_ts[INODE_TABLE_SIZE];
+
+/* Data blocks: an anonymous mapping, so that memory is only committed
+ * for the blocks that are written (page aligned, so that blocks can be
+ * spliced into pipes) */
+static char *fs_data;
+static size_t fs_data_size;
+static char free_blocks[DATA_BLOCKS];
+/* references to each taken block: one per file of the live FS that has it
+ * as its own block (a fragment block, one in all, see fragments.c), plus
+ * one per i-node of a snapshot that has it (see state_freeze); a shared
+ * block is never changed in place (see data_block_unshare) */
+static uint16_t block_refs[DATA_BLOCKS];
+
+/* whether the data blocks are mapped with huge pages if possible */
+static bool huge_pages = true;
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/*
+ * The memory of free blocks is given back to the system in units of a
+ * (huge) page, once every block in the unit is free. Units that become free
+ * are only released in batches, so that a block that is freed and
+ * allocated again does not cost a system call and a page fault each time.
+ */
+typedef struct {
+    uint32_t taken; /* blocks, | UNIT_RELEASING while being released */
+    bool dirty;     /* may hold committed memory */
+} release_unit_t;
+
+#define UNIT_RELEASING (1u << 31)
+
+#define RELEASE_BATCH (16)
+
+static release_unit_t *release_units; /* NULL if blocks are never released */
+static size_t release_size;
+static int blocks_per_unit;
+static int pending_units[RELEASE_BATCH];
+static int n_pending;
+/* MADV_REMOVE for the shared segment, whose pages MADV_DONTNEED would
+ * only unmap */
+static int release_advice = MADV_DONTNEED;
+
+/* The shared segment (see shared_state.h), NULL if the state is private */
+static char const *shared_name;
+static shared_state_header_t *shared;
+static size_t shared_size;
+
+/*
+ * Snapshot being saved by a checkpoint, if any (see state_snapshot_begin):
+ * the blocks that were taken when it began and that it has not read yet,
+ * and the contents they had then, for those that changed since
+ */
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool snapshot_active;
+static bool snapshot_failed;
+static bool snapshot_pending[DATA_BLOCKS];
+static char *snapshot_copies[DATA_BLOCKS];
+
+/* Volatile FS state */
+
+/* the entries after the first MAX_OPEN_FILES are kept for the replay of a
+ * primary's log (see add_to_replay_open_file_table) */
+#define OPEN_FILE_TABLE_SIZE (MAX_OPEN_FILES + REPLAY_OPEN_FILES)
+static open_file_entry_t open_file_table[OPEN_FILE_TABLE_SIZE];
+static char free_open_file_entries[OPEN_FILE_TABLE_SIZE];
+
+/* whether accesses to persistent state are delayed (see insert_delay) */
+static bool storage_delay = true;
+
+_Static_assert(sizeof(dir_block_t) <= BLOCK_SIZE,
+               "a directory must fit in a block");
+/* every i-node of the live FS and of each snapshot may have a block (a
+ * checkpoint takes no references, see state_snapshot_begin) */
+_Static_assert((long)INODE_TABLE_SIZE * (MAX_SNAPSHOTS + 1) <= UINT16_MAX,
+               "block_refs must hold a reference from every i-node");
+
+static inline bool valid_inumber(int inumber) {
+    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
+}
+
+static inline bool valid_block_number(int block_number) {
+    return block_number >= 0 && block_number < DATA_BLOCKS;
+}
+
+static inline bool valid_file_handle(int file_handle) {
+    return file_handle >= 0 && file_handle < OPEN_FILE_TABLE_SIZE;
+}
+
+/*
+ * I-nodes and blocks are allocated from per-thread magazines (see
+ * magazine.h), so that most allocations and frees neither scan nor write
+ * the shared tables. A magazine is refilled with a batch of free entries
+ * (which become RESERVED in the table) when it is empty, and half of it is
+ * flushed back when it is full. When the table has no free entry left, the
+ * magazines of every thread are drained into it first.
+ */
+typedef struct thread_cache {
+    magazine_t inodes;
+    magazine_t blocks;
+    struct thread_cache *next;
+} thread_cache_t;
+
+typedef struct {
+    char *states; /* allocation_state_t of each entry */
+    int size;
+    size_t magazine; /* offset in thread_cache_t */
+} pool_t;
+
+static pool_t inode_pool = {freeinode_ts, INODE_TABLE_SIZE,
+                            offsetof(thread_cache_t, inodes)};
+static pool_t block_pool = {free_blocks, DATA_BLOCKS,
+                            offsetof(thread_cache_t, blocks)};
+
+/* protects the tables' free entries and the list of caches */
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_cache_t *caches;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local thread_cache_t *local_cache;
+
+/**
+ * We need to defeat the optimizer for the insert_delay() function.
+ * Under optimization, the empty loop would be completely optimized away.
+ * This function tells the compiler that the assembly code being run (which is
+ * none) might potentially change *all memory in the process*.
+ *
+ * This prevents the optimizer from optimizing this code away, because it does
+ * not know what it does and it may have side effects.
+ *
+ * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ *
+ * Exercise: try removing this function and look at the assembly generated to
+ * compare.
+ */
+static void touch_all_memory() { __asm volatile("" : : : "memory"); }
+
+/*
+ * Auxiliary function to insert a delay.
+ * Used in accesses to persistent FS state as a way of emulating access
+ * latencies as if such data structures were really stored in secondary memory.
+ */
+static void insert_delay() {
+    if (!storage_delay) {
+        return;
+    }
+    uint64_t t = trace_begin();
+    counter_add(&counters_local()->storage_accesses, 1);
+    for (int i = 0; i < DELAY; i++) {
+        touch_all_memory();
+    }
+    trace_end(TRACE_STORAGE, t);
+}
+
+static inline void set_state(pool_t *pool, int entry, char state) {
+    __atomic_store_n(&pool->states[entry], state, __ATOMIC_RELAXED);
+}
+
+static inline char get_state(pool_t const *pool, int entry) {
+    return __atomic_load_n(&pool->states[entry], __ATOMIC_RELAXED);
+}
+
+static inline magazine_t *pool_magazine(pool_t const *pool,
+                                        thread_cache_t *cache) {
+    return (magazine_t *)((char *)cache + pool->magazine);
+}
+
+/*
+ * Marks up to max free entries of a table with a state, lowest first
+ * (alloc_lock held).
+ * Returns how many were marked.
+ */
+static int pool_scan(pool_t *pool, int *entries, int max, char state) {
+    int n = 0;
+    for (int i = 0; i < pool->size && n < max; i++) {
+        if (i * (int)sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to the table
+        }
+        if (get_state(pool, i) == FREE) {
+            set_state(pool, i, state);
+            entries[n++] = i;
+        }
+    }
+    return n;
+}
+
+/* Frees table entries (alloc_lock held) */
+static void pool_release(pool_t *pool, int const *entries, int n) {
+    for (int i = 0; i < n; i++) {
+        set_state(pool, entries[i], FREE);
+    }
+}
+
+/* Gives the contents of every magazine back to the tables (alloc_lock
+ * held) */
+static void drain_magazines() {
+    int entries[MAGAZINE_SIZE];
+    for (thread_cache_t *c = caches; c != NULL; c = c->next) {
+        pool_release(&inode_pool, entries, magazine_steal(&c->inodes, entries));
+        pool_release(&block_pool, entries, magazine_steal(&c->blocks, entries));
+    }
+}
+
+static void cache_destroy(void *arg) {
+    thread_cache_t *cache = arg;
+    pthread_mutex_lock(&alloc_lock);
+    int entries[MAGAZINE_SIZE];
+    pool_release(&inode_pool, entries, magazine_steal(&cache->inodes, entries));
+    pool_release(&block_pool, entries, magazine_steal(&cache->blocks, entries));
+    for (thread_cache_t **c = &caches; *c != NULL; c = &(*c)->next) {
+        if (*c == cache) {
+            *c = cache->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    free(cache);
+}
+
+static void cache_key_create() { pthread_key_create(&cache_key, cache_destroy); }
+
+/*
+ * Returns the calling thread's magazines (registered on first use, and
+ * drained when the thread exits), NULL if they cannot be allocated
+ */
+static thread_cache_t *cache_local() {
+    if (local_cache != NULL) {
+        return local_cache;
+    }
+    thread_cache_t *cache = aligned_alloc(64, sizeof(thread_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(thread_cache_t));
+    pthread_once(&cache_key_once, cache_key_create);
+    pthread_setspecific(cache_key, cache);
+
+    pthread_mutex_lock(&alloc_lock);
+    cache->next = caches;
+    caches = cache;
+    pthread_mutex_unlock(&alloc_lock);
+    local_cache = cache;
+    return cache;
+}
+
+/*
+ * Allocates an entry of a table.
+ * Returns its number, -1 if there is no free entry.
+ */
+static int pool_take(pool_t *pool) {
+    thread_cache_t *cache = cache_local();
+    magazine_t *m = cache != NULL ? pool_magazine(pool, cache) : NULL;
+    int entry;
+
+    if (m == NULL || !magazine_pop(m, &entry)) {
+        int entries[MAGAZINE_BATCH];
+        int want = m != NULL ? MAGAZINE_BATCH : 1;
+
+        pthread_mutex_lock(&alloc_lock);
+        int n = pool_scan(pool, entries, want, RESERVED);
+        if (n == 0) {
+            /* (nearly) full: the free entries may be in magazines */
+            drain_magazines();
+            n = pool_scan(pool, entries, want, RESERVED);
+        }
+        pthread_mutex_unlock(&alloc_lock);
+        if (n == 0) {
+            return -1;
+        }
+
+        /* the lowest entry is used first */
+        entry = entries[0];
+        for (int i = n - 1; i > 0; i--) {
+            magazine_push(m, entries[i]);
+        }
+    }
+
+    set_state(pool, entry, TAKEN);
+    return entry;
+}
+
+/* Frees an entry of a table */
+static void pool_put(pool_t *pool, int entry) {
+    thread_cache_t *cache = cache_local();
+    magazine_t *m = cache != NULL ? pool_magazine(pool, cache) : NULL;
+
+    set_state(pool, entry, RESERVED);
+    if (m != NULL && magazine_push(m, entry)) {
+        return;
+    }
+
+    /* full: half of the magazine goes back to the table */
+    int entries[MAGAZINE_BATCH + 1];
+    int n = 0;
+    while (m != NULL && n < MAGAZINE_BATCH && magazine_pop(m, &entries[n])) {
+        n++;
+    }
+    entries[n++] = entry;
+    pthread_mutex_lock(&alloc_lock);
+    pool_release(pool, entries, n);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+static size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+/* Sets up the release of free blocks in units of a given size */
+static void release_init(size_t unit) {
+    /* units must be made of whole blocks */
+    release_size = 0;
+    if (unit % BLOCK_SIZE == 0) {
+        release_size = unit;
+    } else if (BLOCK_SIZE % unit == 0) {
+        release_size = BLOCK_SIZE;
+    }
+    if (release_size > 0) {
+        blocks_per_unit = (int)(release_size / BLOCK_SIZE);
+        size_t n_units = (DATA_BLOCKS + (size_t)blocks_per_unit - 1) /
+                         (size_t)blocks_per_unit;
+        release_units = calloc(n_units, sizeof(release_unit_t));
+    }
+}
+
+/*
+ * Creates the shared segment (replacing one left by an earlier server of
+ * the same name) and places the i-node table and the data blocks in it.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int shared_map() {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t data_offset = round_up(sizeof(shared_state_header_t), page);
+    size_t size = data_offset + round_up((size_t)BLOCK_SIZE * DATA_BLOCKS,
+                                         page);
+
+    /* readers that mapped an earlier segment keep it, unchanged */
+    shm_unlink(shared_name);
+    int fd = shm_open(shared_name, O_RDWR | O_CREAT | O_EXCL, 0640);
+    if (fd == -1) {
+        perror("Shm_open error");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) == -1) {
+        perror("Ftruncate error");
+        close(fd);
+        shm_unlink(shared_name);
+        return -1;
+    }
+    void *map =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Mmap error");
+        shm_unlink(shared_name);
+        return -1;
+    }
+
+    shared = map;
+    shared_size = size;
+    shared->block_size = BLOCK_SIZE;
+    shared->data_blocks = DATA_BLOCKS;
+    shared->inode_table_size = INODE_TABLE_SIZE;
+    shared->fragment_size = FRAGMENT_SIZE;
+    shared->inode_size = sizeof(inode_t);
+    shared->data_offset = (uint32_t)data_offset;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shared->magic, SHARED_STATE_MAGIC, sizeof(SHARED_STATE_MAGIC));
+
+    inode_table = shared->inodes;
+    fs_data = (char *)map + data_offset;
+    fs_data_size = size - data_offset;
+    release_advice = MADV_REMOVE;
+    release_init(page);
+    return 0;
+}
+
+/*
+ * Maps the data blocks: with MAP_HUGETLB if huge pages are reserved, or
+ * else with transparent huge pages (2 MiB aligned) if the region is large
+ * enough for them.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int data_map() {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)BLOCK_SIZE * DATA_BLOCKS;
+    bool huge = huge_pages && size >= HUGE_PAGE_SIZE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+    size_t unit = page;
+    char *data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge) {
+        /* reserved up front: without the reservation (MAP_NORESERVE), a
+         * fault with no huge page left would kill the process */
+        data = mmap(NULL, round_up(size, HUGE_PAGE_SIZE),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            size = round_up(size, HUGE_PAGE_SIZE);
+            unit = HUGE_PAGE_SIZE;
+        }
+    }
+#endif
+    if (data == MAP_FAILED) {
+        /* maps more than needed and trims it to the alignment */
+        size_t align = huge ? HUGE_PAGE_SIZE : page;
+        size = round_up(size, page);
+        char *raw = mmap(NULL, size + align - page, PROT_READ | PROT_WRITE,
+                         flags, -1, 0);
+        if (raw == MAP_FAILED) {
+            perror("Mmap error");
+            return -1;
+        }
+        data = (char *)round_up((size_t)raw, align);
+        if (data > raw) {
+            munmap(raw, (size_t)(data - raw));
+        }
+        if (data + size < raw + size + align - page) {
+            munmap(data + size, (size_t)(raw + align - page - data));
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge && madvise(data, size, MADV_HUGEPAGE) == 0) {
+            unit = HUGE_PAGE_SIZE;
+        }
+#endif
+    }
+    fs_data = data;
+    fs_data_size = size;
+    release_advice = MADV_DONTNEED;
+    release_init(unit);
+    return 0;
+}
+
+/*
+ * Gives back the memory of the units that became free and still are
+ * (alloc_lock held). A block allocated from a unit while it is being
+ * released waits for the release to end (see unit_take).
+ */
+static void release_pending_units() {
+    for (int i = 0; i < n_pending; i++) {
+        release_unit_t *unit = &release_units[pending_units[i]];
+        uint32_t free_unit = 0;
+        if (!__atomic_load_n(&unit->dirty, __ATOMIC_RELAXED) ||
+            !__atomic_compare_exchange_n(&unit->taken, &free_unit,
+                                         UNIT_RELEASING, false,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED)) {
+            continue;
+        }
+        madvise(fs_data + (size_t)pending_units[i] * release_size,
+                release_size, release_advice);
+        __atomic_store_n(&unit->dirty, false, __ATOMIC_RELAXED);
+        __atomic_fetch_and(&unit->taken, ~UNIT_RELEASING, __ATOMIC_RELEASE);
+    }
+    n_pending = 0;
+}
+
+/* Accounts for a block allocated from its unit */
+static void unit_take(int block_number) {
+    if (release_units == NULL) {
+        return;
+    }
+    release_unit_t *unit = &release_units[block_number / blocks_per_unit];
+    uint32_t taken = __atomic_fetch_add(&unit->taken, 1, __ATOMIC_ACQUIRE);
+    while (taken & UNIT_RELEASING) {
+        taken = __atomic_load_n(&unit->taken, __ATOMIC_ACQUIRE);
+    }
+    __atomic_store_n(&unit->dirty, true, __ATOMIC_RELAXED);
+}
+
+/* Accounts for a block freed from its unit, releasing free units in
+ * batches */
+static void unit_put(int block_number) {
+    if (release_units == NULL) {
+        return;
+    }
+    int u = block_number / blocks_per_unit;
+    if (__atomic_sub_fetch(&release_units[u].taken, 1, __ATOMIC_RELEASE) ==
+        0) {
+        pthread_mutex_lock(&alloc_lock);
+        pending_units[n_pending++] = u;
+        if (n_pending == RELEASE_BATCH) {
+            release_pending_units();
+        }
+        pthread_mutex_unlock(&alloc_lock);
+    }
+}
+
+/*
+ * Initializes FS state
+ * Returns 0 if successful, -1 otherwise.
+ */
+int state_init() {
+    /* entries left in magazines (e.g. by a previous state_init) are stale */
+    pthread_mutex_lock(&alloc_lock);
+    drain_magazines();
+    pthread_mutex_unlock(&alloc_lock);
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        freeinode_ts[i] = FREE;
+    }
+
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        free_blocks[i] = FREE;
+        block_refs[i] = 0;
+    }
+
+    for (size_t i = 0; i < OPEN_FILE_TABLE_SIZE; i++) {
+        free_open_file_entries[i] = FREE;
+    }
+
+    dir_simd_init();
+    fragments_init();
+
+    /* an existing mapping is reused, emptied */
+    n_pending = 0;
+    if (fs_data != NULL) {
+        madvise(fs_data, fs_data_size, release_advice);
+        if (release_units != NULL) {
+            size_t n_units = (DATA_BLOCKS + (size_t)blocks_per_unit - 1) /
+                             (size_t)blocks_per_unit;
+            memset(release_units, 0, n_units * sizeof(release_unit_t));
+        }
+        return 0;
+    }
+    return shared_name != NULL ? shared_map() : data_map();
+}
+
+void state_destroy() {
+    pthread_mutex_lock(&alloc_lock);
+    drain_magazines();
+    pthread_mutex_unlock(&alloc_lock);
+
+    if (shared != NULL) {
+        munmap(shared, shared_size);
+        shm_unlink(shared_name);
+        shared = NULL;
+        inode_table = private_inode_table;
+    } else if (fs_data != NULL) {
+        munmap(fs_data, fs_data_size);
+    }
+    fs_data = NULL;
+    free(release_units);
+    release_units = NULL;
+}
+
+/*
+ * Turns the emulation of storage access latencies on or off
+ * (it is on by default)
+ */
+void state_set_storage_delay(bool enabled) { storage_delay = enabled; }
+
+/*
+ * Chooses whether the data blocks are mapped with huge pages, when the
+ * region is large enough (it is by default); only applies to the first
+ * state_init after a state_destroy
+ */
+void state_set_huge_pages(bool enabled) { huge_pages = enabled; }
+
+/*
+ * Places the state in the shared memory segment of a given name (see
+ * shared_state.h) rather than in private memory; only applies to the first
+ * state_init after a state_destroy
+ */
+void state_set_shared(char const *name) { shared_name = name; }
+
+/*
+ * Bracket a change to the i-node table or the data blocks, so that readers
+ * of the shared segment retry rather than see it half done. Changes must
+ * not overlap (the callers hold the FS lock). No-ops if the state is
+ * private.
+ */
+void state_change_begin() {
+    if (shared == NULL) {
+        return;
+    }
+    uint64_t seq = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shared->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void state_change_end() {
+    if (shared == NULL) {
+        return;
+    }
+    uint64_t seq = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shared->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Creates a new i-node in the i-node table.
+ * Input:
+ *  - n_type: the type of the node (file or directory)
+ * Returns:
+ *  new i-node's number if successfully created, -1 otherwise
+ */
+int inode_create(inode_type n_type) {
+    /* Takes a free entry in i-node table (from the magazine, which may have
+     * to be refilled from freeinode_ts) */
+    int inumber = pool_take(&inode_pool);
+    if (inumber == -1) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay (to i-node)
+    inode_table[inumber].i_node_type = n_type;
+
+    if (n_type == T_DIRECTORY) {
+        /* Initializes directory (filling its block with empty
+         * entries, labeled with inumber==-1 and an empty tag) */
+        int b = data_block_alloc();
+        if (b == -1) {
+            pool_put(&inode_pool, inumber);
+            return -1;
+        }
+
+        inode_table[inumber].i_size = BLOCK_SIZE;
+        inode_table[inumber].i_data_block = b;
+        inode_table[inumber].i_fragment = -1;
+
+        dir_block_t *dir = (dir_block_t *)data_block_get(b);
+        if (dir == NULL) {
+            pool_put(&inode_pool, inumber);
+            return -1;
+        }
+
+        memset(dir->d_tags, DIR_TAG_EMPTY, sizeof(dir->d_tags));
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            dir->d_entries[i].d_inumber = -1;
+        }
+    } else {
+        /* In case of a new file, simply sets its size to 0 */
+        inode_table[inumber].i_size = 0;
+        inode_table[inumber].i_data_block = -1;
+        inode_table[inumber].i_fragment = -1;
+        inode_table[inumber].i_fragments = 0;
+    }
+    return inumber;
+}
+
+/*
+ * Deletes the i-node.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_delete(int inumber) {
+    // simulate storage access delay (to i-node and freeinode_ts)
+    insert_delay();
+    insert_delay();
+
+    if (!valid_inumber(inumber) || get_state(&inode_pool, inumber) != TAKEN) {
+        return -1;
+    }
+
+    /* the i-node may be reused (by any thread) as soon as it is put back */
+    int ret = inode_data_free(&inode_table[inumber]);
+    pool_put(&inode_pool, inumber);
+    return ret;
+}
+
+/*
+ * Returns a pointer to an existing i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: pointer if successful, NULL if failed
+ */
+inode_t *inode_get(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node
+    return &inode_table[inumber];
+}
+
+/*
+ * Returns the block of a directory that is about to change, which is first
+ * copied if a snapshot shares it (see data_block_unshare); NULL if there is
+ * no free block for the copy
+ */
+static dir_block_t *dir_unshare(inode_t *dir) {
+    if (data_block_unshare(&dir->i_data_block) == -1) {
+        return NULL;
+    }
+    return (dir_block_t *)&fs_data[(size_t)dir->i_data_block * BLOCK_SIZE];
+}
+
+/*
+ * Adds an entry to the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
+    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    if (strlen(sub_name) == 0) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_block_t *dir =
+        (dir_block_t *)data_block_get(inode_table[inumber].i_data_block);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    /* Finds and fills the first empty entry (strncpy zero-pads the name) */
+    int i = dir_free_entry(dir);
+    if (i == -1) {
+        return -1;
+    }
+    dir = dir_unshare(&inode_table[inumber]);
+    if (dir == NULL) {
+        return -1;
+    }
+    data_block_cow(inode_table[inumber].i_data_block);
+    dir_entry_t *entry = &dir->d_entries[i];
+    entry->d_inumber = sub_inumber;
+    strncpy(entry->d_name, sub_name, MAX_FILE_NAME - 1);
+    entry->d_name[MAX_FILE_NAME - 1] = 0;
+    dir->d_tags[i] = dir_tag(entry->d_name);
+    return 0;
+}
+
+/*
+ * Removes an entry from the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int clear_dir_entry(int inumber, int sub_inumber) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (!valid_inumber(inumber) ||
+        inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_block_t *dir =
+        (dir_block_t *)data_block_get(inode_table[inumber].i_data_block);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    /* Finds and empties the entry of the sub i-node */
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir->d_tags[i] != DIR_TAG_EMPTY &&
+            dir->d_entries[i].d_inumber == sub_inumber) {
+            dir = dir_unshare(&inode_table[inumber]);
+            if (dir == NULL) {
+                return -1;
+            }
+            data_block_cow(inode_table[inumber].i_data_block);
+            dir->d_tags[i] = DIR_TAG_EMPTY;
+            dir->d_entries[i].d_inumber = -1;
+            memset(dir->d_entries[i].d_name, 0, MAX_FILE_NAME);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Looks for a given name inside a directory
+ * Input:
+ * 	- parent directory's i-node number
+ * 	- name to search
+ * 	Returns i-number linked to the target name, -1 if not found
+ */
+int find_in_dir(int inumber, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (!valid_inumber(inumber) ||
+        inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_block_t *dir =
+        (dir_block_t *)data_block_get(inode_table[inumber].i_data_block);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    /* Looks for the entries whose tag is the target name's, and compares
+     * only their names with it */
+    char key[MAX_FILE_NAME];
+    dir_key(key, sub_name);
+    int i = dir_lookup(dir, key, dir_tag(key));
+    return i == -1 ? -1 : dir->d_entries[i].d_inumber;
+}
+
+/*
+ * Allocated a new data block
+ * Returns: block index if successful, -1 otherwise
+ */
+int data_block_alloc() {
+    int block_number = pool_take(&block_pool);
+    if (block_number != -1) {
+        __atomic_store_n(&block_refs[block_number], 1, __ATOMIC_RELAXED);
+        unit_take(block_number);
+    }
+    return block_number;
+}
+
+/* Frees a data block (once no snapshot has it either)
+ * Input
+ * 	- the block index
+ * Returns: 0 if success, -1 otherwise
+ */
+int data_block_free(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+    if (get_state(&block_pool, block_number) != TAKEN) {
+        return -1;
+    }
+    /* snapshots drop their references from another thread (see
+     * state_unfreeze) */
+    if (__atomic_sub_fetch(&block_refs[block_number], 1, __ATOMIC_ACQ_REL) >
+        0) {
+        return 0;
+    }
+    /* its memory may be given back, or reused by another file */
+    data_block_cow(block_number);
+    unit_put(block_number);
+    pool_put(&block_pool, block_number);
+    return 0;
+}
+
+/* Returns a pointer to the contents of a given block
+ * Input:
+ * 	- Block's index
+ * Returns: pointer to the first byte of the block, NULL otherwise
+ */
+void *data_block_get(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to block
+    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+}
+
+/* Takes one more reference to a block, for a snapshot or a clone */
+void data_block_share(int block_number) {
+    if (valid_block_number(block_number)) {
+        __atomic_add_fetch(&block_refs[block_number], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Whether a snapshot or a clone shares a block with a file of the live FS */
+bool data_block_shared(int block_number) {
+    return valid_block_number(block_number) &&
+           __atomic_load_n(&block_refs[block_number], __ATOMIC_ACQUIRE) > 1;
+}
+
+/*
+ * Called before a whole block of the live FS is changed in place: if a
+ * snapshot or a clone shares it, its contents are copied to a new block,
+ * which takes its place in *block_number (the others keep the old one).
+ * Returns 0 if successful, -1 if there is no free block for the copy.
+ */
+int data_block_unshare(int *block_number) {
+    if (!data_block_shared(*block_number)) {
+        return 0;
+    }
+    int copy = data_block_alloc();
+    if (copy == -1) {
+        return -1;
+    }
+    insert_delay(); // simulate storage access delay to both blocks
+    memcpy(&fs_data[(size_t)copy * BLOCK_SIZE],
+           &fs_data[(size_t)*block_number * BLOCK_SIZE], BLOCK_SIZE);
+    data_block_free(*block_number);
+    *block_number = copy;
+    return 0;
+}
+
+/*
+ * Freezes the live FS for a snapshot (with the FS lock held): copies the
+ * i-node table and the allocation state of every i-node into the arrays
+ * given, and takes a reference to the block of every i-node that has one,
+ * so that its contents stay as they are. Costs O(INODE_TABLE_SIZE): no
+ * block is copied until the live FS changes it.
+ */
+void state_freeze(bool *inode_taken, inode_t *inodes) {
+    memcpy(inodes, inode_table, INODE_TABLE_SIZE * sizeof(inode_t));
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        inode_taken[i] = get_state(&inode_pool, i) == TAKEN;
+        if (inode_taken[i] && valid_block_number(inodes[i].i_data_block)) {
+            data_block_share(inodes[i].i_data_block);
+        }
+    }
+}
+
+/*
+ * Drops the references of a snapshot taken by state_freeze, freeing the
+ * blocks that nothing else has. May be called from any thread, while the
+ * live FS goes on changing.
+ */
+void state_unfreeze(bool const *inode_taken, inode_t const *inodes) {
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (inode_taken[i]) {
+            data_block_free(inodes[i].i_data_block);
+        }
+    }
+}
+
+/*
+ * Called before a block is changed in place, or freed: if a checkpoint
+ * still needs the block's contents, they are copied first
+ */
+void data_block_cow(int block_number) {
+    if (!__atomic_load_n(&snapshot_active, __ATOMIC_ACQUIRE) ||
+        !valid_block_number(block_number)) {
+        return;
+    }
+    pthread_mutex_lock(&snapshot_lock);
+    if (snapshot_pending[block_number] &&
+        snapshot_copies[block_number] == NULL) {
+        char *copy = malloc(BLOCK_SIZE);
+        if (copy == NULL) {
+            snapshot_failed = true;
+        } else {
+            memcpy(copy, &fs_data[(size_t)block_number * BLOCK_SIZE],
+                   BLOCK_SIZE);
+            snapshot_copies[block_number] = copy;
+        }
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+/*
+ * Starts a snapshot of the persistent state (with the FS lock held, so that
+ * no change is under way): copies the i-node table and the allocation
+ * state of every i-node (taken or not) into the arrays given, and the
+ * numbers of the blocks of the taken i-nodes, in increasing order, into
+ * blocks.
+ * The contents of those blocks are then read with state_snapshot_block,
+ * from any thread, while the FS goes on changing: a block changed before it
+ * is read is copied first (see data_block_cow).
+ * Returns the number of blocks, -1 if a snapshot is already under way.
+ */
+int state_snapshot_begin(bool *inode_taken, inode_t *inodes, int *blocks) {
+    pthread_mutex_lock(&snapshot_lock);
+    if (snapshot_active) {
+        pthread_mutex_unlock(&snapshot_lock);
+        return -1;
+    }
+    /* the blocks of the live i-nodes (not those only snapshots have) */
+    memcpy(inodes, inode_table, INODE_TABLE_SIZE * sizeof(inode_t));
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        inode_taken[i] = get_state(&inode_pool, i) == TAKEN;
+        if (inode_taken[i] && valid_block_number(inodes[i].i_data_block)) {
+            snapshot_pending[inodes[i].i_data_block] = true;
+        }
+    }
+    int n = 0;
+    for (int b = 0; b < DATA_BLOCKS; b++) {
+        if (snapshot_pending[b]) {
+            blocks[n++] = b;
+        }
+    }
+    snapshot_failed = false;
+    __atomic_store_n(&snapshot_active, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&snapshot_lock);
+    return n;
+}
+
+/* Copies the contents a block of the snapshot had when it began (once per
+ * block) */
+void state_snapshot_block(int block_number, void *to) {
+    pthread_mutex_lock(&snapshot_lock);
+    char *copy = snapshot_copies[block_number];
+    if (copy != NULL) {
+        memcpy(to, copy, BLOCK_SIZE);
+        free(copy);
+        snapshot_copies[block_number] = NULL;
+    } else {
+        memcpy(to, &fs_data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE);
+    }
+    snapshot_pending[block_number] = false;
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+/*
+ * Ends the snapshot, dropping the copies it did not read.
+ * Returns 0 if every block it read had the contents of the snapshot, -1
+ * if a copy could not be made.
+ */
+int state_snapshot_end() {
+    pthread_mutex_lock(&snapshot_lock);
+    __atomic_store_n(&snapshot_active, false, __ATOMIC_RELEASE);
+    for (int b = 0; b < DATA_BLOCKS; b++) {
+        free(snapshot_copies[b]);
+        snapshot_copies[b] = NULL;
+        snapshot_pending[b] = false;
+    }
+    int r = snapshot_failed ? -1 : 0;
+    pthread_mutex_unlock(&snapshot_lock);
+    return r;
+}
+
+/*
+ * Replaces the state with one saved by a snapshot: the i-nodes that are
+ * taken (as given by inode_taken, with the contents in inodes) and the
+ * blocks given, whose contents the caller then fills in (through
+ * data_block_get). The open file table is emptied.
+ * Returns 0 if successful, -1 otherwise (the state is then empty).
+ */
+int state_restore(bool const *inode_taken, inode_t const *inodes,
+                  int const *blocks, int n_blocks) {
+    if (state_init() == -1) {
+        return -1;
+    }
+    for (int b = 0; b < n_blocks; b++) {
+        if (!valid_block_number(blocks[b]) ||
+            get_state(&block_pool, blocks[b]) == TAKEN) {
+            state_init();
+            return -1;
+        }
+        /* referenced below by the i-nodes that have them */
+        set_state(&block_pool, blocks[b], TAKEN);
+        block_refs[blocks[b]] = 0;
+        unit_take(blocks[b]);
+    }
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (!inode_taken[i]) {
+            continue;
+        }
+        inode_table[i] = inodes[i];
+        set_state(&inode_pool, i, TAKEN);
+        /* a directory's block is read as a dir_block_t, so only one that
+         * has a whole block of its own is one */
+        bool directory = inodes[i].i_node_type == T_DIRECTORY;
+        if ((!directory && inodes[i].i_node_type != T_FILE) ||
+            (directory != (i == ROOT_DIR_INUM)) ||
+            (directory && (inodes[i].i_data_block == -1 ||
+                           inodes[i].i_fragment != -1))) {
+            state_init();
+            return -1;
+        }
+        if (inodes[i].i_data_block != -1 &&
+            (!valid_block_number(inodes[i].i_data_block) ||
+             get_state(&block_pool, inodes[i].i_data_block) != TAKEN)) {
+            state_init();
+            return -1;
+        }
+        /* the size must fit where the contents are, or reads would go past
+         * them */
+        if (inodes[i].i_size > BLOCK_SIZE ||
+            (inodes[i].i_data_block == -1 &&
+             inodes[i].i_size > INLINE_DATA_SIZE)) {
+            state_init();
+            return -1;
+        }
+        if (inodes[i].i_fragment != -1) {
+            if (inodes[i].i_data_block == -1 || inodes[i].i_fragment < 0 ||
+                inodes[i].i_fragments <= 0 ||
+                inodes[i].i_fragment + inodes[i].i_fragments >
+                    FRAGMENTS_PER_BLOCK ||
+                inodes[i].i_size >
+                    (size_t)inodes[i].i_fragments * FRAGMENT_SIZE) {
+                state_init();
+                return -1;
+            }
+            fragments_take(&inode_table[i]);
+        } else if (inodes[i].i_data_block != -1) {
+            data_block_share(inodes[i].i_data_block);
+        }
+    }
+    /* a block no i-node has would never be freed */
+    for (int b = 0; b < n_blocks; b++) {
+        if (block_refs[blocks[b]] == 0) {
+            state_init();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Takes the first free entry in [first, last) */
+static int add_open_file(int first, int last, int inumber, size_t offset) {
+    for (int i = first; i < last; i++) {
+        if (free_open_file_entries[i] == FREE) {
+            free_open_file_entries[i] = TAKEN;
+            open_file_table[i].of_inumber = inumber;
+            open_file_table[i].of_offset = offset;
+            open_file_table[i].of_snapshot = -1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Add new entry to the open file table
+ * Inputs:
+ * 	- I-node number of the file to open
+ * 	- Initial offset
+ * Returns: file handle if successful, -1 otherwise
+ */
+int add_to_open_file_table(int inumber, size_t offset) {
+    return add_open_file(0, MAX_OPEN_FILES, inumber, offset);
+}
+
+/* Same, in one of the entries kept for the replay of a primary's log */
+int add_to_replay_open_file_table(int inumber, size_t offset) {
+    return add_open_file(MAX_OPEN_FILES, OPEN_FILE_TABLE_SIZE, inumber,
+                         offset);
+}
+
+/* Frees an entry from the open file table
+ * Inputs:
+ * 	- file handle to free/close
+ * Returns 0 is success, -1 otherwise
+ */
+int remove_from_open_file_table(int fhandle) {
+    if (!valid_file_handle(fhandle) ||
+        free_open_file_entries[fhandle] != TAKEN) {
+        return -1;
+    }
+    free_open_file_entries[fhandle] = FREE;
+    return 0;
+}
+
+/* Returns pointer to a given entry in the open file table
+ * Inputs:
+ * 	 - file handle
+ * Returns: pointer to the entry if sucessful, NULL otherwise
+ */
+open_file_entry_t *get_open_file_entry(int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return NULL;
+    }
+    return &open_file_table[fhandle];
+}
+
+/* Whether a file is open (the handles of a log's replay do not count) */
+int files_opened() {
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if(free_open_file_entries[i] == TAKEN) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
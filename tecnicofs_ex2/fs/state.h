@@ -1,62 +1,105 @@
-#ifndef STATE_H
-#define STATE_H
-
-#include "config.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-
-/*
- * Directory entry
- */
-typedef struct {
-    char d_name[MAX_FILE_NAME];
-    int d_inumber;
-} dir_entry_t;
-
-typedef enum { T_FILE, T_DIRECTORY } inode_type;
-
-/*
- * I-node
- */
-typedef struct {
-    inode_type i_node_type;
-    size_t i_size;
-    int i_data_block;
-    /* in a real FS, more fields would exist here */
-} inode_t;
-
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
-
-/*
- * Open file entry (in open file table)
- */
-typedef struct {
-    int of_inumber;
-    size_t of_offset;
-} open_file_entry_t;
-
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
-
-void state_init();
-void state_destroy();
-
-int inode_create(inode_type n_type);
-int inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-int clear_dir_entry(int inumber, int sub_inumber);
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
-int find_in_dir(int inumber, char const *sub_name);
-
-int data_block_alloc();
-int data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-int remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
-int files_opened();
-
-#endif // STATE_H
+#ifndef STATE_H
+#define STATE_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/*
+ * Directory entry (the name is zero-padded to MAX_FILE_NAME bytes)
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} dir_entry_t;
+
+/*
+ * Directory block: one tag byte per entry (DIR_TAG_EMPTY, or a hash of the
+ * entry's name, see dir_tag), followed by the entries. Lookups compare the
+ * tags of many entries at once and only compare the names of the entries
+ * whose tag matches. The tags are padded to a multiple of 32 bytes.
+ */
+#define DIR_TAG_EMPTY (0)
+#define DIR_TAGS_SIZE                                                         \
+    ((BLOCK_SIZE / (sizeof(dir_entry_t) + 1) + 31) / 32 * 32)
+#define MAX_DIR_ENTRIES ((BLOCK_SIZE - DIR_TAGS_SIZE) / sizeof(dir_entry_t))
+
+typedef struct {
+    uint8_t d_tags[DIR_TAGS_SIZE];
+    dir_entry_t d_entries[MAX_DIR_ENTRIES];
+} dir_block_t;
+
+typedef enum { T_FILE, T_DIRECTORY } inode_type;
+
+/*
+ * I-node
+ */
+typedef struct {
+    inode_type i_node_type;
+    size_t i_size;
+    /* -1 while a file's contents fit in i_inline_data */
+    int i_data_block;
+    /* a small file's first fragment of i_data_block (-1 if it has the
+     * whole block), and how many it has (see fragments.h) */
+    int i_fragment;
+    int i_fragments;
+    char i_inline_data[INLINE_DATA_SIZE];
+    /* in a real FS, more fields would exist here */
+} inode_t;
+
+/* RESERVED: free, but cached in a thread's magazine (see state.c) */
+typedef enum { FREE = 0, TAKEN = 1, RESERVED = 2 } allocation_state_t;
+
+/*
+ * Open file entry (in open file table)
+ */
+typedef struct {
+    int of_inumber;
+    size_t of_offset;
+    int of_snapshot; /* the snapshot the file is in, -1 for the live FS */
+} open_file_entry_t;
+
+int state_init();
+void state_destroy();
+void state_set_storage_delay(bool enabled);
+void state_set_huge_pages(bool enabled);
+void state_set_shared(char const *name);
+void state_change_begin();
+void state_change_end();
+
+int inode_create(inode_type n_type);
+int inode_delete(int inumber);
+inode_t *inode_get(int inumber);
+
+int clear_dir_entry(int inumber, int sub_inumber);
+int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
+int find_in_dir(int inumber, char const *sub_name);
+
+int data_block_alloc();
+int data_block_free(int block_number);
+void *data_block_get(int block_number);
+void data_block_share(int block_number);
+bool data_block_shared(int block_number);
+int data_block_unshare(int *block_number);
+void data_block_cow(int block_number);
+
+void state_freeze(bool *inode_taken, inode_t *inodes);
+void state_unfreeze(bool const *inode_taken, inode_t const *inodes);
+
+int state_snapshot_begin(bool *inode_taken, inode_t *inodes, int *blocks);
+void state_snapshot_block(int block_number, void *to);
+int state_snapshot_end();
+int state_restore(bool const *inode_taken, inode_t const *inodes,
+                  int const *blocks, int n_blocks);
+
+int add_to_open_file_table(int inumber, size_t offset);
+int add_to_replay_open_file_table(int inumber, size_t offset);
+int remove_from_open_file_table(int fhandle);
+open_file_entry_t *get_open_file_entry(int fhandle);
+int files_opened();
+
+#endif // STATE_H
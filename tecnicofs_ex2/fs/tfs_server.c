@@ -1,260 +1,1033 @@
+#define _GNU_SOURCE /* vmsplice */
+#include "capture.h"
+#include "counters.h"
+#include "lease.h"
+#include "lockprof.h"
+#include "oplog.h"
 #include "operations.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "transport.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
-int fserv, fcli;
-char buffer[BLOCK_SIZE];
-int id;
-//int sessions[S];
+/*
+ * Client session
+ */
+typedef struct {
+    bool active;
+    int fcli; /* reply channel */
+    bool fcli_is_pipe;
+    /* shared-memory arena (NULL if not negotiated) */
+    char *shm_arena;
+    size_t shm_arena_size;
+    /* where lease revocations are sent (-1 if the session does not cache) */
+    int fcb;
+} session_t;
 
-int s_mount(char tfs_op_code);
-int s_unmount();
-int s_open(char tfs_op_code);
-int s_close(char tfs_op_code);
-int s_write(char tfs_op_code);
-int s_read(char tfs_op_code);
-int s_shutdown();
+static session_t sessions[MAX_SESSIONS];
+static transport_t *transport;
+
+/* reads of at least this many bytes are answered straight from the file's
+ * block instead of going through a copy in the server */
+#define DIRECT_READ_MIN (4096)
+/* whether direct reads to a pipe splice the block pages (-z) */
+static bool zerocopy;
+static size_t page_size;
+
+/* bytes sent in reply to the request being handled (for the statistics) */
+static _Thread_local uint64_t reply_bytes;
+/* status at the start of that reply (for the capture) */
+static _Thread_local int64_t reply_result;
+/* tag of the request being handled, echoed in its reply */
+static _Thread_local tfs_tag_t reply_tag;
+
+int s_mount(tfs_request_t const *req);
+int s_unmount(session_t *session);
+int s_open(session_t *session, tfs_request_t const *req);
+int s_close(session_t *session, tfs_request_t const *req);
+int s_write(session_t *session, tfs_request_t const *req);
+int s_read(session_t *session, tfs_request_t const *req);
+int s_shutdown(session_t *session);
+int s_shm_attach(session_t *session, tfs_request_t const *req);
+int s_shm_write(session_t *session, tfs_request_t const *req);
+int s_shm_read(session_t *session, tfs_request_t const *req);
+int s_stats(session_t *session);
+int s_trace(session_t *session, tfs_request_t const *req);
+int s_lock_profile(session_t *session);
+int s_callback(session_t *session, tfs_request_t const *req);
+int s_lease(session_t *session, tfs_request_t const *req);
+int s_pwrite(session_t *session, tfs_request_t const *req);
+int s_checkpoint(session_t *session, tfs_request_t const *req);
+int s_snapshot(session_t *session, tfs_request_t const *req);
+int s_clone(session_t *session, tfs_request_t const *req);
+
+_Static_assert(BLOCK_SIZE <= TFS_LEASE_DATA_MAX,
+               "a lease must carry the whole file");
+
+static void end_session(session_t *session);
+static void handle_request(tfs_request_t const *req);
+static void handle_next();
+static void handle_disconnect(int conn);
+static int request_session(tfs_request_t const *req);
+static void send_revocation(int session, int inumber);
 
 int main(int argc, char **argv) {
-    char opcode;
+    bool use_socket = false;
+    int opt;
 
-    if (argc < 2) {
-        printf("Please specify the pathname of the server's pipe.\n");
+    char const *capture_path = NULL;
+    char const *log_path = NULL;
+    char const *primary_log = NULL;
+    char const *shared_name = NULL;
+    long max_staleness_ms = 10;
+    long quantum = SCHED_DEFAULT_QUANTUM;
+    int in_flight = SCHED_DEFAULT_IN_FLIGHT;
+    bool metadata_first = false;
+    char const *checkpoint_path = NULL;
+    while ((opt = getopt(argc, argv, "t:zc:l:r:m:S:q:i:pk:")) != -1) {
+        if (opt == 'z') {
+            zerocopy = true;
+        } else if (opt == 'c') {
+            capture_path = optarg;
+        } else if (opt == 'l') {
+            log_path = optarg;
+        } else if (opt == 'r') {
+            primary_log = optarg;
+        } else if (opt == 'm') {
+            max_staleness_ms = atol(optarg);
+        } else if (opt == 'S') {
+            shared_name = optarg;
+        } else if (opt == 'q') {
+            quantum = atol(optarg);
+        } else if (opt == 'i') {
+            in_flight = atoi(optarg);
+        } else if (opt == 'p') {
+            metadata_first = true;
+        } else if (opt == 'k') {
+            checkpoint_path = optarg;
+        } else if (opt == 't' && strcmp(optarg, "socket") == 0) {
+            use_socket = true;
+        } else if (opt != 't' || strcmp(optarg, "fifo") != 0) {
+            optind = argc;
+            break;
+        }
+    }
+    if (optind >= argc || (log_path != NULL && primary_log != NULL) ||
+        max_staleness_ms < 0 || quantum < 0 || quantum > UINT32_MAX ||
+        in_flight < 1 || in_flight > SCHED_MAX_IN_FLIGHT) {
+        printf("Please specify the pathname of the server's pipe.\n"
+               "Usage: %s [-t fifo|socket] [-z] [-c capture_path]\n"
+               "       [-l log_path | -r primary_log_path "
+               "[-m max_staleness_ms]] [-S shm_name]\n"
+               "       [-q quantum_bytes] [-i max_in_flight] [-p]\n"
+               "       [-k checkpoint_path] path\n",
+               argv[0]);
         return 1;
     }
 
-    char *pipename = argv[1];
-    printf("Starting TecnicoFS server with pipe called %s\n", pipename);
+    char *pipename = argv[optind];
+    printf("Starting TecnicoFS server with %s called %s\n",
+           use_socket ? "socket" : "pipe", pipename);
 
-    tfs_init();
+    /* a client that goes away must not take the server with it */
+    signal(SIGPIPE, SIG_IGN);
 
-    unlink(pipename);
+    char const *trace = getenv("TFS_TRACE");
+    if (trace != NULL && strcmp(trace, "1") == 0) {
+        trace_set_enabled(true);
+    }
 
-    if (mkfifo(pipename, 0644) == -1) {
-        perror("Mkfifo error");
+    if (capture_path != NULL && capture_start(capture_path) == -1) {
         return 1;
     }
-    if ((fserv = open(pipename, O_RDONLY)) == -1) {
-        perror("Open error");
-        return -1;
+
+    /* with -S, co-located processes can read the state directly (see
+     * fs/shared_state.h) */
+    if (shared_name != NULL) {
+        state_set_shared(shared_name);
+    }
+    if (tfs_init() == -1) {
+        return 1;
+    }
+    /* -k: the files of a checkpoint (see tools/tfs_checkpoint), if there is
+     * one */
+    if (checkpoint_path != NULL && access(checkpoint_path, F_OK) == 0) {
+        int files = tfs_restore(checkpoint_path);
+        if (files == -1) {
+            return 1;
+        }
+        printf("Restored %d files from %s\n", files, checkpoint_path);
+    }
+    lease_init(send_revocation);
+
+    /* a primary logs its changes for its replicas; a replica only serves
+     * reads, of the state it rebuilds from the primary's log */
+    if (log_path != NULL && oplog_start(log_path) == -1) {
+        return 1;
+    }
+    if (primary_log != NULL &&
+        oplog_follow(primary_log, (uint64_t)max_staleness_ms * 1000000,
+                     lease_revoke_all) == -1) {
+        return 1;
+    }
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    /* -q 0: requests are handled in the order they arrive */
+    sched_init((uint32_t)quantum, in_flight, metadata_first);
+
+    transport = use_socket ? socket_transport_create(pipename)
+                           : fifo_transport_create(pipename);
+    if (transport == NULL) {
+        return 1;
     }
 
+    /* requests are taken in for as long as they keep coming, so that the
+     * scheduler chooses among all of them, and one is handled whenever
+     * none is waiting */
+    static tfs_request_t req;
+    uint32_t request_id = 0;
     while (true) {
-        memcpy(&opcode, buffer, sizeof(char));
-        ssize_t rd = read(fserv, &opcode, sizeof(opcode));
-        if (rd == -1) {
-            perror("Read error");
+        trace_set_request(++request_id);
+        int r = transport->recv(transport, &req, !sched_pending());
+        if (r == 2) {
+            handle_next();
+            continue;
         }
-        if (rd == 0) {
-            fserv = open(pipename, O_RDONLY);
+        if (r == -1) {
+            continue;
+        }
+        if (r == 1) {
+            sched_drop_conn(req.conn);
+            oplog_begin_request();
+            handle_disconnect(req.conn);
+            oplog_end_request();
             continue;
         }
 
-        if (opcode == TFS_OP_CODE_MOUNT) {
-            s_mount(opcode);
-        } else if (opcode == TFS_OP_CODE_UNMOUNT) {
-            s_unmount();
-        } else if (opcode == TFS_OP_CODE_OPEN) {
-            s_open(opcode);
-        } else if (opcode == TFS_OP_CODE_CLOSE) {
-            s_close(opcode);
-        } else if (opcode == TFS_OP_CODE_WRITE) {
-            s_write(opcode);
-        } else if (opcode == TFS_OP_CODE_READ) {
-            s_read(opcode);
-        } else if (opcode == TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED) {
-            s_shutdown();
+        /* mounts belong to no session yet */
+        int session = request_session(&req);
+        if (session == -1) {
+            handle_request(&req);
+            continue;
+        }
+        /* a session with too many requests queued holds up the intake
+         * (and so its client) until one of them is handled */
+        while (sched_full(session)) {
+            handle_next();
         }
+        sched_push(&req, session, request_id);
     }
 
-    close(fserv);
-    unlink(pipename);
+    transport->destroy(transport);
     return 0;
 }
 
-int s_mount(char opcode) {
-    char client_pipe_path[40];
-    id = 1;
-    memcpy(buffer, &opcode, sizeof(char));
+/*
+ * Returns the session a request belongs to, NULL if it is not valid
+ */
+static session_t *get_session(tfs_request_t const *req) {
+    int session_id;
+    if (req->len < 1 + sizeof(int)) {
+        return NULL;
+    }
+    memcpy(&session_id, req->buf + 1, sizeof(int));
+    if (session_id < 0 || session_id >= MAX_SESSIONS ||
+        !sessions[session_id].active) {
+        return NULL;
+    }
+    /* connection-oriented transports also tie sessions to connections */
+    if (req->conn != -1 && sessions[session_id].fcli != req->conn) {
+        return NULL;
+    }
+    return &sessions[session_id];
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
 
-    if (read(fserv, buffer + 1, sizeof(char) * 40) == -1) {
-        perror("Read error");
-        return -1;
+static void dispatch_request(tfs_request_t const *req) {
+    char opcode = req->buf[0];
+
+    if (opcode == TFS_OP_CODE_MOUNT) {
+        s_mount(req);
+        return;
     }
-    memcpy(client_pipe_path, buffer + 1, sizeof(client_pipe_path));
 
-    if ((fcli = open(client_pipe_path, O_WRONLY)) == -1) {
-        perror("Open error");
-        return -1;
+    session_t *session = get_session(req);
+    if (session == NULL) {
+        fprintf(stderr, "Request %d for an invalid session\n", opcode);
+        return;
     }
-    if (write(fcli, &id, sizeof(int)) == -1) {
-        perror("Write error");
-        return -1;
+
+    switch (opcode) {
+    case TFS_OP_CODE_UNMOUNT:
+        s_unmount(session);
+        break;
+    case TFS_OP_CODE_OPEN:
+        s_open(session, req);
+        break;
+    case TFS_OP_CODE_CLOSE:
+        s_close(session, req);
+        break;
+    case TFS_OP_CODE_WRITE:
+        s_write(session, req);
+        break;
+    case TFS_OP_CODE_READ:
+        s_read(session, req);
+        break;
+    case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+        s_shutdown(session);
+        break;
+    case TFS_OP_CODE_SHM_ATTACH:
+        s_shm_attach(session, req);
+        break;
+    case TFS_OP_CODE_SHM_WRITE:
+        s_shm_write(session, req);
+        break;
+    case TFS_OP_CODE_SHM_READ:
+        s_shm_read(session, req);
+        break;
+    case TFS_OP_CODE_STATS:
+        s_stats(session);
+        break;
+    case TFS_OP_CODE_TRACE:
+        s_trace(session, req);
+        break;
+    case TFS_OP_CODE_CHECKPOINT:
+        s_checkpoint(session, req);
+        break;
+    case TFS_OP_CODE_SNAPSHOT:
+        s_snapshot(session, req);
+        break;
+    case TFS_OP_CODE_CLONE:
+        s_clone(session, req);
+        break;
+    case TFS_OP_CODE_LOCK_PROFILE:
+        s_lock_profile(session);
+        break;
+    case TFS_OP_CODE_CALLBACK:
+        s_callback(session, req);
+        break;
+    case TFS_OP_CODE_LEASE:
+        s_lease(session, req);
+        break;
+    case TFS_OP_CODE_PWRITE:
+        s_pwrite(session, req);
+        break;
+    default:
+        fprintf(stderr, "Unknown op code %d\n", opcode);
+        break;
     }
+}
 
-    return 0;
+/*
+ * Returns the offset of the file handle a read or write request is for
+ */
+static uint64_t request_offset(tfs_request_t const *req) {
+    char opcode = req->buf[0];
+    int fh;
+    if (opcode == TFS_OP_CODE_PWRITE && req->len >= 25) {
+        size_t offset;
+        memcpy(&offset, req->buf + 17, sizeof(size_t));
+        return offset;
+    }
+    if ((opcode != TFS_OP_CODE_READ && opcode != TFS_OP_CODE_WRITE &&
+         opcode != TFS_OP_CODE_SHM_READ && opcode != TFS_OP_CODE_SHM_WRITE) ||
+        req->len < 5 + sizeof(int)) {
+        return 0;
+    }
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    /* requests are handled one at a time, so the entry cannot change */
+    open_file_entry_t *file = get_open_file_entry(fh);
+    return file != NULL ? file->of_offset : 0;
 }
 
-int s_unmount() {
+/*
+ * Logs a handled request to the capture
+ */
+static void capture(tfs_request_t const *req, uint64_t offset, uint64_t start,
+                    uint64_t end) {
+    capture_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ns = start;
+    rec.offset = offset;
+    rec.latency_ns = end - start > UINT32_MAX ? UINT32_MAX
+                                              : (uint32_t)(end - start);
+    rec.opcode = (uint8_t)req->buf[0];
+    rec.result = (int32_t)reply_result;
+    rec.session = -1;
+    if (req->len >= 1 + sizeof(int) && rec.opcode != TFS_OP_CODE_MOUNT) {
+        memcpy(&rec.session, req->buf + 1, sizeof(int));
+    }
+
+    char name[MAX_FILE_NAME + 1] = "";
+    switch (rec.opcode) {
+    case TFS_OP_CODE_OPEN:
+        if (req->len >= 5 + 44) {
+            int flags;
+            memcpy(name, req->buf + 5, MAX_FILE_NAME);
+            memcpy(&flags, req->buf + 45, sizeof(int));
+            rec.flags = (uint8_t)flags;
+            rec.name_len = (uint16_t)strlen(name);
+        }
+        break;
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_SHM_WRITE:
+    case TFS_OP_CODE_SHM_READ:
+    case TFS_OP_CODE_PWRITE:
+        if (req->len >= 17) {
+            size_t len;
+            memcpy(&len, req->buf + 9, sizeof(size_t));
+            rec.len = len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;
+        }
+        /* fall through */
+    case TFS_OP_CODE_CLOSE:
+    case TFS_OP_CODE_LEASE:
+        if (req->len >= 5 + sizeof(int)) {
+            memcpy(&rec.handle, req->buf + 5, sizeof(int));
+        }
+        break;
+    default:
+        break;
+    }
+
+    capture_request(&rec, name);
+}
+
+static void handle_request(tfs_request_t const *req) {
+    uint64_t t = trace_begin();
+    uint64_t start = now_ns();
+    uint64_t offset = capture_enabled() ? request_offset(req) : 0;
+    reply_bytes = 0;
+    reply_result = -1;
+    reply_tag = req->tag;
+
+    oplog_begin_request();
+    dispatch_request(req);
+    oplog_end_request();
+
+    int opcode = req->buf[0];
+    if (opcode < 0 || opcode >= TFS_OP_CODE_COUNT) {
+        opcode = 0;
+    }
+    trace_end(TRACE_OP + opcode, t);
+    tfs_op_stats_t *stats = &counters_local()->ops[opcode];
+    counter_add(&stats->count, 1);
+    counter_add(&stats->bytes_in, req->len);
+    counter_add(&stats->bytes_out, reply_bytes);
+    uint64_t end = now_ns();
+    counter_add(&stats->latency[tfs_hist_bucket(end - start)], 1);
+    if (capture_enabled()) {
+        capture(req, offset, start, end);
+    }
+}
+
+/* Handles the request the scheduler picks */
+static void handle_next() {
+    static tfs_request_t req;
+    uint32_t id;
+    if (sched_pop(&req, &id)) {
+        trace_set_request(id);
+        handle_request(&req);
+    }
+}
+
+/*
+ * Returns the session a request says it belongs to (queued by the
+ * scheduler even if the session is not valid, which handling it finds
+ * out), -1 for mounts and malformed requests
+ */
+static int request_session(tfs_request_t const *req) {
     int session_id;
-    if (read(fserv, &session_id, sizeof(int)) == -1) {
-        perror("Read error");
+    if (req->buf[0] == TFS_OP_CODE_MOUNT || req->len < 1 + sizeof(int)) {
         return -1;
     }
-    if (id == 0) {
-        return -1;
+    memcpy(&session_id, req->buf + 1, sizeof(int));
+    return session_id >= 0 && session_id < MAX_SESSIONS ? session_id : -1;
+}
+
+static void handle_disconnect(int conn) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active && sessions[i].fcli == conn) {
+            end_session(&sessions[i]);
+            return;
+        }
     }
+    /* connected, but never mounted */
+    transport->close_reply(transport, conn);
+}
 
-    if (close(fcli) == -1) {
-        perror("Closing error");
-        return -1;
+static void end_session(session_t *session) {
+    if (session->shm_arena != NULL) {
+        munmap(session->shm_arena, session->shm_arena_size);
+        session->shm_arena = NULL;
+    }
+    if (session->fcb != -1) {
+        close(session->fcb);
+        session->fcb = -1;
+    }
+    lease_drop_session((int)(session - sessions));
+    transport->close_reply(transport, session->fcli);
+    session->active = false;
+    /* a finished session leaves no records behind in the buffer */
+    capture_flush();
+}
+
+/*
+ * Returns the i-number of the file a handle is open on, -1 if none (or if
+ * it is a file of a snapshot, which never changes and takes no lease)
+ */
+static int handle_inumber(int fh) {
+    open_file_entry_t *file = get_open_file_entry(fh);
+    return file != NULL && file->of_snapshot == -1 ? file->of_inumber : -1;
+}
+
+/*
+ * Logs a write done at the offset of its handle (which it advanced), if the
+ * server logs its changes
+ */
+static void log_write(int fh, void const *data, ssize_t wt) {
+    open_file_entry_t *file = get_open_file_entry(fh);
+    if (wt > 0 && oplog_enabled() && file != NULL) {
+        oplog_write(fh, file->of_offset - (size_t)wt, data, (size_t)wt);
     }
+}
+
+/*
+ * Sends a reply made of a fixed-size part and (optionally) some data, as a
+ * single message after the reply header.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int reply(session_t *session, void const *ret, size_t ret_len,
+                 void const *data, size_t data_len) {
+    tfs_reply_header_t header = {reply_tag, (uint32_t)(ret_len + data_len)};
+    struct iovec iov[3];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)ret;
+    iov[1].iov_len = ret_len;
+    iov[2].iov_base = (void *)data;
+    iov[2].iov_len = data_len;
 
+    uint64_t t = trace_begin();
+    ssize_t wt = writev(session->fcli, iov, data_len > 0 ? 3 : 2);
+    trace_end(TRACE_REPLY, t);
+    if (wt == -1) {
+        perror("Write error");
+        return -1;
+    }
+    reply_bytes += ret_len + data_len;
+    if (ret_len == sizeof(int)) {
+        int r;
+        memcpy(&r, ret, sizeof(int));
+        reply_result = r;
+    } else if (ret_len == sizeof(ssize_t)) {
+        ssize_t r;
+        memcpy(&r, ret, sizeof(ssize_t));
+        reply_result = r;
+    }
     return 0;
 }
 
-int s_open(char opcode) {
-    int session_id, flags;
-    char name[40];
-    if (read(fserv, &session_id, sizeof(int)) == -1) {
-        perror("Read error");
+int s_mount(tfs_request_t const *req) {
+    char client_pipe_path[41];
+    if (req->len < 1 + 40) {
         return -1;
     }
-    if (id == 0) {
+    memcpy(client_pipe_path, req->buf + 1, 40);
+    client_pipe_path[40] = '\0';
+
+    int fcli = transport->open_reply(transport, req, client_pipe_path);
+    if (fcli == -1) {
         return -1;
     }
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &session_id, sizeof(int));
 
-    if (read(fserv, buffer + 5, sizeof(char) * 44) == -1) {
-        perror("Read error");
-        return -1;
+    int id = -1;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i].active) {
+            sessions[i].active = true;
+            sessions[i].fcli = fcli;
+            struct stat st;
+            sessions[i].fcli_is_pipe =
+                fstat(fcli, &st) == 0 && S_ISFIFO(st.st_mode);
+            sessions[i].shm_arena = NULL;
+            sessions[i].fcb = -1;
+            id = i;
+            break;
+        }
     }
-    memcpy(name, buffer + 5, sizeof(name));
-    memcpy(&flags, buffer + 45, sizeof(int));
 
-    int ret = tfs_open(name, flags);
-    if (write(fcli, &ret, sizeof(int)) == -1) {
+    tfs_reply_header_t header = {0, sizeof(int)};
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = &id;
+    iov[1].iov_len = sizeof(int);
+    if (writev(fcli, iov, 2) == -1) {
         perror("Write error");
+    } else {
+        reply_bytes += sizeof(int);
+        reply_result = id;
+    }
+    if (id == -1) {
+        /* no free session: the client is told so and let go */
+        transport->close_reply(transport, fcli);
         return -1;
     }
 
     return 0;
 }
 
-int s_close(char opcode) {
-    int session_id;
-    if (read(fserv, &session_id, sizeof(int)) == -1) {
-        perror("Read error");
+int s_unmount(session_t *session) {
+    end_session(session);
+    return 0;
+}
+
+int s_open(session_t *session, tfs_request_t const *req) {
+    int flags;
+    char name[41];
+    if (req->len < 5 + 44) {
         return -1;
     }
-    if (id == 0) {
+    memcpy(name, req->buf + 5, 40);
+    name[40] = '\0';
+    memcpy(&flags, req->buf + 45, sizeof(int));
+
+    int ret = -1;
+    if (!oplog_following() || !(flags & (TFS_O_CREAT | TFS_O_TRUNC))) {
+        ret = tfs_open(name, flags);
+    }
+    if (ret != -1 && (flags & TFS_O_TRUNC)) {
+        lease_write((int)(session - sessions), handle_inumber(ret));
+    }
+    /* the replicas have no snapshots, and opening a file of one changes
+     * nothing */
+    char const *snapshot_name;
+    if (ret != -1 && oplog_enabled() &&
+        snapshot_path(name, &snapshot_name) == -1) {
+        oplog_open(ret, flags, name);
+    }
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
+
+int s_close(session_t *session, tfs_request_t const *req) {
+    int fh;
+    if (req->len < 5 + 4) {
         return -1;
     }
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &session_id, sizeof(int));
+    memcpy(&fh, req->buf + 5, sizeof(int));
+
+    /* the opens of files of snapshots are not logged (see s_open) */
+    open_file_entry_t *file = get_open_file_entry(fh);
+    bool logged = file != NULL && file->of_snapshot == -1;
+    int ret = tfs_close(fh);
+    if (ret != -1 && logged && oplog_enabled()) {
+        oplog_close(fh);
+    }
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
 
-    if (read(fserv, buffer + 5, sizeof(char) * 4) == -1) {
-        perror("Read error");
+int s_write(session_t *session, tfs_request_t const *req) {
+    int fh;
+    size_t len;
+    if (req->len < 17) {
         return -1;
     }
-    int fh, ret;
-    memcpy(&fh, buffer + 5, sizeof(int));
-    ret = tfs_close(fh);
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    memcpy(&len, req->buf + 9, sizeof(size_t));
+
+    /* the payload is written in place from the request */
+    ssize_t wt = -1;
+    if (len <= req->len - 17 && !oplog_following()) {
+        lease_write((int)(session - sessions), handle_inumber(fh));
+        wt = tfs_write(fh, req->buf + 17, len);
+        log_write(fh, req->buf + 17, wt);
+    }
+    return reply(session, &wt, sizeof(ssize_t), NULL, 0);
+}
+
+/*
+ * Answers a large read straight from the file's block. With -z, when the
+ * reply channel is a pipe and the data starts at a page boundary, the pages
+ * are spliced into the pipe and never copied in user space; otherwise they
+ * are written from the block (one copy less than the buffered path).
+ * Since the pipe references the pages until the client consumes them, a
+ * client may observe writes done after its read was answered.
+ */
+static int s_read_direct(session_t *session, int fh, size_t len) {
+    void const *data;
+    ssize_t rd = tfs_read_ref(fh, len, &data);
+
+    if (rd <= 0 || !zerocopy || !session->fcli_is_pipe ||
+        (uintptr_t)data % page_size != 0) {
+        return reply(session, &rd, sizeof(ssize_t), data,
+                     rd > 0 ? (size_t)rd : 0);
+    }
 
-    if (write(fcli, &ret, sizeof(int)) == -1) {
+    uint64_t t = trace_begin();
+    tfs_reply_header_t header = {reply_tag,
+                                 (uint32_t)(sizeof(ssize_t) + (size_t)rd)};
+    struct iovec head[2];
+    head[0].iov_base = &header;
+    head[0].iov_len = sizeof(header);
+    head[1].iov_base = &rd;
+    head[1].iov_len = sizeof(ssize_t);
+    if (writev(session->fcli, head, 2) == -1) {
         perror("Write error");
         return -1;
     }
-    printf("Closed \n");
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = (size_t)rd;
+    while (iov.iov_len > 0) {
+        ssize_t n = vmsplice(session->fcli, &iov, 1, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Vmsplice error");
+            return -1;
+        }
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= (size_t)n;
+    }
+    trace_end(TRACE_REPLY, t);
+    reply_bytes += sizeof(ssize_t) + (size_t)rd;
+    reply_result = rd;
     return 0;
 }
 
-int s_write(char opcode) {
-    int session_id, fh;
-
-    if (read(fserv, &session_id, sizeof(int)) == -1) {
-        perror("Read error");
+int s_read(session_t *session, tfs_request_t const *req) {
+    int fh;
+    size_t len;
+    if (req->len < 17) {
         return -1;
     }
-    if (id == 0) {
-        return -1;
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    memcpy(&len, req->buf + 9, sizeof(size_t));
+    if (len >= DIRECT_READ_MIN || len > TFS_MAX_PAYLOAD) {
+        return s_read_direct(session, fh, len);
     }
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &session_id, sizeof(int));
 
-    if (read(fserv, buffer + 5, sizeof(int)) == -1) {
-        perror("Read error");
+    char to_read[TFS_MAX_PAYLOAD];
+    ssize_t rd = tfs_read(fh, to_read, len);
+    return reply(session, &rd, sizeof(ssize_t), to_read,
+                 rd > 0 ? (size_t)rd : 0);
+}
+
+int s_shutdown(session_t *session) {
+    (void)session;
+    return 0;
+}
+
+int s_shm_attach(session_t *session, tfs_request_t const *req) {
+    int ret = -1;
+    char name[TFS_SHM_NAME_SIZE];
+    if (req->len < 5 + TFS_SHM_NAME_SIZE) {
         return -1;
     }
-    memcpy(&fh, buffer + 5, sizeof(int));
-    
+    memcpy(name, req->buf + 5, sizeof(name));
+    name[TFS_SHM_NAME_SIZE - 1] = '\0';
+
+    int fd = shm_open(name, O_RDWR, 0);
+    struct stat st;
+    if (fd == -1) {
+        perror("Shm_open error");
+    } else if (fstat(fd, &st) == -1 || st.st_size < TFS_SHM_ARENA_SIZE) {
+        perror("Shm arena error");
+    } else {
+        void *arena = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+        if (arena == MAP_FAILED) {
+            perror("Mmap error");
+        } else {
+            if (session->shm_arena != NULL) {
+                munmap(session->shm_arena, session->shm_arena_size);
+            }
+            session->shm_arena = arena;
+            session->shm_arena_size = (size_t)st.st_size;
+            ret = 0;
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+
+    reply(session, &ret, sizeof(int), NULL, 0);
+    return ret;
+}
+
+int s_shm_write(session_t *session, tfs_request_t const *req) {
+    int fh;
     size_t len;
-    if (read(fserv, &len, sizeof(size_t)) == -1) {
-        perror("Read error");
+    if (req->len < 17) {
         return -1;
     }
-    memcpy(buffer + 9, &len, sizeof(size_t));
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    memcpy(&len, req->buf + 9, sizeof(size_t));
+
+    /* the payload is read in place from the client's arena */
+    ssize_t wt = -1;
+    if (session->shm_arena != NULL && len <= session->shm_arena_size &&
+        !oplog_following()) {
+        lease_write((int)(session - sessions), handle_inumber(fh));
+        wt = tfs_write(fh, session->shm_arena, len);
+        log_write(fh, session->shm_arena, wt);
+    }
+    return reply(session, &wt, sizeof(ssize_t), NULL, 0);
+}
 
-    if (read(fserv, buffer + 17, sizeof(char) * len) == -1) {
-        perror("Read error");
+int s_shm_read(session_t *session, tfs_request_t const *req) {
+    int fh;
+    size_t len;
+    if (req->len < 17) {
         return -1;
     }
-    char to_write[len];
-    memcpy(to_write, buffer + 17, sizeof(to_write));
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    memcpy(&len, req->buf + 9, sizeof(size_t));
 
-    ssize_t wt = tfs_write(fh, to_write, len);
-    if (write(fcli, &wt, sizeof(ssize_t)) == -1) {
-        perror("Write error");
+    /* the file contents go straight into the client's arena */
+    ssize_t rd = -1;
+    if (session->shm_arena != NULL && len <= session->shm_arena_size) {
+        rd = tfs_read(fh, session->shm_arena, len);
+    }
+    return reply(session, &rd, sizeof(ssize_t), NULL, 0);
+}
+
+int s_stats(session_t *session) {
+    static tfs_stats_t stats;
+
+    counters_collect(&stats);
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active) {
+            stats.sessions++;
+        }
+    }
+
+    return reply(session, &stats, sizeof(stats), NULL, 0);
+}
+
+int s_trace(session_t *session, tfs_request_t const *req) {
+    int command, ret = 0;
+    char path[TFS_TRACE_PATH_SIZE];
+    if (req->len < 9 + TFS_TRACE_PATH_SIZE) {
         return -1;
     }
+    memcpy(&command, req->buf + 5, sizeof(int));
+    memcpy(path, req->buf + 9, sizeof(path));
+    path[TFS_TRACE_PATH_SIZE - 1] = '\0';
 
-    return 0;
+    if (command == TFS_TRACE_ON || command == TFS_TRACE_OFF) {
+        trace_set_enabled(command == TFS_TRACE_ON);
+    } else if (command == TFS_TRACE_DUMP) {
+        ret = trace_dump(path);
+    } else {
+        ret = -1;
+    }
+
+    return reply(session, &ret, sizeof(int), NULL, 0);
 }
 
-int s_read(char opcode) {
-    int session_id, fh;
+int s_checkpoint(session_t *session, tfs_request_t const *req) {
+    int command, ret;
+    char path[TFS_CHECKPOINT_PATH_SIZE];
+    if (req->len < 9 + TFS_CHECKPOINT_PATH_SIZE) {
+        return -1;
+    }
+    memcpy(&command, req->buf + 5, sizeof(int));
+    memcpy(path, req->buf + 9, sizeof(path));
+    path[TFS_CHECKPOINT_PATH_SIZE - 1] = '\0';
+
+    if (command == TFS_CHECKPOINT_START) {
+        ret = tfs_checkpoint(path);
+    } else if (command == TFS_CHECKPOINT_STATUS) {
+        ret = tfs_checkpoint_status();
+    } else {
+        ret = -1;
+    }
+
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
 
-    if (read(fserv, &session_id, sizeof(int)) == -1) {
-        perror("Read error");
+int s_snapshot(session_t *session, tfs_request_t const *req) {
+    int command, id, ret;
+    if (req->len < 9 + 4) {
         return -1;
     }
-    if (id == 0) {
+    memcpy(&command, req->buf + 5, sizeof(int));
+    memcpy(&id, req->buf + 9, sizeof(int));
+
+    if (command == TFS_SNAPSHOT_CREATE) {
+        ret = tfs_snapshot_create();
+    } else if (command == TFS_SNAPSHOT_DELETE) {
+        ret = tfs_snapshot_delete(id);
+    } else {
+        ret = -1;
+    }
+
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
+
+/*
+ * Logs a clone. The replicas have no snapshots, so a clone of a file of a
+ * snapshot is logged as a rewrite of the destination with its new contents
+ * (at most a block).
+ */
+static void log_clone(char const *source, char const *dest) {
+    if (strncmp(source, TFS_SNAPSHOT_PREFIX, strlen(TFS_SNAPSHOT_PREFIX))) {
+        oplog_clone(source, dest);
+        return;
+    }
+
+    static char data[BLOCK_SIZE];
+    int fh = tfs_open(dest, 0);
+    if (fh == -1) {
+        return;
+    }
+    ssize_t size = tfs_pread(fh, data, sizeof(data), 0);
+    oplog_open(fh, TFS_O_CREAT | TFS_O_TRUNC, dest);
+    if (size > 0) {
+        oplog_write(fh, 0, data, (size_t)size);
+    }
+    oplog_close(fh);
+    tfs_close(fh);
+}
+
+int s_clone(session_t *session, tfs_request_t const *req) {
+    char source[41], dest[41];
+    if (req->len < 5 + 80) {
         return -1;
     }
-    memcpy(buffer, &opcode, sizeof(char));
-    memcpy(buffer + 1, &session_id, sizeof(int));
-    
-    if (read(fserv, buffer + 5, sizeof(char) * 12) == -1) {
-        perror("Read error");
+    memcpy(source, req->buf + 5, 40);
+    source[40] = '\0';
+    memcpy(dest, req->buf + 45, 40);
+    dest[40] = '\0';
+
+    int ret = -1;
+    if (!oplog_following()) {
+        /* the destination's contents are replaced under every lease on it,
+         * the cloning session's included */
+        lease_revoke_all(tfs_lookup(dest));
+        ret = tfs_clone(source, dest);
+    }
+    if (ret != -1 && oplog_enabled()) {
+        log_clone(source, dest);
+    }
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
+
+int s_lock_profile(session_t *session) {
+    static char report[TFS_LOCK_REPORT_SIZE];
+
+    /* -1 (and no text) unless the server was built with TFS_LOCK_PROFILE */
+    ssize_t len = lockprof_report(report, sizeof(report));
+    return reply(session, &len, sizeof(ssize_t), report,
+                 len > 0 ? (size_t)len : 0);
+}
+
+/*
+ * Sends a lease revocation to a session. A revocation that cannot be
+ * delivered closes the callback channel instead: the client sees it end and
+ * stops trusting its cache.
+ */
+static void send_revocation(int session, int inumber) {
+    session_t *s = &sessions[session];
+    if (s->fcb == -1) {
+        return;
+    }
+    if (write(s->fcb, &inumber, sizeof(int)) != sizeof(int)) {
+        perror("Callback error");
+        close(s->fcb);
+        s->fcb = -1;
+        lease_drop_session(session);
+    }
+}
+
+int s_callback(session_t *session, tfs_request_t const *req) {
+    int ret = -1;
+    char path[TFS_CALLBACK_PATH_SIZE + 1];
+    if (req->len < 5 + TFS_CALLBACK_PATH_SIZE) {
         return -1;
     }
-    size_t len;
-    memcpy(&fh, buffer + 5, sizeof(int));
-    memcpy(&len, buffer + 9, sizeof(size_t));
+    memcpy(path, req->buf + 5, TFS_CALLBACK_PATH_SIZE);
+    path[TFS_CALLBACK_PATH_SIZE] = '\0';
 
-    char to_read[len];
-    ssize_t rd = tfs_read(fh, to_read, len);
-    if (write(fcli, &rd, sizeof(ssize_t)) == -1) {
-        perror("Write error");
+    /* the client already has the pipe open for reading, and a client that
+     * stops reading it must never block the server */
+    int fcb = open(path, O_WRONLY | O_NONBLOCK);
+    if (fcb == -1) {
+        perror("Callback open error");
+    } else {
+        if (session->fcb != -1) {
+            close(session->fcb);
+        }
+        session->fcb = fcb;
+        ret = 0;
+    }
+    return reply(session, &ret, sizeof(int), NULL, 0);
+}
+
+int s_lease(session_t *session, tfs_request_t const *req) {
+    static char data[TFS_LEASE_DATA_MAX];
+    int fh;
+    if (req->len < 5 + 4) {
         return -1;
     }
-    if (rd != -1) {
-        if (write(fcli, to_read, sizeof(char) * (size_t)rd) == -1) {
-            perror("Write error");
-            return -1;
+    memcpy(&fh, req->buf + 5, sizeof(int));
+
+    /* only a session that can be told when to let go gets a lease */
+    int inumber = handle_inumber(fh);
+    ssize_t size = -1;
+    if (session->fcb != -1 && inumber != -1) {
+        size = tfs_pread(fh, data, sizeof(data), 0);
+        if (size != -1) {
+            lease_grant((int)(session - sessions), inumber);
         }
     }
 
-    return 0;
+    char header[sizeof(ssize_t) + sizeof(int)];
+    memcpy(header, &size, sizeof(ssize_t));
+    memcpy(header + sizeof(ssize_t), &inumber, sizeof(int));
+    int ret = reply(session, header, sizeof(header), data,
+                    size > 0 ? (size_t)size : 0);
+    reply_result = size;
+    return ret;
 }
 
-int s_shutdown() {
-    return 0;
+int s_pwrite(session_t *session, tfs_request_t const *req) {
+    int fh;
+    size_t len, offset;
+    if (req->len < 25) {
+        return -1;
+    }
+    memcpy(&fh, req->buf + 5, sizeof(int));
+    memcpy(&len, req->buf + 9, sizeof(size_t));
+    memcpy(&offset, req->buf + 17, sizeof(size_t));
+
+    ssize_t wt = -1;
+    if (len <= req->len - 25 && !oplog_following()) {
+        lease_write((int)(session - sessions), handle_inumber(fh));
+        wt = tfs_pwrite(fh, req->buf + 25, len, offset);
+        if (wt > 0 && oplog_enabled()) {
+            oplog_write(fh, offset, req->buf + 25, (size_t)wt);
+        }
+    }
+    return reply(session, &wt, sizeof(ssize_t), NULL, 0);
 }
@@ -0,0 +1,146 @@
+#include "trace.h"
+#include "common/stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TRACE_RING_SIZE (1 << 14) /* spans kept per thread */
+
+typedef struct {
+    uint64_t start; /* ns */
+    uint64_t duration;
+    uint32_t request;
+    uint32_t kind;
+} trace_event_t;
+
+typedef struct trace_ring {
+    trace_event_t events[TRACE_RING_SIZE];
+    uint64_t head; /* number of spans ever recorded */
+    int tid;
+    struct trace_ring *next;
+} trace_ring_t;
+
+bool trace_enabled;
+
+static trace_ring_t *rings;
+static int n_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local trace_ring_t *local;
+static _Thread_local uint32_t current_request;
+
+uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static trace_ring_t *local_ring() {
+    if (local != NULL) {
+        return local;
+    }
+
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&rings_lock);
+    ring->tid = ++n_rings;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    local = ring;
+    return ring;
+}
+
+void trace_record(int kind, uint64_t start) {
+    uint64_t end = trace_now();
+    trace_ring_t *ring = local_ring();
+    if (ring == NULL) {
+        return;
+    }
+
+    trace_event_t *ev = &ring->events[ring->head % TRACE_RING_SIZE];
+    ev->start = start;
+    ev->duration = end - start;
+    ev->request = current_request;
+    ev->kind = (uint32_t)kind;
+    /* publishes the span to trace_dump */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_set_enabled(bool enabled) {
+    __atomic_store_n(&trace_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+void trace_set_request(uint32_t request) { current_request = request; }
+
+static char const *kind_name(uint32_t kind) {
+    switch (kind) {
+    case TRACE_RECV:
+        return "recv";
+    case TRACE_LOCK:
+        return "lock wait";
+    case TRACE_STORAGE:
+        return "storage";
+    case TRACE_REPLY:
+        return "reply";
+    default:
+        return tfs_op_code_name((int)kind - TRACE_OP);
+    }
+}
+
+int trace_dump(char const *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("Fopen error");
+        return -1;
+    }
+
+    trace_event_t *copy = malloc(sizeof(trace_event_t) * TRACE_RING_SIZE);
+    if (copy == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[");
+    bool first = true;
+
+    pthread_mutex_lock(&rings_lock);
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        /* copy the ring, then drop whatever its owner may have overwritten
+         * in the meantime */
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t from = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint64_t i = from; i < head; i++) {
+            copy[i % TRACE_RING_SIZE] = ring->events[i % TRACE_RING_SIZE];
+        }
+        uint64_t head_after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head_after > TRACE_RING_SIZE &&
+            head_after - TRACE_RING_SIZE > from) {
+            from = head_after - TRACE_RING_SIZE;
+        }
+
+        for (uint64_t i = from; i < head; i++) {
+            trace_event_t const *ev = &copy[i % TRACE_RING_SIZE];
+            fprintf(fp,
+                    "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%u}}",
+                    first ? "" : ",", kind_name(ev->kind), ring->tid,
+                    (double)ev->start / 1e3, (double)ev->duration / 1e3,
+                    ev->request);
+            first = false;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    free(copy);
+    if (fclose(fp) != 0) {
+        perror("Fclose error");
+        return -1;
+    }
+    return 0;
+}
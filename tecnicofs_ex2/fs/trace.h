@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Lightweight span tracing.
+ * Each thread records spans into its own ring buffer (the oldest spans are
+ * overwritten), without locks. When tracing is disabled, a span costs one
+ * relaxed load of trace_enabled.
+ */
+
+/* Stages of a request; requests themselves use TRACE_OP + their op code */
+typedef enum {
+    TRACE_RECV,    /* reading the request from the transport */
+    TRACE_LOCK,    /* waiting for the state lock */
+    TRACE_STORAGE, /* simulated storage access (insert_delay) */
+    TRACE_REPLY,   /* writing the reply */
+    TRACE_OP,
+} trace_kind_t;
+
+extern bool trace_enabled;
+
+uint64_t trace_now();
+void trace_record(int kind, uint64_t start);
+
+/* Starts a span: returns its start time, 0 if tracing is disabled */
+static inline uint64_t trace_begin() {
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return trace_now();
+}
+
+/* Ends a span started by trace_begin */
+static inline void trace_end(int kind, uint64_t start) {
+    if (start != 0) {
+        trace_record(kind, start);
+    }
+}
+
+/* Switches tracing on or off */
+void trace_set_enabled(bool enabled);
+
+/* Sets the id of the request the calling thread is working on (recorded
+ * with its spans) */
+void trace_set_request(uint32_t request);
+
+/*
+ * Writes the spans of every thread to path, in Chrome's trace event JSON
+ * format (open it in chrome://tracing or https://ui.perfetto.dev).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int trace_dump(char const *path);
+
+#endif // TRACE_H
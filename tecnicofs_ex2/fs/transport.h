@@ -0,0 +1,62 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "common/common.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* longest path a transport listens on (the size of sun_path) */
+#define TRANSPORT_PATH_MAX (108)
+
+/*
+ * A whole client request, as delivered by a transport
+ */
+typedef struct {
+    int conn;      /* connection it arrived on (-1: the shared server pipe) */
+    tfs_tag_t tag; /* to echo in the reply (0 for a mount) */
+    size_t len;    /* number of valid bytes in buf */
+    /* the request without its tag: the op code, the session id, and then
+     * the op's fields */
+    char buf[TFS_MAX_REQUEST];
+} tfs_request_t;
+
+/*
+ * Server-side transport. The server only sees whole requests and
+ * replies through a file descriptor per session, so the named pipe and the
+ * Unix socket back ends are interchangeable.
+ */
+typedef struct transport transport_t;
+struct transport {
+    /* Blocks until a whole request arrives (unless wait is false and none
+     * has started to arrive).
+     * Returns 0 if a request was read into req, 1 if the connection
+     * req->conn was closed by the client, 2 if there was no request to
+     * read without waiting, -1 on error */
+    int (*recv)(transport_t *t, tfs_request_t *req, bool wait);
+
+    /* Opens the reply channel of a session being mounted through req.
+     * Returns the file descriptor replies are written to, -1 on error */
+    int (*open_reply)(transport_t *t, tfs_request_t const *req,
+                      char const *client_path);
+
+    /* Closes the reply channel of a session */
+    void (*close_reply)(transport_t *t, int reply_fd);
+
+    /* Stops listening and frees the transport */
+    void (*destroy)(transport_t *t);
+};
+
+/*
+ * Creates the named pipe transport, listening on a FIFO created at path.
+ * Returns the transport if successful, NULL otherwise.
+ */
+transport_t *fifo_transport_create(char const *path);
+
+/*
+ * Creates the SOCK_SEQPACKET Unix socket transport, bound to path: each
+ * client connection is one session and message boundaries are preserved.
+ * Returns the transport if successful, NULL otherwise.
+ */
+transport_t *socket_transport_create(char const *path);
+
+#endif // TRANSPORT_H
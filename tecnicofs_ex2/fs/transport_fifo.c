@@ -0,0 +1,207 @@
+#include "transport.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    transport_t ops;
+    char path[TRANSPORT_PATH_MAX];
+    int fserv;
+} fifo_transport_t;
+
+/*
+ * Size of the fixed part of each request, after the op code.
+ * The pipe is a byte stream, so the framing has to be known here.
+ * Returns -1 for unknown op codes.
+ */
+static ssize_t request_header_size(char opcode) {
+    switch (opcode) {
+    case TFS_OP_CODE_MOUNT:
+        return 40;
+    case TFS_OP_CODE_UNMOUNT:
+    case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+    case TFS_OP_CODE_STATS:
+    case TFS_OP_CODE_LOCK_PROFILE:
+        return 4;
+    case TFS_OP_CODE_TRACE:
+        return 8 + TFS_TRACE_PATH_SIZE;
+    case TFS_OP_CODE_CHECKPOINT:
+        return 8 + TFS_CHECKPOINT_PATH_SIZE;
+    case TFS_OP_CODE_OPEN:
+        return 48;
+    case TFS_OP_CODE_CLOSE:
+    case TFS_OP_CODE_LEASE:
+        return 8;
+    case TFS_OP_CODE_SNAPSHOT:
+        return 12;
+    case TFS_OP_CODE_CLONE:
+        return 84;
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_SHM_WRITE:
+    case TFS_OP_CODE_SHM_READ:
+        return 16;
+    case TFS_OP_CODE_PWRITE:
+        return 24;
+    case TFS_OP_CODE_SHM_ATTACH:
+        return 4 + TFS_SHM_NAME_SIZE;
+    case TFS_OP_CODE_CALLBACK:
+        return 4 + TFS_CALLBACK_PATH_SIZE;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Reads exactly len bytes from the server pipe.
+ * Returns 0 if successful, 1 on end of file, -1 on error.
+ */
+static int read_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t rd = read(fd, buf, len);
+        if (rd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Read error");
+            return -1;
+        }
+        if (rd == 0) {
+            return 1;
+        }
+        buf += rd;
+        len -= (size_t)rd;
+    }
+    return 0;
+}
+
+static int fifo_recv(transport_t *t, tfs_request_t *req, bool wait) {
+    fifo_transport_t *ft = (fifo_transport_t *)t;
+
+    req->conn = -1;
+    if (!wait) {
+        /* (with no client left, there is nothing to read either) */
+        struct pollfd p = {ft->fserv, POLLIN, 0};
+        if (poll(&p, 1, 0) <= 0 || !(p.revents & POLLIN)) {
+            return 2;
+        }
+    }
+    while (true) {
+        int r = read_all(ft->fserv, req->buf, 1);
+        if (r == 1) {
+            /* every client closed the pipe: wait for the next one */
+            close(ft->fserv);
+            if ((ft->fserv = open(ft->path, O_RDONLY)) == -1) {
+                perror("Open error");
+                return -1;
+            }
+            continue;
+        }
+        if (r == -1) {
+            return -1;
+        }
+        break;
+    }
+
+    /* the wait for the first byte is idle time, not part of the request */
+    uint64_t span = trace_begin();
+    ssize_t header = request_header_size(req->buf[0]);
+    if (header == -1) {
+        fprintf(stderr, "Unknown op code %d\n", req->buf[0]);
+        return -1;
+    }
+    /* the tag follows the session id, and is kept apart */
+    req->tag = 0;
+    bool tagged = req->buf[0] != TFS_OP_CODE_MOUNT;
+    size_t untagged = tagged ? 4 : (size_t)header;
+    if (read_all(ft->fserv, req->buf + 1, untagged) != 0 ||
+        (tagged &&
+         (read_all(ft->fserv, (char *)&req->tag, sizeof(tfs_tag_t)) != 0 ||
+          read_all(ft->fserv, req->buf + 1 + untagged,
+                   (size_t)header - untagged) != 0))) {
+        return -1;
+    }
+    req->len = 1 + (size_t)header;
+
+    if (req->buf[0] == TFS_OP_CODE_WRITE ||
+        req->buf[0] == TFS_OP_CODE_PWRITE) {
+        /* the payload length follows the file handle in both */
+        size_t len;
+        memcpy(&len, req->buf + 9, sizeof(size_t));
+        if (len > sizeof(req->buf) - req->len) {
+            fprintf(stderr, "Request too large\n");
+            return -1;
+        }
+        if (read_all(ft->fserv, req->buf + req->len, len) != 0) {
+            return -1;
+        }
+        req->len += len;
+    }
+
+    trace_end(TRACE_RECV, span);
+    return 0;
+}
+
+static int fifo_open_reply(transport_t *t, tfs_request_t const *req,
+                           char const *client_path) {
+    (void)t;
+    (void)req;
+
+    int fd = open(client_path, O_WRONLY);
+    if (fd == -1) {
+        perror("Open error");
+    }
+    return fd;
+}
+
+static void fifo_close_reply(transport_t *t, int reply_fd) {
+    (void)t;
+    if (close(reply_fd) == -1) {
+        perror("Closing error");
+    }
+}
+
+static void fifo_destroy(transport_t *t) {
+    fifo_transport_t *ft = (fifo_transport_t *)t;
+    close(ft->fserv);
+    unlink(ft->path);
+    free(ft);
+}
+
+transport_t *fifo_transport_create(char const *path) {
+    if (strlen(path) >= TRANSPORT_PATH_MAX) {
+        return NULL;
+    }
+
+    fifo_transport_t *ft = malloc(sizeof(fifo_transport_t));
+    if (ft == NULL) {
+        return NULL;
+    }
+    ft->ops.recv = fifo_recv;
+    ft->ops.open_reply = fifo_open_reply;
+    ft->ops.close_reply = fifo_close_reply;
+    ft->ops.destroy = fifo_destroy;
+    strcpy(ft->path, path);
+
+    unlink(path);
+    if (mkfifo(path, 0644) == -1) {
+        perror("Mkfifo error");
+        free(ft);
+        return NULL;
+    }
+    if ((ft->fserv = open(path, O_RDONLY)) == -1) {
+        perror("Open error");
+        unlink(path);
+        free(ft);
+        return NULL;
+    }
+
+    return &ft->ops;
+}
@@ -0,0 +1,180 @@
+#include "transport.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_EVENTS (32)
+
+typedef struct {
+    transport_t ops;
+    char path[TRANSPORT_PATH_MAX];
+    int listen_fd;
+    int epoll_fd;
+    /* events returned by the last epoll_wait, not yet handled */
+    struct epoll_event events[MAX_EVENTS];
+    int n_events;
+    int next_event;
+} socket_transport_t;
+
+static int watch(socket_transport_t *st, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("Epoll_ctl error");
+        return -1;
+    }
+    return 0;
+}
+
+static int socket_recv(transport_t *t, tfs_request_t *req, bool wait) {
+    socket_transport_t *st = (socket_transport_t *)t;
+
+    while (true) {
+        if (st->next_event == st->n_events) {
+            int n = epoll_wait(st->epoll_fd, st->events, MAX_EVENTS,
+                               wait ? -1 : 0);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Epoll_wait error");
+                return -1;
+            }
+            if (n == 0) {
+                return 2;
+            }
+            st->n_events = n;
+            st->next_event = 0;
+            continue;
+        }
+
+        struct epoll_event *ev = &st->events[st->next_event++];
+        int fd = ev->data.fd;
+
+        if (fd == st->listen_fd) {
+            int conn = accept(st->listen_fd, NULL, NULL);
+            if (conn == -1) {
+                perror("Accept error");
+                continue;
+            }
+            fcntl(conn, F_SETFD, FD_CLOEXEC);
+            if (watch(st, conn) == -1) {
+                close(conn);
+            }
+            continue;
+        }
+
+        /* one message is exactly one request */
+        uint64_t span = trace_begin();
+        ssize_t rd = recv(fd, req->buf, sizeof(req->buf), 0);
+        trace_end(TRACE_RECV, span);
+        if (rd == -1 &&
+            (errno == EINTR || errno == EAGAIN || errno == EBADF)) {
+            /* EBADF: a stale event of a session that was just unmounted */
+            continue;
+        }
+        req->conn = fd;
+        if (rd <= 0) {
+            /* the client went away, possibly without unmounting */
+            epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            return 1;
+        }
+        req->len = (size_t)rd;
+
+        /* the tag follows the session id, and is kept apart */
+        req->tag = 0;
+        if (req->buf[0] != TFS_OP_CODE_MOUNT) {
+            if (req->len < 5 + sizeof(tfs_tag_t)) {
+                fprintf(stderr, "Request too short\n");
+                continue;
+            }
+            memcpy(&req->tag, req->buf + 5, sizeof(tfs_tag_t));
+            req->len -= sizeof(tfs_tag_t);
+            memmove(req->buf + 5, req->buf + 5 + sizeof(tfs_tag_t),
+                    req->len - 5);
+        }
+        return 0;
+    }
+}
+
+static int socket_open_reply(transport_t *t, tfs_request_t const *req,
+                             char const *client_path) {
+    (void)t;
+    (void)client_path;
+
+    /* replies go back through the connection the mount came from */
+    return req->conn;
+}
+
+static void socket_close_reply(transport_t *t, int reply_fd) {
+    socket_transport_t *st = (socket_transport_t *)t;
+    epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, reply_fd, NULL);
+    close(reply_fd);
+}
+
+static void socket_destroy(transport_t *t) {
+    socket_transport_t *st = (socket_transport_t *)t;
+    close(st->epoll_fd);
+    close(st->listen_fd);
+    unlink(st->path);
+    free(st);
+}
+
+transport_t *socket_transport_create(char const *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+
+    socket_transport_t *st = malloc(sizeof(socket_transport_t));
+    if (st == NULL) {
+        return NULL;
+    }
+    st->ops.recv = socket_recv;
+    st->ops.open_reply = socket_open_reply;
+    st->ops.close_reply = socket_close_reply;
+    st->ops.destroy = socket_destroy;
+    strcpy(st->path, path);
+    st->n_events = st->next_event = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    unlink(path);
+    if ((st->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+        perror("Socket error");
+        free(st);
+        return NULL;
+    }
+    if (bind(st->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(st->listen_fd, SOMAXCONN) == -1) {
+        perror("Bind error");
+        close(st->listen_fd);
+        free(st);
+        return NULL;
+    }
+    if ((st->epoll_fd = epoll_create1(0)) == -1) {
+        perror("Epoll_create error");
+        close(st->listen_fd);
+        unlink(path);
+        free(st);
+        return NULL;
+    }
+    if (watch(st, st->listen_fd) == -1) {
+        socket_destroy(&st->ops);
+        return NULL;
+    }
+
+    return &st->ops;
+}
@@ -0,0 +1,74 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*  Checks that a checkpoint restores the contents files had when it was
+    started: files of every size (inline, in a fragment and in a block of
+    their own) are written, a checkpoint is started, and they are
+    overwritten while it is being written; once it is restored, the files
+    must read the old contents again, and be written as usual.
+    Note: This test uses TecnicoFS as a library, not
+    as a standalone server.
+*/
+
+#define CHECKPOINT_PATH "/tmp/tfs_checkpoint_test"
+
+static size_t const sizes[] = {20, FRAGMENT_SIZE, BLOCK_SIZE};
+#define FILES (sizeof(sizes) / sizeof(sizes[0]))
+
+static void write_files(char c) {
+    char name[MAX_FILE_NAME];
+    char buffer[BLOCK_SIZE];
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%zu", i);
+        memset(buffer, c, sizes[i]);
+        int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizes[i]) == (ssize_t)sizes[i]);
+        assert(tfs_close(f) != -1);
+    }
+}
+
+static void check_files(char c) {
+    char name[MAX_FILE_NAME];
+    char buffer[BLOCK_SIZE + 1];
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%zu", i);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)sizes[i]);
+        for (size_t j = 0; j < sizes[i]; j++) {
+            assert(buffer[j] == c);
+        }
+        assert(tfs_close(f) != -1);
+    }
+}
+
+int main() {
+    assert(tfs_init() != -1);
+    state_set_storage_delay(false);
+
+    write_files('a');
+    assert(tfs_checkpoint(CHECKPOINT_PATH) != -1);
+    write_files('b');
+    assert(tfs_checkpoint_wait() == 0);
+    check_files('b');
+
+    assert(tfs_restore(CHECKPOINT_PATH) == FILES);
+    check_files('a');
+    write_files('c');
+    check_files('c');
+
+    assert(tfs_restore("/nonexistent") == -1);
+    assert(tfs_open("/f0", 0) == -1);
+
+    assert(tfs_destroy() != -1);
+    unlink(CHECKPOINT_PATH);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
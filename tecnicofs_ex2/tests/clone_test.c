@@ -0,0 +1,75 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Checks that a clone and its source do not see each other's writes:
+    files of every size (inline, in a fragment and in a block of their own)
+    are cloned, and then the first bytes of the clone and the last bytes of
+    the source are overwritten; each must read its own writes and the
+    original contents everywhere else.
+    Note: This test uses TecnicoFS as a library, not
+    as a standalone server.
+*/
+
+static size_t const sizes[] = {20, FRAGMENT_SIZE, BLOCK_SIZE};
+#define FILES (sizeof(sizes) / sizeof(sizes[0]))
+#define OVERWRITTEN (8)
+
+static void write_at(char const *name, char c, size_t len, size_t offset) {
+    char buffer[BLOCK_SIZE];
+    memset(buffer, c, len);
+    int f = tfs_open(name, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_pwrite(f, buffer, len, offset) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+/* Checks that a file holds c everywhere but in [from, to), which holds d */
+static void check_file(char const *name, size_t size, char c, char d,
+                       size_t from, size_t to) {
+    char buffer[BLOCK_SIZE + 1];
+    int f = tfs_open(name, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)size);
+    for (size_t i = 0; i < size; i++) {
+        assert(buffer[i] == (i >= from && i < to ? d : c));
+    }
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char source[MAX_FILE_NAME];
+    char clone[MAX_FILE_NAME];
+
+    assert(tfs_init() != -1);
+    state_set_storage_delay(false);
+
+    for (size_t i = 0; i < FILES; i++) {
+        size_t size = sizes[i];
+        snprintf(source, sizeof(source), "/f%zu", i);
+        snprintf(clone, sizeof(clone), "/c%zu", i);
+        write_at(source, 'a', size, 0);
+        assert(tfs_clone(source, clone) != -1);
+        check_file(clone, size, 'a', 'a', 0, 0);
+
+        write_at(clone, 'b', OVERWRITTEN, 0);
+        check_file(clone, size, 'a', 'b', 0, OVERWRITTEN);
+        check_file(source, size, 'a', 'a', 0, 0);
+
+        write_at(source, 'c', OVERWRITTEN, size - OVERWRITTEN);
+        check_file(source, size, 'a', 'c', size - OVERWRITTEN, size);
+        check_file(clone, size, 'a', 'b', 0, OVERWRITTEN);
+    }
+
+    /* a clone replaces the contents of a file that exists */
+    assert(tfs_clone("/f0", "/c1") != -1);
+    check_file("/c1", sizes[0], 'a', 'c', sizes[0] - OVERWRITTEN, sizes[0]);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Checks that i-nodes whose blocks are shared by clones are truncated and
+    freed without taking the blocks from the clones: a file is cloned, the
+    clone is truncated and removed, and then the source is cloned again and
+    removed itself; every free i-node must then be reusable (over and
+    over), and writing to them must leave the last clone as it was. There
+    is no operation to remove a file, so the test removes them as one would.
+    Note: This test uses TecnicoFS as a library, not
+    as a standalone server.
+*/
+
+#define OVERWRITTEN (8)
+
+static void write_file(char const *name, int flags, char c, size_t size) {
+    char buffer[BLOCK_SIZE];
+    memset(buffer, c, size);
+    int f = tfs_open(name, TFS_O_CREAT | flags);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, size) == (ssize_t)size);
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *name, char c, size_t size) {
+    char buffer[BLOCK_SIZE + 1];
+    int f = tfs_open(name, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)size);
+    for (size_t i = 0; i < size; i++) {
+        assert(buffer[i] == c);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+static void remove_file(char const *name) {
+    int inumber = tfs_lookup(name);
+    assert(inumber != -1);
+    assert(clear_dir_entry(ROOT_DIR_INUM, inumber) != -1);
+    assert(inode_delete(inumber) != -1);
+    assert(tfs_lookup(name) == -1);
+}
+
+int main() {
+    char name[MAX_FILE_NAME];
+
+    assert(tfs_init() != -1);
+    state_set_storage_delay(false);
+
+    write_file("/f", 0, 'a', BLOCK_SIZE);
+    assert(tfs_clone("/f", "/c") != -1);
+    write_file("/c", TFS_O_TRUNC, 'b', OVERWRITTEN);
+    check_file("/c", 'b', OVERWRITTEN);
+    check_file("/f", 'a', BLOCK_SIZE);
+    remove_file("/c");
+    check_file("/f", 'a', BLOCK_SIZE);
+
+    assert(tfs_clone("/f", "/g") != -1);
+    remove_file("/f");
+    check_file("/g", 'a', BLOCK_SIZE);
+
+    /* the files fill the i-nodes or the root directory, and are then
+     * removed, often enough for every i-node to be reused */
+    int expected = INODE_TABLE_SIZE - 2;
+    if (expected > (int)MAX_DIR_ENTRIES - 1) {
+        expected = (int)MAX_DIR_ENTRIES - 1;
+    }
+    for (int round = 0; round * expected < 2 * INODE_TABLE_SIZE; round++) {
+        int created = 0;
+        for (;;) {
+            snprintf(name, sizeof(name), "/n%d", created);
+            int f = tfs_open(name, TFS_O_CREAT);
+            if (f == -1) {
+                break;
+            }
+            assert(tfs_close(f) != -1);
+            write_file(name, 0, (char)('n' + round), BLOCK_SIZE);
+            created++;
+        }
+        assert(created == expected);
+        check_file("/g", 'a', BLOCK_SIZE);
+        for (int i = 0; i < created; i++) {
+            snprintf(name, sizeof(name), "/n%d", i);
+            check_file(name, (char)('n' + round), BLOCK_SIZE);
+            remove_file(name);
+        }
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
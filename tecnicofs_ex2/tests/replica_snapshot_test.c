@@ -0,0 +1,73 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*  Checks that reading a file of a snapshot on a primary does not stop its
+    replicas, which have no snapshots: the server at primary_pipe_path must
+    be started with -l log_path and the one at replica_pipe_path with
+    -r log_path.
+*/
+
+static void pause_ms(long ms) {
+    struct timespec ts = {0, ms * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+static void put(tfs_session_t *s, char const *path, char const *str) {
+    int f = tfs_session_open(s, path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_session_write(s, f, str, strlen(str)) == (ssize_t)strlen(str));
+    assert(tfs_session_close(s, f) != -1);
+}
+
+static void check(tfs_session_t *s, char const *path, char const *str) {
+    char buffer[40];
+    int f = tfs_session_open(s, path, 0);
+    assert(f != -1);
+    ssize_t r = tfs_session_read(s, f, buffer, sizeof(buffer) - 1);
+    assert(r == (ssize_t)strlen(str));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str) == 0);
+    assert(tfs_session_close(s, f) != -1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "primary_pipe_path replica_pipe_path'\n");
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s_p", argv[1]);
+    tfs_session_t *primary = tfs_session_mount(path, argv[2]);
+    snprintf(path, sizeof(path), "%s_r", argv[1]);
+    tfs_session_t *replica = tfs_session_mount(path, argv[3]);
+    assert(primary != NULL && replica != NULL);
+
+    put(primary, "/f1", "AAA!");
+    int id = tfs_session_snapshot_create(primary);
+    assert(id != -1);
+    put(primary, "/f1", "BBB!");
+
+    /* the open and the close of the snapshot's file are not logged */
+    char name[64];
+    snprintf(name, sizeof(name), TFS_SNAPSHOT_PREFIX "%d/f1", id);
+    check(primary, name, "AAA!");
+
+    /* the replica goes on following the log */
+    put(primary, "/f2", "CCC!");
+    pause_ms(200);
+    check(replica, "/f1", "BBB!");
+    check(replica, "/f2", "CCC!");
+
+    assert(tfs_session_snapshot_delete(primary, id) != -1);
+    assert(tfs_session_unmount(replica) == 0);
+    assert(tfs_session_unmount(primary) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
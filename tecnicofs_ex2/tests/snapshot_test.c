@@ -0,0 +1,75 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Checks that a snapshot keeps the contents files had when it was taken:
+    files of every size (inline, in a fragment and in a block of their own)
+    are written, a snapshot is taken, and then they are overwritten; the
+    snapshot must still read the old contents, and the live FS the new ones.
+    Note: This test uses TecnicoFS as a library, not
+    as a standalone server.
+*/
+
+static size_t const sizes[] = {20, FRAGMENT_SIZE, BLOCK_SIZE};
+#define FILES (sizeof(sizes) / sizeof(sizes[0]))
+
+static void write_file(char const *name, char c, size_t size) {
+    char buffer[BLOCK_SIZE];
+    memset(buffer, c, size);
+    int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, size) == (ssize_t)size);
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *name, char c, size_t size) {
+    char buffer[BLOCK_SIZE + 1];
+    int f = tfs_open(name, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)size);
+    for (size_t i = 0; i < size; i++) {
+        assert(buffer[i] == c);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char name[MAX_FILE_NAME];
+    char snapshot_name[2 * MAX_FILE_NAME];
+
+    assert(tfs_init() != -1);
+    state_set_storage_delay(false);
+
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%zu", i);
+        write_file(name, 'a', sizes[i]);
+    }
+    int id = tfs_snapshot_create();
+    assert(id != -1);
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%zu", i);
+        write_file(name, 'b', sizes[i]);
+    }
+
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "/f%zu", i);
+        snprintf(snapshot_name, sizeof(snapshot_name),
+                 TFS_SNAPSHOT_PREFIX "%d/f%zu", id, i);
+        check_file(snapshot_name, 'a', sizes[i]);
+        check_file(name, 'b', sizes[i]);
+    }
+
+    /* snapshots are read-only */
+    snprintf(snapshot_name, sizeof(snapshot_name), TFS_SNAPSHOT_PREFIX "%d/f0",
+             id);
+    assert(tfs_open(snapshot_name, TFS_O_TRUNC) == -1);
+
+    assert(tfs_snapshot_delete(id) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
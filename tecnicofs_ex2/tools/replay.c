@@ -0,0 +1,243 @@
+#include "replay.h"
+#include "common/stats.h"
+#include "fs/capture.h"
+#include "fs/config.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t ops;
+    uint64_t mismatched; /* returned something else than when captured */
+    uint64_t captured[TFS_HIST_BUCKETS];
+    uint64_t replayed[TFS_HIST_BUCKETS];
+} op_report_t;
+
+static op_report_t report[TFS_OP_CODE_COUNT];
+
+/* captured handle -> replayed handle (-1 if not open) */
+static int handles[MAX_OPEN_FILES];
+
+static char *buffer;
+static size_t buffer_size;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t) {
+    uint64_t now = now_ns();
+    if (now < t) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)((t - now) / 1000000000);
+        ts.tv_nsec = (long)((t - now) % 1000000000);
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int grow_buffer(size_t len) {
+    if (len <= buffer_size) {
+        return 0;
+    }
+    char *b = realloc(buffer, len);
+    if (b == NULL) {
+        return -1;
+    }
+    memset(b + buffer_size, 'r', len - buffer_size);
+    buffer = b;
+    buffer_size = len;
+    return 0;
+}
+
+/*
+ * Replays one file operation.
+ * Returns its result, or -2 if it does not apply (unknown handle, or not
+ * a file operation).
+ */
+static ssize_t replay_op(replay_target_t const *target,
+                         capture_record_t const *rec, char const *name) {
+    if (rec->opcode == TFS_OP_CODE_OPEN) {
+        int fh = target->open(name, rec->flags);
+        if (rec->result >= 0 && rec->result < MAX_OPEN_FILES) {
+            handles[rec->result] = fh;
+        }
+        return fh;
+    }
+
+    bool file_op = rec->opcode == TFS_OP_CODE_CLOSE ||
+                   rec->opcode == TFS_OP_CODE_WRITE ||
+                   rec->opcode == TFS_OP_CODE_READ ||
+                   rec->opcode == TFS_OP_CODE_SHM_WRITE ||
+                   rec->opcode == TFS_OP_CODE_SHM_READ ||
+                   rec->opcode == TFS_OP_CODE_PWRITE;
+    if (!file_op || rec->handle < 0 || rec->handle >= MAX_OPEN_FILES ||
+        handles[rec->handle] == -1) {
+        return -2;
+    }
+    int fh = handles[rec->handle];
+
+    switch (rec->opcode) {
+    case TFS_OP_CODE_CLOSE:
+        handles[rec->handle] = -1;
+        return target->close(fh);
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_SHM_WRITE:
+    case TFS_OP_CODE_PWRITE: /* at the handle's offset, not the captured one */
+        if (grow_buffer(rec->len) == -1) {
+            return -1;
+        }
+        return target->write(fh, buffer, rec->len);
+    default:
+        if (grow_buffer(rec->len) == -1) {
+            return -1;
+        }
+        return target->read(fh, buffer, rec->len);
+    }
+}
+
+static void print_report(uint64_t ops, uint64_t skipped, uint64_t captured_ns,
+                         uint64_t replayed_ns, FILE *json) {
+    double captured_s = (double)captured_ns / 1e9;
+    double replayed_s = (double)replayed_ns / 1e9;
+    printf("%lu operations (%lu skipped)\n", (unsigned long)ops,
+           (unsigned long)skipped);
+    printf("captured: %.3f s, %.0f ops/s\n", captured_s,
+           captured_s > 0 ? (double)ops / captured_s : 0);
+    printf("replayed: %.3f s, %.0f ops/s\n\n", replayed_s,
+           replayed_s > 0 ? (double)ops / replayed_s : 0);
+    printf("%-12s %8s %10s %12s %12s %12s %12s\n", "op", "count",
+           "mismatch", "cap p50 us", "cap p99 us", "rep p50 us",
+           "rep p99 us");
+
+    if (json != NULL) {
+        fprintf(json,
+                "{\n  \"ops\": %lu,\n  \"skipped\": %lu,\n"
+                "  \"captured_s\": %.6f,\n  \"replayed_s\": %.6f,\n"
+                "  \"by_op\": [",
+                (unsigned long)ops, (unsigned long)skipped, captured_s,
+                replayed_s);
+    }
+    bool first = true;
+    for (int i = 0; i < TFS_OP_CODE_COUNT; i++) {
+        op_report_t *r = &report[i];
+        if (r->ops == 0) {
+            continue;
+        }
+        double cap50 = (double)tfs_hist_percentile(r->captured, 0.5) / 1e3;
+        double cap99 = (double)tfs_hist_percentile(r->captured, 0.99) / 1e3;
+        double rep50 = (double)tfs_hist_percentile(r->replayed, 0.5) / 1e3;
+        double rep99 = (double)tfs_hist_percentile(r->replayed, 0.99) / 1e3;
+        printf("%-12s %8lu %10lu %12.2f %12.2f %12.2f %12.2f\n",
+               tfs_op_code_name(i), (unsigned long)r->ops,
+               (unsigned long)r->mismatched, cap50, cap99, rep50, rep99);
+        if (json != NULL) {
+            fprintf(json,
+                    "%s\n    {\"op\": \"%s\", \"count\": %lu, "
+                    "\"mismatched\": %lu, \"captured_p50_us\": %.3f, "
+                    "\"captured_p99_us\": %.3f, \"replayed_p50_us\": %.3f, "
+                    "\"replayed_p99_us\": %.3f}",
+                    first ? "" : ",", tfs_op_code_name(i),
+                    (unsigned long)r->ops, (unsigned long)r->mismatched,
+                    cap50, cap99, rep50, rep99);
+        }
+        first = false;
+    }
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+    }
+}
+
+int replay_main(int argc, char **argv, replay_target_t const *target) {
+    bool timed = false;
+    char const *json_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "tj:")) != -1) {
+        if (opt == 't') {
+            timed = true;
+        } else if (opt == 'j') {
+            json_path = optarg;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind != 1 + target->args) {
+        printf("Usage: %s [-t] [-j output.json] capture_path %s\n"
+               "  -t: keep the captured timing (default: as fast as "
+               "possible)\n",
+               argv[0], target->usage);
+        return 1;
+    }
+
+    FILE *capture = capture_open(argv[optind]);
+    if (capture == NULL) {
+        return 1;
+    }
+    FILE *json = NULL;
+    if (json_path != NULL && (json = fopen(json_path, "w")) == NULL) {
+        perror("Open error");
+        fclose(capture);
+        return 1;
+    }
+    if (target->setup(argv + optind + 1) == -1) {
+        fclose(capture);
+        return 1;
+    }
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        handles[i] = -1;
+    }
+
+    capture_record_t rec;
+    char name[MAX_FILE_NAME + 1];
+    uint64_t ops = 0, skipped = 0, first = 0, last = 0;
+    uint64_t start = now_ns();
+    int r;
+    while ((r = capture_next(capture, &rec, name, sizeof(name))) == 1) {
+        if (ops + skipped == 0) {
+            first = rec.time_ns;
+        }
+        if (timed) {
+            sleep_until(start + rec.time_ns - first);
+        }
+
+        uint64_t t = now_ns();
+        ssize_t ret = replay_op(target, &rec, name);
+        uint64_t latency = now_ns() - t;
+        if (ret == -2 || rec.opcode >= TFS_OP_CODE_COUNT) {
+            skipped++;
+            continue;
+        }
+
+        op_report_t *op = &report[rec.opcode];
+        op->ops++;
+        op->captured[tfs_hist_bucket(rec.latency_ns)]++;
+        op->replayed[tfs_hist_bucket(latency)]++;
+        /* new handles may differ, but not whether the open failed */
+        if (rec.opcode == TFS_OP_CODE_OPEN ? (ret == -1) != (rec.result == -1)
+                                           : ret != rec.result) {
+            op->mismatched++;
+        }
+        ops++;
+        last = rec.time_ns + rec.latency_ns;
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (r == -1) {
+        fprintf(stderr, "Corrupt capture after %lu records\n",
+                (unsigned long)(ops + skipped));
+    }
+
+    target->teardown();
+    fclose(capture);
+    print_report(ops, skipped, last - first, elapsed, json);
+    if (json != NULL) {
+        fclose(json);
+    }
+    free(buffer);
+    return r == -1 ? 1 : 0;
+}
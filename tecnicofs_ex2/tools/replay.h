@@ -0,0 +1,29 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <sys/types.h>
+
+/*
+ * Replay of a workload capture (fs/capture.h), shared by the replay tools:
+ * the operations are the same whether they go to the library or to a
+ * server, only where they are sent changes.
+ */
+typedef struct {
+    char const *usage; /* of the arguments that follow the capture */
+    int args;          /* how many of them */
+    int (*setup)(char **args);
+    void (*teardown)();
+    int (*open)(char const *name, int flags);
+    int (*close)(int fhandle);
+    ssize_t (*write)(int fhandle, void const *buffer, size_t len);
+    ssize_t (*read)(int fhandle, void *buffer, size_t len);
+} replay_target_t;
+
+/*
+ * Parses the command line, replays the capture against a target and
+ * prints how it fared against the captured run.
+ * Returns the program's exit status.
+ */
+int replay_main(int argc, char **argv, replay_target_t const *target);
+
+#endif // REPLAY_H
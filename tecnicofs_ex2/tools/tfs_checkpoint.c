@@ -0,0 +1,36 @@
+#include "client/tecnicofs_client_api.h"
+#include <stdio.h>
+#include <time.h>
+
+/*  Has a running TecnicoFS server write a checkpoint of its files (to a
+    path on its host), and waits until it is written; the server keeps
+    serving its clients meanwhile. Start the server with -k path to
+    restore them.
+    Usage: tfs_checkpoint client_pipe_path server_pipe_path path
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path path'\n");
+        return 1;
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = tfs_checkpoint(argv[3]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tfs_unmount();
+
+    if (ret == -1) {
+        printf("The server could not write the checkpoint\n");
+        return 1;
+    }
+    printf("Checkpoint written to %s in %.1f ms\n", argv[3],
+           (double)(end.tv_sec - start.tv_sec) * 1e3 +
+               (double)(end.tv_nsec - start.tv_nsec) / 1e6);
+    return 0;
+}
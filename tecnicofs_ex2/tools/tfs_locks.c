@@ -0,0 +1,32 @@
+#include "client/tecnicofs_client_api.h"
+#include <stdio.h>
+
+/*  Prints the lock contention report of a running TecnicoFS server: for
+    every place the state lock is taken, how often it was acquired, how
+    often it had to wait, and the time spent waiting for and holding it.
+    The server must be built with EXTRA_CFLAGS=-DTFS_LOCK_PROFILE.
+    Usage: tfs_locks client_pipe_path server_pipe_path
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+    static char report[TFS_LOCK_REPORT_SIZE];
+    ssize_t len = tfs_lock_report(report, sizeof(report));
+    tfs_unmount();
+
+    if (len == -1) {
+        printf("No lock profile (is the server built with "
+               "-DTFS_LOCK_PROFILE?)\n");
+        return 1;
+    }
+    fputs(report, stdout);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "client/tecnicofs_client_api.h"
+#include "replay.h"
+
+/*  Replays a workload captured by a TecnicoFS server (tfs_server -c) against
+    a live server, as fast as possible or with the captured timing (-t),
+    and compares the latencies with the captured ones. The captured
+    latencies are measured inside the server, the replayed ones include the
+    round trip to it.
+    The operations of every captured session are sent through a single
+    session (file handles are shared by all sessions).
+    Usage: tfs_replay [-t] [-j output.json] capture_path client_pipe_path
+                      server_pipe_path
+*/
+
+static int setup(char **args) { return tfs_mount(args[0], args[1]); }
+
+static void teardown() { tfs_unmount(); }
+
+int main(int argc, char **argv) {
+    replay_target_t target = {
+        .usage = "client_pipe_path server_pipe_path",
+        .args = 2,
+        .setup = setup,
+        .teardown = teardown,
+        .open = tfs_open,
+        .close = tfs_close,
+        .write = tfs_write,
+        .read = tfs_read,
+    };
+    return replay_main(argc, argv, &target);
+}
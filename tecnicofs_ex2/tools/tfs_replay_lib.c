@@ -0,0 +1,31 @@
+#include "fs/operations.h"
+#include "replay.h"
+
+/*  Replays a workload captured by a TecnicoFS server (tfs_server -c)
+    directly against the library (operations.c) of this build, as fast as
+    possible or with the captured timing (-t), and compares the latencies
+    with the captured ones (measured in the server, so these exclude the
+    transport on both sides).
+    Usage: tfs_replay_lib [-t] [-j output.json] capture_path
+*/
+
+static int setup(char **args) {
+    (void)args;
+    return tfs_init();
+}
+
+static void teardown() { tfs_destroy(); }
+
+int main(int argc, char **argv) {
+    replay_target_t target = {
+        .usage = "",
+        .args = 0,
+        .setup = setup,
+        .teardown = teardown,
+        .open = tfs_open,
+        .close = tfs_close,
+        .write = tfs_write,
+        .read = tfs_read,
+    };
+    return replay_main(argc, argv, &target);
+}
@@ -0,0 +1,177 @@
+#include "common/common.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*  Starts a sharded TecnicoFS: N server processes, the pipe (or socket) of
+    shard i being map_path.i, and then writes the shard map at map_path.
+    Clients mount map_path like the pipe of a single server, and the client
+    library sends each path to the shard that owns it. The shards run until
+    they all exit (e.g. after tfs_shutdown_after_all_closed) or the launcher
+    is interrupted, which stops them; the map and the pipes are removed
+    either way.
+    Usage: tfs_shards [-n shards] [-t fifo|socket] [-z]
+                      [-s server_executable] map_path
+*/
+
+/* longest pipe path of a shard (as read back by the client library) */
+#define SHARD_PATH_SIZE (256)
+
+static pid_t shards[TFS_MAX_SHARDS];
+static int n_shards = 4;
+
+/* Waits (up to 5 s) for a shard to create its pipe */
+static bool wait_for(char const *path) {
+    struct timespec pause = {0, 10 * 1000 * 1000};
+    struct stat st;
+    for (int i = 0; i < 500; i++) {
+        if (stat(path, &st) == 0) {
+            return true;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+static void stop_all() {
+    for (int i = 0; i < n_shards; i++) {
+        if (shards[i] > 0) {
+            kill(shards[i], SIGTERM);
+        }
+    }
+}
+
+/* Writes the map, under a temporary name, so clients never see half of it */
+static int write_map(char const *map_path) {
+    char tmp[SHARD_PATH_SIZE];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", map_path);
+    FILE *map = fopen(tmp, "w");
+    if (map == NULL) {
+        perror("Fopen error");
+        return -1;
+    }
+    for (int i = 0; i < n_shards; i++) {
+        fprintf(map, "%s.%d\n", map_path, i);
+    }
+    if (fclose(map) != 0 || rename(tmp, map_path) == -1) {
+        perror("Write error");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char const *transport = "fifo";
+    char const *server = "fs/tfs_server";
+    bool zerocopy = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:zs:")) != -1) {
+        if (opt == 'n') {
+            n_shards = atoi(optarg);
+        } else if (opt == 't') {
+            transport = optarg;
+        } else if (opt == 'z') {
+            zerocopy = true;
+        } else if (opt == 's') {
+            server = optarg;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: %s [-n shards] [-t fifo|socket] [-z] "
+               "[-s server_executable] map_path\n",
+               argv[0]);
+        return 1;
+    }
+    if (n_shards <= 0 || n_shards > TFS_MAX_SHARDS) {
+        printf("shards must be in [1, %d]\n", TFS_MAX_SHARDS);
+        return 1;
+    }
+    char const *map_path = argv[optind];
+    unlink(map_path);
+
+    /* the signals are only taken when the launcher waits for them */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    for (int i = 0; i < n_shards; i++) {
+        char path[SHARD_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s.%d", map_path, i);
+        /* a pipe left behind by an earlier run would look like a new one */
+        unlink(path);
+        shards[i] = fork();
+        if (shards[i] == -1) {
+            perror("Fork error");
+            stop_all();
+            return 1;
+        }
+        if (shards[i] == 0) {
+            sigprocmask(SIG_UNBLOCK, &set, NULL);
+            char *args[6];
+            int n = 0;
+            args[n++] = (char *)server;
+            args[n++] = "-t";
+            args[n++] = (char *)transport;
+            if (zerocopy) {
+                args[n++] = "-z";
+            }
+            args[n++] = path;
+            args[n] = NULL;
+            execv(server, args);
+            perror("Exec error");
+            _exit(1);
+        }
+        if (!wait_for(path)) {
+            fprintf(stderr, "shard %d did not start\n", i);
+            stop_all();
+            return 1;
+        }
+    }
+    if (write_map(map_path) == -1) {
+        stop_all();
+        return 1;
+    }
+    printf("%d shards listed in %s\n", n_shards, map_path);
+    fflush(stdout);
+
+    int running = n_shards;
+    while (running > 0) {
+        int sig;
+        sigwait(&set, &sig);
+        if (sig != SIGCHLD) {
+            stop_all();
+        }
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (int i = 0; i < n_shards; i++) {
+                if (shards[i] == pid) {
+                    shards[i] = 0;
+                    running--;
+                }
+            }
+        }
+    }
+
+    unlink(map_path);
+    /* a stopped shard leaves its pipe behind */
+    for (int i = 0; i < n_shards; i++) {
+        char path[SHARD_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s.%d", map_path, i);
+        unlink(path);
+    }
+    return 0;
+}
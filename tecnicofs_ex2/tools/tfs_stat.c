@@ -0,0 +1,85 @@
+#include "client/tecnicofs_client_api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*  Polls a running TecnicoFS server for its statistics and prints, for
+    each interval, the rate and latency percentiles of every operation,
+    the time spent waiting for the state lock and the simulated storage
+    accesses. With count 0 it runs until interrupted.
+    Usage: tfs_stat client_pipe_path server_pipe_path [interval_s] [count]
+*/
+
+static void print_stats(tfs_stats_t const *delta, double interval) {
+    printf("%-10s %10s %10s %10s %10s %10s %10s\n", "op", "ops/s",
+           "in KB/s", "out KB/s", "p50 us", "p99 us", "p999 us");
+    for (int op = 0; op < TFS_OP_CODE_COUNT; op++) {
+        tfs_op_stats_t const *s = &delta->ops[op];
+        if (s->count == 0) {
+            continue;
+        }
+        printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               tfs_op_code_name(op), (double)s->count / interval,
+               (double)s->bytes_in / interval / 1e3,
+               (double)s->bytes_out / interval / 1e3,
+               (double)tfs_hist_percentile(s->latency, 0.5) / 1e3,
+               (double)tfs_hist_percentile(s->latency, 0.99) / 1e3,
+               (double)tfs_hist_percentile(s->latency, 0.999) / 1e3);
+    }
+    printf("lock: %lu acquisitions, %lu contended, %.3f ms waiting\n",
+           (unsigned long)delta->lock_acquisitions,
+           (unsigned long)delta->lock_contended,
+           (double)delta->lock_wait_ns / 1e6);
+    printf("storage: %.1f accesses/s   sessions: %lu\n",
+           (double)delta->storage_accesses / interval,
+           (unsigned long)delta->sessions);
+    printf("leases: %lu granted, %lu revoked\n\n",
+           (unsigned long)delta->lease_grants,
+           (unsigned long)delta->lease_revocations);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [interval_s] [count]'\n");
+        return 1;
+    }
+
+    int interval = argc > 3 ? atoi(argv[3]) : 1;
+    long count = argc > 4 ? atol(argv[4]) : 0;
+    if (interval <= 0) {
+        interval = 1;
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+
+    static tfs_stats_t before, after;
+    if (tfs_stats(&before) == -1) {
+        return 1;
+    }
+
+    for (long i = 0; count == 0 || i < count; i++) {
+        struct timespec ts = {interval, 0};
+        nanosleep(&ts, NULL);
+
+        if (tfs_stats(&after) == -1) {
+            return 1;
+        }
+        tfs_stats_t *delta = malloc(sizeof(tfs_stats_t));
+        if (delta == NULL) {
+            return 1;
+        }
+        memcpy(delta, &after, sizeof(tfs_stats_t));
+        tfs_stats_diff(delta, &before);
+        print_stats(delta, (double)interval);
+        free(delta);
+
+        memcpy(&before, &after, sizeof(tfs_stats_t));
+    }
+
+    tfs_unmount();
+    return 0;
+}
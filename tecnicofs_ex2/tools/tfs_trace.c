@@ -0,0 +1,44 @@
+#include "client/tecnicofs_client_api.h"
+#include <stdio.h>
+#include <string.h>
+
+/*  Switches the request tracing of a running TecnicoFS server on or off,
+    or makes it dump the spans recorded so far to a Chrome trace event
+    JSON file (written by the server, so the path is on its host).
+    Tracing can also be enabled from startup with TFS_TRACE=1.
+    Usage: tfs_trace client_pipe_path server_pipe_path on|off|dump [path]
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path on|off|dump [path]'\n");
+        return 1;
+    }
+
+    int command;
+    char const *path = NULL;
+    if (strcmp(argv[3], "on") == 0) {
+        command = TFS_TRACE_ON;
+    } else if (strcmp(argv[3], "off") == 0) {
+        command = TFS_TRACE_OFF;
+    } else if (strcmp(argv[3], "dump") == 0 && argc > 4) {
+        command = TFS_TRACE_DUMP;
+        path = argv[4];
+    } else {
+        printf("Unknown command (dump needs a path)\n");
+        return 1;
+    }
+
+    if (tfs_mount(argv[1], argv[2]) == -1) {
+        return 1;
+    }
+    int ret = tfs_trace(command, path);
+    tfs_unmount();
+
+    if (ret == -1) {
+        printf("The server could not %s\n", argv[3]);
+        return 1;
+    }
+    return 0;
+}